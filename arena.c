@@ -0,0 +1,358 @@
+//
+//  arena.c
+//  logo
+//
+//  Region allocator. Each stage of the pipeline carves its memory from an arena and
+//  gives it all back in one call, and every arena's use is totted up per stage.
+//
+#include "main.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGNMENT 16
+#define ALIGN_UP(n) (((n)+ARENA_ALIGNMENT-1) & ~(unsigned long)(ARENA_ALIGNMENT-1))
+#define ARENA_HEADER_SIZE ALIGN_UP(sizeof(arenaBlock))
+#define MAX_STAGES 16
+
+struct arenaBlock {
+    struct arenaBlock * next;//the block allocated before this one
+    unsigned long size;//bytes that can be carved from this block
+    unsigned long used;
+};
+
+typedef struct stageStats {
+    const char * stage;
+    unsigned long releases, allocations, bytes, mallocs, peakBytes;
+} stageStats;
+
+//totals for every arena released so far, see printArenaStats()
+static stageStats stageTotals[MAX_STAGES];
+static int numberOfStages = 0;
+
+#pragma mark prototypes
+arenaBlock * newArenaBlock(arena * a, unsigned long size);
+unsigned char * blockData(arenaBlock * block);
+void recordArenaStats(arena * a);
+
+#pragma mark Unit Test Prototypes
+void testArenaAlloc();
+void testArenaGrow();
+void testResetArena();
+
+#pragma mark Arena Functions
+/**
+ Module interface,
+ Returns an empty arena whose use will be reported under stage. stage should be a
+ string literal as it is kept, not copied.
+ */
+arena * initArena(const char * stage)
+{
+    arena * a = malloc(sizeof(arena));
+    if(a==NULL)
+    {
+        printError("arena * a = malloc(sizeof(arena)) failed exiting.",__FILE__,__FUNCTION__,__LINE__);
+        exit(1);
+    }
+    a->stage = stage;
+    a->blocks = NULL;
+    a->allocations = 0;
+    a->bytes = 0;
+    a->mallocs = 0;
+    a->numberOfBlocks = 0;
+    a->blockBytes = 0;
+    a->peakBytes = 0;
+    return a;
+}
+
+/**
+ Module interface,
+ Returns size bytes from a, aligned for any type. Never returns NULL.
+ */
+void * arenaAlloc(arena * a, unsigned long size)
+{
+    unsigned long alignedSize = ALIGN_UP(size ? size : 1);
+    arenaBlock * block = a->blocks;
+    if(block==NULL || block->size-block->used < alignedSize)
+    {
+        //a big allocation gets a block of its own, with room to spare for the small ones that follow it
+        block = newArenaBlock(a, alignedSize > ARENA_BLOCK_SIZE ? alignedSize+ARENA_BLOCK_SIZE : ARENA_BLOCK_SIZE);
+    }
+    void * allocation = blockData(block)+block->used;
+    block->used += alignedSize;
+    ++a->allocations;
+    a->bytes += size;
+    return allocation;
+}
+
+/**
+ Module interface,
+ The arena version of realloc for arrays that grow geometrically. The newest allocation
+ is extended in place if its block has room and an allocation that has a block to itself
+ is realloc'd, otherwise the oldSize bytes at old are copied to a new allocation and
+ the old one is left for the arena to reclaim.
+ */
+void * arenaGrow(arena * a, void * old, unsigned long oldSize, unsigned long newSize)
+{
+    if(old==NULL) return arenaAlloc(a, newSize);
+    unsigned long alignedOldSize = ALIGN_UP(oldSize ? oldSize : 1);
+    unsigned long alignedNewSize = ALIGN_UP(newSize);
+    arenaBlock * head = a->blocks;
+    unsigned char * start = old;
+    if(start+alignedOldSize==blockData(head)+head->used &&
+       head->size-(head->used-alignedOldSize) >= alignedNewSize)
+    {
+        head->used += alignedNewSize-alignedOldSize;
+        ++a->allocations;
+        a->bytes += newSize-oldSize;
+        return old;
+    }
+    for(arenaBlock ** link = &a->blocks; *link!=NULL; link = &(*link)->next)
+    {
+        arenaBlock * block = *link;
+        if(start!=blockData(block) || block->used!=alignedOldSize) continue;
+        //old is the only allocation in its block so the block can be realloc'd
+        arenaBlock * tmp = realloc(block, ARENA_HEADER_SIZE+alignedNewSize);
+        if(tmp==NULL)
+        {
+            printError("realloc failed exiting.",__FILE__,__FUNCTION__,__LINE__);
+            exit(1);
+        }
+        a->blockBytes += alignedNewSize-tmp->size;
+        if(a->blockBytes > a->peakBytes) a->peakBytes = a->blockBytes;
+        tmp->size = alignedNewSize;
+        tmp->used = alignedNewSize;
+        *link = tmp;
+        ++a->mallocs;
+        ++a->allocations;
+        a->bytes += newSize-oldSize;
+        return blockData(tmp);
+    }
+    void * allocation = arenaAlloc(a, newSize);
+    memcpy(allocation, old, oldSize);
+    return allocation;
+}
+
+/**
+ Module interface,
+ Copies the NUL terminated string in to a.
+ */
+char * arenaStrdup(arena * a, const char * string)
+{
+    unsigned long length = strlen(string)+1;
+    return memcpy(arenaAlloc(a, length), string, length);
+}
+
+/**
+ Module interface,
+ Gives back everything allocated from a but keeps its biggest block for reuse, so an
+ arena reset between programs or frames stops mallocing once it has warmed up.
+ */
+void resetArena(arena * a)
+{
+    recordArenaStats(a);
+    if(a->blocks==NULL) return;
+    arenaBlock * biggest = a->blocks;
+    for(arenaBlock * block = a->blocks; block!=NULL; block = block->next)
+    {
+        if(block->size > biggest->size) biggest = block;
+    }
+    arenaBlock * block = a->blocks;
+    while(block!=NULL)
+    {
+        arenaBlock * next = block->next;
+        if(block!=biggest)
+        {
+            a->blockBytes -= block->size;
+            free(block);
+        }
+        block = next;
+    }
+    a->blocks = biggest;
+    a->blocks->next = NULL;
+    a->blocks->used = 0;
+    a->numberOfBlocks = 1;
+    a->mallocs = 0;
+    a->allocations = 0;
+    a->bytes = 0;
+}
+
+/**
+ Module interface,
+ Frees a and everything allocated from it.
+ */
+void freeArena(arena * a)
+{
+    if(a==NULL) return;
+    recordArenaStats(a);
+    arenaBlock * block = a->blocks;
+    while(block!=NULL)
+    {
+        arenaBlock * next = block->next;
+        free(block);
+        block = next;
+    }
+    free(a);
+}
+
+/**
+ Mallocs a block with room for size bytes and makes it a's newest.
+ */
+arenaBlock * newArenaBlock(arena * a, unsigned long size)
+{
+    arenaBlock * block = malloc(ARENA_HEADER_SIZE+size);
+    if(block==NULL)
+    {
+        printError("arenaBlock * block = malloc(ARENA_HEADER_SIZE+size) failed exiting.",__FILE__,__FUNCTION__,__LINE__);
+        exit(1);
+    }
+    block->next = a->blocks;
+    block->size = size;
+    block->used = 0;
+    a->blocks = block;
+    ++a->mallocs;
+    ++a->numberOfBlocks;
+    a->blockBytes += size;
+    if(a->blockBytes > a->peakBytes) a->peakBytes = a->blockBytes;
+    return block;
+}
+
+unsigned char * blockData(arenaBlock * block)
+{
+    return (unsigned char *)block+ARENA_HEADER_SIZE;
+}
+
+#pragma mark Stats Functions
+/**
+ Adds what a has done since it was made or last reset to its stage's totals.
+ */
+void recordArenaStats(arena * a)
+{
+    int i = 0;
+    while(i<numberOfStages && strcmp(stageTotals[i].stage, a->stage)!=0) ++i;
+    if(i==numberOfStages)
+    {
+        if(numberOfStages==MAX_STAGES) return;
+        stageTotals[numberOfStages++] = (stageStats){ a->stage, 0, 0, 0, 0, 0 };
+    }
+    ++stageTotals[i].releases;
+    stageTotals[i].allocations += a->allocations;
+    stageTotals[i].bytes += a->bytes;
+    stageTotals[i].mallocs += a->mallocs;
+    if(a->peakBytes > stageTotals[i].peakBytes) stageTotals[i].peakBytes = a->peakBytes;
+}
+
+/**
+ Module interface,
+ Prints, for each stage, how many times its arenas were reset or freed, how many
+ allocations and bytes were carved from them, the number of times they called malloc
+ or realloc and the most any one arena held at once.
+ Arenas still in use are not counted until they are reset or freed.
+ */
+void printArenaStats()
+{
+    printf("\n%-10s %10s %14s %14s %10s %14s\n", "stage", "releases", "allocations", "bytes", "mallocs", "peak bytes");
+    for(int i=0; i<numberOfStages; ++i)
+    {
+        stageStats * s = &stageTotals[i];
+        printf("%-10s %10lu %14lu %14lu %10lu %14lu\n", s->stage, s->releases, s->allocations, s->bytes, s->mallocs, s->peakBytes);
+    }
+    printf("\n");
+}
+
+#pragma mark Unit Test Functions
+void unitTests_arena()
+{
+    sput_start_testing();
+    sput_set_output_stream(NULL);
+
+    sput_enter_suite("testArenaAlloc()");
+    sput_run_test(testArenaAlloc);
+    sput_leave_suite();
+
+    sput_enter_suite("testArenaGrow()");
+    sput_run_test(testArenaGrow);
+    sput_leave_suite();
+
+    sput_enter_suite("testResetArena()");
+    sput_run_test(testResetArena);
+    sput_leave_suite();
+
+    sput_finish_testing();
+}
+
+void testArenaAlloc()
+{
+    arena * a = initArena("test");
+    char * first = arenaAlloc(a, 3);
+    double * second = arenaAlloc(a, sizeof(double));
+    sput_fail_unless(((unsigned long)second)%ARENA_ALIGNMENT==0, "Allocations should be aligned for any type.");
+    sput_fail_unless((char *)second>=first+3, "Allocations should not overlap.");
+    for(int i=0; i<10000; ++i)
+    {
+        arenaAlloc(a, 24);
+    }
+    sput_fail_unless(a->allocations==10002 && a->bytes==3+sizeof(double)+10000*24,
+                     "The arena should count every allocation and the bytes asked for.");
+    sput_fail_unless(a->numberOfBlocks<=1+10000*ALIGN_UP(24)/ARENA_BLOCK_SIZE+1,
+                     "Small allocations should share blocks rather than each being malloc'd.");
+    void * big = arenaAlloc(a, 4*ARENA_BLOCK_SIZE);
+    sput_fail_unless(big!=NULL && a->blocks->size>=4*ARENA_BLOCK_SIZE,
+                     "An allocation bigger than a block should get a block of its own.");
+    char * copy = arenaStrdup(a, "arena");
+    sput_fail_unless(strcmp(copy, "arena")==0, "arenaStrdup should copy the string.");
+    freeArena(a);
+}
+
+void testArenaGrow()
+{
+    arena * a = initArena("test");
+    int * array = arenaGrow(a, NULL, 0, 4*sizeof(int));
+    for(int i=0; i<4; ++i) array[i] = i;
+    int * grown = arenaGrow(a, array, 4*sizeof(int), 8*sizeof(int));
+    sput_fail_unless(grown==array, "The newest allocation should be grown in place.");
+    arenaAlloc(a, 8);
+    grown = arenaGrow(a, array, 8*sizeof(int), 16*sizeof(int));
+    sput_fail_unless(grown!=array && grown[3]==3, "An older allocation should be copied when it grows.");
+    int capacity = 1024;
+    int * big = arenaAlloc(a, capacity*sizeof(int));
+    for(int i=0; i<capacity; ++i) big[i] = i;
+    unsigned long blocks = a->numberOfBlocks;
+    for(; capacity<1<<20; capacity *= 2)
+    {
+        big = arenaGrow(a, big, capacity*sizeof(int), 2*capacity*sizeof(int));
+    }
+    sput_fail_unless(big[1023]==1023 && a->numberOfBlocks<=blocks+2,
+                     "An array with a block to itself should be realloc'd, not copied to a new block each time.");
+    freeArena(a);
+}
+
+void testResetArena()
+{
+    arena * a = initArena("test");
+    for(int i=0; i<5000; ++i)
+    {
+        arenaAlloc(a, 64);
+    }
+    resetArena(a);
+    sput_fail_unless(a->numberOfBlocks==1 && a->allocations==0 && a->blocks->used==0,
+                     "Reset should give back everything but one block.");
+    unsigned long blockBytes = a->blockBytes;
+    for(int run=0; run<1000; ++run)
+    {
+        arenaAlloc(a, 100);
+        arenaAlloc(a, 200);
+        resetArena(a);
+    }
+    sput_fail_unless(a->numberOfBlocks==1 && a->blockBytes==blockBytes,
+                     "Reusing a reset arena should not malloc any more blocks.");
+    for(int frame=0; frame<3; ++frame)
+    {
+        resetArena(a);
+        arenaAlloc(a, 16);
+        arenaAlloc(a, 3*ARENA_BLOCK_SIZE);
+    }
+    sput_fail_unless(a->mallocs==0,
+                     "Once it has warmed up a reset arena should hold a frame's small and big allocations without mallocing.");
+    freeArena(a);
+}
@@ -8,8 +8,16 @@
 #include "main.h"
 #include "debug.h"
 #include <stdio.h>
+#include <math.h>
 #include <SDL2/SDL.h>
 
+/* What renderPath has handed to the renderer, printed on exit if RENDER_STATS is set. */
+typedef struct renderStats {
+  unsigned long frames, batches, points;
+  unsigned long rasters;//times the path was drawn in to the texture cache
+  Uint64 submitTicks;//SDL performance counter ticks spent in the draw line and texture copy calls
+} renderStats;
+
 typedef struct display {
   SDL_bool finished;
   SDL_bool skip;
@@ -17,7 +25,7 @@ typedef struct display {
   int winSize[2];
   SDL_Renderer *renderer;
   SDL_Event *event;
-    
+  renderStats stats;
 } display;
 
 typedef enum sdlKey {
@@ -28,19 +36,29 @@ typedef enum sdlKey {
   NONE = 0
 } sdlKey;
 
-typedef struct scaler {
-  float scale[NUMBER_OF_DIMENSIONS];//pixcels per unit distance
-  float offset[NUMBER_OF_DIMENSIONS];
-  float centreOfPath[NUMBER_OF_DIMENSIONS];
-  float centreOfWindow[NUMBER_OF_DIMENSIONS];
-  float spanOfPath[NUMBER_OF_DIMENSIONS];
-  float rotation; 
-} scaler;
+/* The path drawn once in to a TEXTURE_SIZE square texture, unrotated, at scale px per
+   unit with the point centre in the middle. Frames are copied from it rotated and zoomed
+   until the view moves too far from how it was drawn. */
+typedef struct pathTexture {
+  SDL_Texture * texture;
+  float scale[NUMBER_OF_DIMENSIONS];
+  float centre[NUMBER_OF_DIMENSIONS];//in path units
+  int drawn;
+} pathTexture;
 
 #pragma mark prototypes
-scaler * getScaler(display * d, pointArray * path);
-pointArray * scale(pointArray * path, scaler * s);
+pointArray * initScaledPath(pointArray * path);
+void scale(pointArray * path, scaler * s, pointArray * scaledPath);
 void renderPath(display * d, pointArray * path);
+void submitPath(display * d, pointArray * path);
+void renderFrame(display * d, pointArray * path, pointArray * scaledPath, scaler * s, pathTexture * cache);
+pathTexture * initPathTexture(display * d);
+int renderFromTexture(display * d, pathTexture * cache, pointArray * path, pointArray * scaledPath, scaler * s);
+int textureCoversView(display * d, pathTexture * cache, scaler * s, viewTransform * view);
+int rasterizePath(display * d, pathTexture * cache, pointArray * path, pointArray * scaledPath, scaler * s, viewTransform * view);
+void freePathTexture(pathTexture * cache);
+int drawPolyline(SDL_Renderer * renderer, point * points, int count);
+void printRenderStats(display * d);
 sdlKey getSdlKeyPresses(display * d);
 void zoom(scaler * s, int zoomIn);
 void rotate(scaler * s, int clockwise);
@@ -54,6 +72,8 @@ void printPath(pointArray * path, char * name);
 #pragma mark Unit Test Prototypes
 void testStartSDL();
 void testScalePath();
+void testRenderPath();
+void testTextureCache();
 
 #pragma mark draw functions
 /**
@@ -68,12 +88,14 @@ void draw(pointArray * path)
 
   display * d = startSDL();
     
-  scaler * s = getScaler(d, path);
-  pointArray * scaledPath = scale(path, s);
+  scaler * s = getScaler(d->winSize, path);
+  pointArray * scaledPath = initScaledPath(path);//lives as long as the window
+  scale(path, s, scaledPath);
+  pathTexture * cache = TEXTURE_CACHE ? initPathTexture(d) : NULL;
   if(VERBOSE) printPath(scaledPath, "orininal path:");
   printf("Press up and down arrows to zoom in/out.\n");
   while(!d->finished) {
-    renderPath(d, scaledPath);
+    renderFrame(d, path, scaledPath, s, cache);
     /* sdlKey key = getSdlKeyPresses(d);
     if(key==UP) zoom(s,1);//zoomin
     else if(key==DOWN) zoom(s,0);//zoomout
@@ -82,101 +104,41 @@ void draw(pointArray * path)
     */
     rotate(s,1);
     zoom(s,1);
-    freePath(scaledPath);
-    scaledPath = scale(path, s);
     //    if(VERBOSE) printPath(scaledPath, "orininal path:");
     checkSDLwinClosed(d);
     SDL_Delay(1e3/FPS);
   }
+  if(RENDER_STATS) printRenderStats(d);
   free(s);//free scaler
   freePath(path);//free unscaled path
   freePath(scaledPath);
+  if(cache!=NULL) freePathTexture(cache);
   quitSDL(d);
 }
 
 
 #pragma Scaling functions
 
-/*
-  Takes path and works out what the px/unit (FD) distance should be to fit the
-  entire path on to 90% of the screen. It also works out the translation vector required to
-  move the path into the centre of the window.
-  It returns a malloc'd scaler *
+/**
+   Makes a malloc'd path with room for every point of path, for scale() to write
+   the display coordinates in to. Free it with freePath.
 */
-scaler * getScaler(display * d, pointArray * path)
+pointArray * initScaledPath(pointArray * path)
 {
-  scaler * s = malloc(sizeof(scaler));
-  if(s==NULL){
-    printError("scaler * s = malloc(sizeof(scaler)) failed exiting.",__FILE__,__FUNCTION__,__LINE__);
-    return NULL;
-  }
-  float rMin[NUMBER_OF_DIMENSIONS]={0};
-  float rMax[NUMBER_OF_DIMENSIONS]={0};
-  for(int point = 0; point<path->numberOfPoints; ++point){
-    for(dimension dim = X; dim<=DIM_MAX; ++dim)	{
-      if(path->array[point].r[dim] > rMax[dim])	{
-	rMax[dim] = path->array[point].r[dim];
-      }
-      if(path->array[point].r[dim] < rMin[dim]) {
-	rMin[dim] = path->array[point].r[dim];
-      }
-    }
-  }
-  for(dimension dim = X; dim<=DIM_MAX; ++dim) {
-    s->spanOfPath[dim] = rMax[dim]-rMin[dim];//FD units
-    s->centreOfPath[dim] = (rMax[dim]-rMin[dim])/2;//FD units
-    s->centreOfWindow[dim] = (float)d->winSize[dim]/2;//px
-    s->scale[dim] = SCALE_AT_START*( (float)d->winSize[dim]  / s->spanOfPath[dim]);//px per fd unit
-    s->offset[dim] = -s->scale[dim]*s->centreOfPath[dim] + s->centreOfWindow[dim] +
-      s->scale[dim]*s->spanOfPath[dim]/2;
-  }
-  if(!STRETCH_TO_FIT_WINDOW) {//if we dont want to alter ratio then use the smallest scale for both.
-    if( s->scale[X] < s->scale[Y] ) s->scale[Y] = s->scale[X];
-    if( s->scale[X] > s->scale[Y] ) s->scale[X] = s->scale[Y];
-  }
-  s->rotation = 0;    
-  if(VERBOSE) {
-    printf("scale: %f,%f\n", s->scale[X], s->scale[Y]);
-    printf("offset: %f,%f\n", s->offset[X], s->offset[Y]);
-  }
-  return s;
+  pointArray * scaledPath = initPath();
+  reservePath(scaledPath, path->numberOfPoints);
+  return scaledPath;
 }
 
 /**
-   Takes path and transforms each point on to the display coordinates.
-   returns a new, malloc'd, path. This and the old one should be free'd.
+   Takes path and transforms each point on to the display coordinates, overwriting
+   scaledPath which must have been made for it by initScaledPath. Marks s up to date.
 */
-pointArray * scale(pointArray * path, scaler * s)
+void scale(pointArray * path, scaler * s, pointArray * scaledPath)
 {
-  pointArray * scaledPath = malloc(sizeof(pointArray));
-  if(scaledPath==NULL) {
-    printError("pointArray * scaledPath = malloc(sizeof(pointArray)) failed exiting.",
-	       __FILE__,__FUNCTION__,__LINE__);
-    return NULL;
-  }
-  scaledPath->numberOfPoints = path->numberOfPoints;
-  scaledPath->array = malloc(path->numberOfPoints*sizeof(point));
-  if(scaledPath->array==NULL) {
-    printError("scaledPath->array = malloc(path->numberOfPoints*sizeof(point)) failed exiting.",
-	       __FILE__,__FUNCTION__,__LINE__);
-    return NULL;
-  }
-  
-  for(int point = 0; point<path->numberOfPoints; ++point) {
-      
-    //    for(dimension dim = X; dim<=DIM_MAX; ++dim) {
-    scaledPath->array[point].r[0] =
-      (cos(s->rotation)*(path->array[point].r[0]*s->scale[0]) +
-       sin(s->rotation)*(path->array[point].r[1]*s->scale[1])) +
-    s->offset[0];
-    scaledPath->array[point].r[1] =
-      (cos(s->rotation)*(-path->array[point].r[1]*s->scale[1]) +
-       sin(s->rotation)*(path->array[point].r[0]*s->scale[0])) +
-      s->offset[1];
-    
-      //}
-  }
-  return scaledPath;
+  viewTransform view = makeViewTransform(s->scale, s->offset, s->rotation);
+  transformPath(path, &view, scaledPath);
+  s->changed = 0;
 }
 
 /* if zoomin > 1 increases the scale by ZOOM_SENSITIVITY of the current scale
@@ -188,6 +150,7 @@ void zoom(scaler * s, int zoomIn)
     if(zoomIn) s->scale[dim] += s->scale[dim]*ZOOM_SENSITIVITY;
     else       s->scale[dim] -= s->scale[dim]*ZOOM_SENSITIVITY;
   }
+  s->changed = 1;
   if(VERBOSE) {
     printf("new scale");
     lfprint(s->scale[0]);
@@ -208,24 +171,197 @@ void rotate(scaler * s, int clockwise)
   while(s->rotation>2*M_PI) {
     s->rotation -= 2*M_PI;
   }
+  s->changed = 1;
   if(VERBOSE) {
     lfprint(s->rotation);
   }
 }	    
 #pragma mark SDL functions
-/* conect the points in the path with lines in SDL window
+/* conect the points in the path with lines in SDL window. The points go to SDL as
+   polylines of up to RENDER_BATCH_POINTS, each starting on the last point of the one
+   before so no segment is lost.
  */
 void renderPath(display * d, pointArray * path)
 {
   SDL_SetRenderDrawColor( d->renderer, 0x00, 0x00, 0x00, 0xFF );
   SDL_RenderClear(d->renderer);
+  Uint64 start = SDL_GetPerformanceCounter();
+  submitPath(d, path);
+  d->stats.submitTicks += SDL_GetPerformanceCounter()-start;
+  ++d->stats.frames;
+  SDL_RenderPresent(d->renderer);
+}
+
+/* draws the path in white on whatever the renderer is targeting, in batches.
+ */
+void submitPath(display * d, pointArray * path)
+{
   SDL_SetRenderDrawColor( d->renderer, 0xFF, 0xFF, 0xFF, 0xFF );
-  for(int point = 0; point<path->numberOfPoints-1; ++point) {
-    SDL_RenderDrawLine(d->renderer,
-		       path->array[point].r[X],path->array[point].r[Y],
-		       path->array[point+1].r[X],path->array[point+1].r[Y]);
+  for(int first = 0; first<path->numberOfPoints-1; first += RENDER_BATCH_POINTS-1) {
+    int count = path->numberOfPoints-first;
+    if(count>RENDER_BATCH_POINTS) count = RENDER_BATCH_POINTS;
+    drawPolyline(d->renderer, &path->array[first], count);
+    ++d->stats.batches;
+  }
+  d->stats.points += path->numberOfPoints;
+}
+
+#if SDL_VERSION_ATLEAST(2,0,10)
+//a point is laid out as an SDL_FPoint so a path can be handed to SDL as it is
+typedef char pointIsAnSDL_FPoint[sizeof(point)==sizeof(SDL_FPoint) ? 1 : -1];
+
+/* draws lines joining the count points, returns SDL's error code.
+ */
+int drawPolyline(SDL_Renderer * renderer, point * points, int count)
+{
+  return SDL_RenderDrawLinesF(renderer, (const SDL_FPoint *)points, count);
+}
+#else
+/* draws lines joining the count points, returns SDL's error code. SDL before 2.0.10
+   only takes int points, they are rounded rather than truncated.
+ */
+int drawPolyline(SDL_Renderer * renderer, point * points, int count)
+{
+  static SDL_Point rounded[RENDER_BATCH_POINTS];
+  for(int p=0; p<count; ++p) {
+    rounded[p].x = lroundf(points[p].r[X]);
+    rounded[p].y = lroundf(points[p].r[Y]);
+  }
+  return SDL_RenderDrawLines(renderer, rounded, count);
+}
+#endif
+
+#pragma mark Texture Cache functions
+/* draws one frame of the path as s sees it, copied from cache if it isn't NULL and can
+   be used, drawn line by line if not.
+ */
+void renderFrame(display * d, pointArray * path, pointArray * scaledPath, scaler * s, pathTexture * cache)
+{
+  if(cache!=NULL && renderFromTexture(d, cache, path, scaledPath, s)) return;
+  if(s->changed) scale(path, s, scaledPath);
+  renderPath(d, scaledPath);
+}
+
+/* makes an empty texture cache, or returns NULL if the renderer can't draw to textures.
+ */
+pathTexture * initPathTexture(display * d)
+{
+  if(!SDL_RenderTargetSupported(d->renderer)) return NULL;
+  pathTexture * cache = malloc(sizeof(pathTexture));
+  if(cache==NULL) {
+    printError("pathTexture * cache = malloc(sizeof(pathTexture)) failed exiting.",__FILE__,__FUNCTION__,__LINE__);
+    exit(1);
+  }
+  cache->texture = SDL_CreateTexture(d->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET,
+				     TEXTURE_SIZE, TEXTURE_SIZE);
+  if(cache->texture==NULL) {
+    free(cache);
+    return NULL;
+  }
+  cache->drawn = 0;
+  return cache;
+}
+
+/* Draws the frame by copying the cached texture rotated and zoomed in to place, drawing
+   the path in to it again first if it no longer covers the window well enough.
+   Returns 1 if the frame was drawn, 0 if it should be drawn line by line instead.
+ */
+int renderFromTexture(display * d, pathTexture * cache, pointArray * path, pointArray * scaledPath, scaler * s)
+{
+  viewTransform view = makeViewTransform(s->scale, s->offset, s->rotation);
+  if(!textureCoversView(d, cache, s, &view)) {
+    if(!rasterizePath(d, cache, path, scaledPath, s, &view)) return 0;
+    s->changed = 1;//scaledPath holds the texture's coordinates now
   }
+  //the texture's centre is cache->centre, which the view puts at (x, y)
+  float x = view.m[X][0]*cache->centre[X] + view.m[X][1]*cache->centre[Y] + view.m[X][2];
+  float y = view.m[Y][0]*cache->centre[X] + view.m[Y][1]*cache->centre[Y] + view.m[Y][2];
+  float w = TEXTURE_SIZE*s->scale[X]/cache->scale[X];
+  float h = TEXTURE_SIZE*s->scale[Y]/cache->scale[Y];
+  double degrees = s->rotation*180/M_PI;//clockwise, as the view rotates with y down
+  SDL_SetRenderDrawColor( d->renderer, 0x00, 0x00, 0x00, 0xFF );
+  SDL_RenderClear(d->renderer);
+  Uint64 start = SDL_GetPerformanceCounter();
+#if SDL_VERSION_ATLEAST(2,0,10)
+  SDL_FRect destination = { x-w/2, y-h/2, w, h };
+  SDL_RenderCopyExF(d->renderer, cache->texture, NULL, &destination, degrees, NULL, SDL_FLIP_NONE);
+#else
+  SDL_Rect destination = { lroundf(x-w/2), lroundf(y-h/2), lroundf(w), lroundf(h) };
+  SDL_RenderCopyEx(d->renderer, cache->texture, NULL, &destination, degrees, NULL, SDL_FLIP_NONE);
+#endif
+  d->stats.submitTicks += SDL_GetPerformanceCounter()-start;
+  ++d->stats.frames;
   SDL_RenderPresent(d->renderer);
+  return 1;
+}
+
+/* 1 if cache has been drawn, is zoomed by no more than TEXTURE_ZOOM_LIMIT either way
+   and the window still fits inside the circle the rotated texture covers.
+ */
+int textureCoversView(display * d, pathTexture * cache, scaler * s, viewTransform * view)
+{
+  if(!cache->drawn) return 0;
+  float zoomed = TEXTURE_ZOOM_LIMIT;
+  for(dimension dim = X; dim<=DIM_MAX; ++dim) {
+    float k = s->scale[dim]/cache->scale[dim];
+    if(k>TEXTURE_ZOOM_LIMIT || k*TEXTURE_ZOOM_LIMIT<1) return 0;
+    if(k<zoomed) zoomed = k;
+  }
+  float x = view->m[X][0]*cache->centre[X] + view->m[X][1]*cache->centre[Y] + view->m[X][2];
+  float y = view->m[Y][0]*cache->centre[X] + view->m[Y][1]*cache->centre[Y] + view->m[Y][2];
+  float fromCentre = hypotf(x-d->winSize[X]/2.0f, y-d->winSize[Y]/2.0f);
+  float halfDiagonal = hypotf(d->winSize[X], d->winSize[Y])/2;
+  return fromCentre+halfDiagonal <= zoomed*TEXTURE_SIZE/2;
+}
+
+/* Draws the path in to cache at the view's scale, centred on the point at the middle
+   of the window, using scaledPath for the texture's coordinates. Returns 0 if the view
+   can't be undone to find that point or SDL can't draw in to the texture, in which case
+   neither cache nor scaledPath has been touched.
+ */
+int rasterizePath(display * d, pathTexture * cache, pointArray * path, pointArray * scaledPath, scaler * s, viewTransform * view)
+{
+  float (*m)[3] = view->m;
+  float determinant = m[X][0]*m[Y][1] - m[X][1]*m[Y][0];
+  if(determinant==0 || !isfinite(determinant)) return 0;
+  if(SDL_SetRenderTarget(d->renderer, cache->texture)!=0) return 0;
+  float x = d->winSize[X]/2.0f - m[X][2], y = d->winSize[Y]/2.0f - m[Y][2];
+  cache->centre[X] = ( m[Y][1]*x - m[X][1]*y)/determinant;
+  cache->centre[Y] = (-m[Y][0]*x + m[X][0]*y)/determinant;
+  float offset[NUMBER_OF_DIMENSIONS];
+  for(dimension dim = X; dim<=DIM_MAX; ++dim) {
+    cache->scale[dim] = s->scale[dim];
+  }
+  offset[X] = TEXTURE_SIZE/2.0f - s->scale[X]*cache->centre[X];
+  offset[Y] = TEXTURE_SIZE/2.0f + s->scale[Y]*cache->centre[Y];//y is flipped
+  viewTransform unrotated = makeViewTransform(s->scale, offset, 0);
+  transformPath(path, &unrotated, scaledPath);
+  SDL_SetRenderDrawColor( d->renderer, 0x00, 0x00, 0x00, 0xFF );
+  SDL_RenderClear(d->renderer);
+  submitPath(d, scaledPath);
+  SDL_SetRenderTarget(d->renderer, NULL);
+  cache->drawn = 1;
+  ++d->stats.rasters;
+  return 1;
+}
+
+void freePathTexture(pathTexture * cache)
+{
+  SDL_DestroyTexture(cache->texture);
+  free(cache);
+}
+
+#pragma mark Stats functions
+/* prints the average cost per frame of handing the path to the renderer.
+ */
+void printRenderStats(display * d)
+{
+  renderStats * stats = &d->stats;
+  if(stats->frames==0) return;
+  double ms = 1e3*(double)stats->submitTicks/SDL_GetPerformanceFrequency();
+  printf("\nrender: %lu frames, %.3f ms a frame submitting %lu points in %lu batches.\n",
+	 stats->frames, ms/stats->frames, stats->points/stats->frames, stats->batches/stats->frames);
+  if(TEXTURE_CACHE) printf("the texture cache was drawn %lu times.\n", stats->rasters);
 }
 
 void printPath(pointArray * path, char * name)
@@ -287,6 +423,7 @@ display * startSDL()
   }
   d->finished = 0;
   d->skip = 0;
+  d->stats = (renderStats){ 0 };
   d->winSize[X] = 900;
   d->winSize[Y] = 660;
   d->win= SDL_CreateWindow("SDL Window",
@@ -355,6 +492,14 @@ void unitTests_draw()
   sput_enter_suite("testScalePath()");
   sput_run_test(testScalePath);
   sput_leave_suite();
+
+  sput_enter_suite("testRenderPath()");
+  sput_run_test(testRenderPath);
+  sput_leave_suite();
+
+  sput_enter_suite("testTextureCache()");
+  sput_run_test(testTextureCache);
+  sput_leave_suite();
     
   sput_finish_testing();
 }
@@ -391,8 +536,11 @@ void testScalePath()
       |              |___________
       (0,20)---------------------(40,20)
   */
-  scaler * s = getScaler(d, path);
-  pointArray * scaledPath = scale(path, s);
+  scaler * s = getScaler(d->winSize, path);
+  pointArray * scaledPath = initScaledPath(path);
+  scale(path, s, scaledPath);
+  sput_fail_unless(scaledPath->numberOfPoints==path->numberOfPoints && !s->changed,
+		   "Every point should be scaled and the scaler marked up to date.");
   for(int point = 0; point<scaledPath->numberOfPoints; ++point) {
     for(dimension dim=X;dim<=DIM_MAX;++dim) {
       sput_fail_unless( scaledPath->array[point].r[dim] <= d->winSize[dim] &&
@@ -400,11 +548,71 @@ void testScalePath()
 			"Each coordinate of the scaled path should be within the window dimensions");
     }
   }
+  point * buffer = scaledPath->array;
+  point before = scaledPath->array[1];
+  rotate(s, 1);
+  sput_fail_unless(s->changed, "Rotating should mark the scaled path out of date.");
+  scale(path, s, scaledPath);
+  sput_fail_unless(scaledPath->array==buffer && !floatCompare(scaledPath->array[1].r[X], before.r[X]),
+		   "Rescaling should overwrite the same buffer with the new transform.");
   free(s);
   freePath(path);
+  freePath(scaledPath);
   quitSDL(d);
 }
 
 
 
 
+
+void testRenderPath()
+{
+  display * d = startSDL();
+  pointArray * path = mockPathForDrawUnitTests();
+  renderPath(d, path);
+  sput_fail_unless(d->stats.frames==1 && d->stats.batches==1 && d->stats.points==6,
+		   "The 6 point mock path should go to SDL in one batch.");
+
+  int numberOfPoints = 3*RENDER_BATCH_POINTS;
+  reservePath(path, numberOfPoints);
+  for(int p=6; p<numberOfPoints; ++p) path->array[p] = path->array[p%6];//round the mock again and again
+  path->numberOfPoints = numberOfPoints;
+  renderPath(d, path);
+  sput_fail_unless(d->stats.frames==2 && d->stats.batches==1+(numberOfPoints-2)/(RENDER_BATCH_POINTS-1)+1,
+		   "Batches share their end points, so 3 batches worth of points takes 4.");
+  freePath(path);
+  quitSDL(d);
+}
+
+void testTextureCache()
+{
+  display * d = startSDL();
+  pointArray * path = mockPathForDrawUnitTests();
+  scaler * s = getScaler(d->winSize, path);
+  pointArray * scaledPath = initScaledPath(path);
+  pathTexture * cache = initPathTexture(d);
+  sput_fail_unless(cache!=NULL, "The renderer should be able to draw to a texture.");
+  if(cache==NULL) return;
+  renderFrame(d, path, scaledPath, s, cache);
+  sput_fail_unless(d->stats.rasters==1 && d->stats.frames==1 && cache->drawn,
+		   "The first frame should draw the path in to the texture.");
+  for(int frame=0; frame<20; ++frame) {
+    rotate(s, 1);
+    renderFrame(d, path, scaledPath, s, cache);
+  }
+  sput_fail_unless(d->stats.rasters==1 && d->stats.frames==21,
+		   "Rotating should only copy the texture.");
+  unsigned long points = d->stats.points;
+  for(float k = 1; k<=TEXTURE_ZOOM_LIMIT; k *= 1+ZOOM_SENSITIVITY) {
+    zoom(s, 1);
+  }
+  renderFrame(d, path, scaledPath, s, cache);
+  sput_fail_unless(d->stats.rasters==2 && d->stats.points==points+path->numberOfPoints,
+		   "Zooming past TEXTURE_ZOOM_LIMIT should draw the texture again.");
+  sput_fail_unless(floatCompare(cache->scale[X], s->scale[X]), "At the new scale.");
+  freePathTexture(cache);
+  free(s);
+  freePath(scaledPath);
+  freePath(path);
+  quitSDL(d);
+}
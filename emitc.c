@@ -0,0 +1,317 @@
+//
+//  emitc.c
+//  logo
+//
+//  Ahead of time compiler: writes a validated instruction tree out as a C
+//  function, and loads a shared object built from that output.
+//
+#include "main.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <dlfcn.h>
+
+#define COMPILED_PROGRAM_FUNCTION "logoProgram"
+
+//must match the struct written out by emitC
+typedef struct logoKernels {
+    void (*fd)(void * context, float ammount);
+    void (*lt)(void * context, float ammount);
+    void (*rt)(void * context, float ammount);
+    void * context;
+} logoKernels;
+
+typedef void (*compiledProgram)(const logoKernels * kernels);
+
+#pragma mark prototypes
+int emitInstrctlst(FILE * out, instructionList * list, int indent, int loopDepth);
+char * varnumToC(varnum operand);
+char * polishToC(polish * expression);
+void kernelFD(void * context, float ammount);
+void kernelLT(void * context, float ammount);
+void kernelRT(void * context, float ammount);
+
+#pragma mark Unit Test Prototypes
+void testVarnumToC();
+void testPolishToC();
+void testEmitC();
+
+#pragma mark Emitter Functions
+/**
+ Module interface,
+ Writes program to out as a C function logoProgram() that calls the FD, LT and RT kernels
+ it is passed. DO loops become for loops and SET expressions inline arithmetic, so the
+ output can be built with e.g.
+    cc -O2 -shared -fPIC program.c -o program.so -lm
+ and run with runCompiledProgram().
+ Returns 1 if successful, 0 if not.
+ */
+int emitC(instructionList * program, FILE * out)
+{
+    fprintf(out, "/* Generated by logo --emit-c. */\n");
+    fprintf(out, "#include <math.h>\n\n");
+    fprintf(out, "typedef struct logoKernels {\n");
+    fprintf(out, "    void (*fd)(void * context, float ammount);\n");
+    fprintf(out, "    void (*lt)(void * context, float ammount);\n");
+    fprintf(out, "    void (*rt)(void * context, float ammount);\n");
+    fprintf(out, "    void * context;\n");
+    fprintf(out, "} logoKernels;\n\n");
+    fprintf(out, "void %s(const logoKernels * k)\n{\n", COMPILED_PROGRAM_FUNCTION);
+    fprintf(out, "    float");
+    for(char var='A'; var<='Z'; ++var)
+    {
+        fprintf(out, " %c = 0%s", var, var=='Z' ? ";\n" : ",");
+    }
+    for(char var='A'; var<='Z'; ++var)
+    {
+        fprintf(out, "    (void)%c;\n", var);
+    }
+    if(emitInstrctlst(out, program, 1, 0)==0) return 0;
+    fprintf(out, "}\n");
+    return ferror(out) ? 0 : 1;
+}
+
+/**
+ Writes the statements for each instruction in list, indented by indent levels.
+ loopDepth names the loop counters so nested loops never shadow each other.
+ */
+int emitInstrctlst(FILE * out, instructionList * list, int indent, int loopDepth)
+{
+    for(int i=0; i<list->numberOfInstructions; ++i)
+    {
+        instruction * current = &list->array[i];
+        fprintf(out, "%*s", 4*indent, "");
+        switch(current->sym)
+        {
+            case symFD:
+            case symLT:
+            case symRT:
+            {
+                char * ammount = varnumToC(current->operand[0]);
+                const char * kernel = current->sym==symFD ? "fd" : current->sym==symLT ? "lt" : "rt";
+                fprintf(out, "{ float v = %s; if(v!=0) k->%s(k->context, v); }\n", ammount, kernel);
+                free(ammount);
+                break;
+            }
+            case symSET:
+            {
+                char * expression = polishToC(&current->expression);
+                fprintf(out, "%c = %s;\n", current->var, expression);
+                free(expression);
+                break;
+            }
+            case symDO:
+            {
+                char * from = varnumToC(current->operand[0]);
+                char * to = varnumToC(current->operand[1]);
+                fprintf(out, "{\n%*sfloat to%d = %s;\n", 4*(indent+1), "", loopDepth, to);
+                fprintf(out, "%*sfor(int i%d = %s; i%d <= to%d; ++i%d)\n", 4*(indent+1), "",
+                        loopDepth, from, loopDepth, loopDepth, loopDepth);
+                fprintf(out, "%*s{\n", 4*(indent+1), "");
+                fprintf(out, "%*s%c = i%d;\n", 4*(indent+2), "", current->var, loopDepth);
+                free(from);
+                free(to);
+                if(emitInstrctlst(out, current->body, indent+2, loopDepth+1)==0) return 0;
+                fprintf(out, "%*s}\n%*s}\n", 4*(indent+1), "", 4*indent, "");
+                break;
+            }
+            default:
+            {
+                printError("instructionList contained an unexpected symbol.", __FILE__, __FUNCTION__, __LINE__);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/**
+ Returns a malloc'd C expression for operand.
+ */
+char * varnumToC(varnum operand)
+{
+    char * str = malloc(64);
+    if(str==NULL)
+    {
+        printError("malloc failed exiting.",__FILE__,__FUNCTION__,__LINE__);
+        exit(1);
+    }
+    if(operand.var!='\0')
+    {
+        if(operand.value==1) sprintf(str, "%c", operand.var);
+        else if(operand.value==-1) sprintf(str, "(-%c)", operand.var);
+        else sprintf(str, "(%#.9gf*%c)", operand.value, operand.var);
+    }
+    else if(isinf(operand.value))
+    {
+        sprintf(str, "(%sHUGE_VALF)", operand.value<0 ? "-" : "");
+    }
+    else
+    {
+        sprintf(str, "(%#.9gf)", operand.value);//# keeps the decimal point so the f suffix is valid
+    }
+    return str;
+}
+
+/**
+ Turns expression in to a malloc'd, fully bracketed, infix C expression.
+ Every operation is done in float, as it is in popToOperator.
+ */
+char * polishToC(polish * expression)
+{
+    char ** stack = malloc((expression->numberOfTerms+1)*sizeof(char *));
+    if(stack==NULL)
+    {
+        printError("malloc failed exiting.",__FILE__,__FUNCTION__,__LINE__);
+        exit(1);
+    }
+    int itemsInStack = 0;
+    for(int i=0; i<expression->numberOfTerms; ++i)
+    {
+        polishTerm * term = &expression->terms[i];
+        if(!term->isOperator)
+        {
+            stack[itemsInStack++] = varnumToC(term->operand);
+            continue;
+        }
+        char * rhs = stack[--itemsInStack];
+        char * lhs = stack[--itemsInStack];
+        char * combined = malloc(strlen(lhs)+strlen(rhs)+32);
+        if(combined==NULL)
+        {
+            printError("malloc failed exiting.",__FILE__,__FUNCTION__,__LINE__);
+            exit(1);
+        }
+        if(term->op==opExpo) sprintf(combined, "((float)pow(%s, %s))", lhs, rhs);
+        else sprintf(combined, "(%s %c %s)", lhs, (char)term->op, rhs);
+        free(lhs);
+        free(rhs);
+        stack[itemsInStack++] = combined;
+    }
+    char * result = stack[0];//parsePOLISH has checked there is exactly one item left
+    free(stack);
+    return result;
+}
+
+#pragma mark Loader Functions
+/**
+ Module interface,
+ Loads the shared object at soPath, built from the output of emitC(), runs it and
+ returns the resulting symList. Returns NULL if it can not be loaded.
+ */
+symbolList * runCompiledProgram(const char * soPath)
+{
+    void * handle = dlopen(soPath, RTLD_NOW);
+    if(handle==NULL)
+    {
+        char errStr[MAX_ERROR_STRING_SIZE];
+        snprintf(errStr, MAX_ERROR_STRING_SIZE, "Could not load compiled program: %s", dlerror());
+        printError(errStr, __FILE__, __FUNCTION__, __LINE__);
+        return NULL;
+    }
+    compiledProgram program;
+    *(void **)(&program) = dlsym(handle, COMPILED_PROGRAM_FUNCTION);//ISO C can't cast void * to a function pointer
+    if(program==NULL)
+    {
+        printError("Compiled program has no " COMPILED_PROGRAM_FUNCTION "() function.", __FILE__, __FUNCTION__, __LINE__);
+        dlclose(handle);
+        return NULL;
+    }
+    symbolList * symList = initSymList();
+    logoKernels kernels = { kernelFD, kernelLT, kernelRT, symList };
+    program(&kernels);
+    dlclose(handle);
+    return symList;
+}
+
+void kernelFD(void * context, float ammount)
+{
+    appendSym(context, symFD, ammount);
+}
+
+void kernelLT(void * context, float ammount)
+{
+    appendSym(context, symLT, ammount);
+}
+
+void kernelRT(void * context, float ammount)
+{
+    appendSym(context, symRT, ammount);
+}
+
+#pragma mark Unit Test Functions
+void unitTests_emitc()
+{
+    sput_start_testing();
+    sput_set_output_stream(NULL);
+
+    sput_enter_suite("testVarnumToC()");
+    sput_run_test(testVarnumToC);
+    sput_leave_suite();
+
+    sput_enter_suite("testPolishToC()");
+    sput_run_test(testPolishToC);
+    sput_leave_suite();
+
+    sput_enter_suite("testEmitC()");
+    sput_run_test(testEmitC);
+    sput_leave_suite();
+
+    sput_finish_testing();
+}
+
+void testVarnumToC()
+{
+    varnum operand = { '\0', 5 };
+    char * str = varnumToC(operand);
+    sput_fail_unless(strcmp(str, "(5.00000000f)")==0, "Whole numbers must keep a decimal point to be valid float literals.");
+    free(str);
+    operand.var = 'A';
+    operand.value = 1;
+    str = varnumToC(operand);
+    sput_fail_unless(strcmp(str, "A")==0, "A variable should be emitted by name.");
+    free(str);
+    operand.value = -1;
+    str = varnumToC(operand);
+    sput_fail_unless(strcmp(str, "(-A)")==0, "-A should be emitted as a negated variable.");
+    free(str);
+}
+
+void testPolishToC()
+{
+    polishTerm terms[] = {
+        { 0, 0, { 'A', 1 } },
+        { 0, 0, { '\0', 2 } },
+        { 1, opMultiply, { 0 } },
+        { 0, 0, { 'B', 1 } },
+        { 1, opExpo, { 0 } }
+    };
+    polish expression = { terms, 5 };
+    char * str = polishToC(&expression);
+    sput_fail_unless(strcmp(str, "((float)pow((A * (2.00000000f)), B))")==0,
+                     "A 2 * B ^ should become a bracketed infix expression.");
+    free(str);
+}
+
+void testEmitC()
+{
+    const char programSource[] = "{ DO A FROM 1 TO 4 { DO B FROM 1 TO A { FD B } RT 90 } }";
+    instructionList * program = parseProgram(programSource, strlen(programSource));
+    FILE * out = tmpfile();
+    sput_fail_unless(out!=NULL && emitC(program, out)==1, "emitC should write the program without error.");
+    long length = ftell(out);
+    rewind(out);
+    char * source = calloc(length+1, 1);
+    fread(source, 1, length, out);
+    sput_fail_unless(strstr(source, "void " COMPILED_PROGRAM_FUNCTION "(const logoKernels * k)")!=NULL,
+                     "The output should define the entry point runCompiledProgram() looks for.");
+    sput_fail_unless(strstr(source, "for(int i0 = (1.00000000f); i0 <= to0; ++i0)")!=NULL &&
+                     strstr(source, "for(int i1 = (1.00000000f); i1 <= to1; ++i1)")!=NULL,
+                     "Nested DO loops should become nested for loops with their own counters.");
+    sput_fail_unless(strstr(source, "k->fd(k->context, v)")!=NULL && strstr(source, "k->rt(k->context, v)")!=NULL,
+                     "FD and RT should call their kernels.");
+    free(source);
+    fclose(out);
+    freeInstructionList(program);
+}
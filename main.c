@@ -6,17 +6,34 @@
 //  Copyright (c) 2015 ben. All rights reserved.
 //
 //#define sprint(s) printf(#s " = ""%s""\n",s);
+#define _POSIX_C_SOURCE 200809L //for mmap, fstat and read
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "main.h"
 
-char * readFile(const char * argv1);
+/* A read only view of the whole program, either mapped from a file or read in to the heap. */
+typedef struct inputBuffer {
+    const char * data;
+    unsigned long length;
+    int isMapped;
+} inputBuffer;
+
+inputBuffer * readFile(const char * argv1);
+int readStream(int fd, inputBuffer * input);
+symbolList * parseInputStream(int fd);
+void freeInput(inputBuffer * input);
+int emitCFile(const char * inputPath, const char * outputPath);
 
 //unit test functions
 void unitTests();
 void testReadFile();
+void testReadStream();
 void testStrDup();
 void testStringsMatch();
 void testFloatCompare();
@@ -29,67 +46,214 @@ int main(int argc, const char * argv[])
         unitTests();
         return 1;
     }
-    if(argc!=2)
+    if(argc==4 && stringsMatch(argv[1], "--emit-c"))
+    {
+        return emitCFile(argv[3], argv[2]);
+    }
+    const char * imagePath = HEADLESS ? HEADLESS_IMAGE : NULL;
+    if(argc>=3 && stringsMatch(argv[1], "--render"))
+    {
+        imagePath = argv[2];
+        argc -= 2;//the rest of the arguments say where the program comes from as usual
+        argv += 2;
+    }
+    symbolList * symList = NULL;
+    if(argc==3 && stringsMatch(argv[1], "--load"))
+    {
+        symList = runCompiledProgram(argv[2]);
+    }
+    else if((argc==2 && stringsMatch(argv[1], "-")) || (argc==1 && !isatty(STDIN_FILENO)))
+    {
+        symList = parseInputStream(STDIN_FILENO);
+    }
+    else if(argc==2)
+    {
+        inputBuffer * input = readFile(argv[1]);
+        if(input==NULL) exit(1);
+        symList = parse(input->data, input->length);
+        freeInput(input);
+    }
+    else
     {
-        fprintf(stderr, "ERROR: expected a .txt file path as 1st argument.\nExiting.\n");
+        fprintf(stderr, "ERROR: expected a .txt file path as 1st argument.\n"
+                "usage: logo program.txt\n"
+                "       generator | logo -\n"
+                "       logo --emit-c program.c program.txt\n"
+                "       logo --load program.so\n"
+                "       logo --render image.ppm|image.png program.txt\nExiting.\n");
         exit(0);
     }
-    char * inputString = readFile(argv[1]);
-    if(inputString==NULL) exit(1);
-    
-    symbolList * symList = parse(inputString);
     if(symList==NULL) return 0;
+    if(PEEPHOLE) peepholeSymList(symList);
     
     pointArray * path = buildPath(symList);
     if(path==NULL) return 0;
-    draw(path);
-    return 1;
+    if(BENCHMARK) benchmarkView(path, BENCHMARK_RUNS);
+    int drawn = 1;
+    if(imagePath!=NULL)
+    {
+        drawn = writePathImage(path, imagePath);
+        freePath(path);
+    }
+#if !HEADLESS
+    else draw(path);
+#endif
+    if(ARENA_STATS) printArenaStats();
+    return drawn;
 }
 
 
 #pragma mark Input Functions
 /*
- *  Takes argv[1] which should contain a .txt file path
-    reads into a malloc'd null-terminated string which is returned.
+ *  Takes argv[1] which should contain a .txt file path, or - for stdin.
+    Regular files are mmap'd read only, anything else (pipes, terminals) is read with
+    readStream. The returned buffer is not NUL terminated, use its length.
  */
-char * readFile(const char * argv1)
+inputBuffer * readFile(const char * argv1)
 {
     if(VERBOSE) printf("readFile opening %s.\n",argv1);
-    FILE * fp = NULL;
-    fp = fopen(argv1, "r");
-    if(!fp)
+    int fd = stringsMatch(argv1, "-") ? STDIN_FILENO : open(argv1, O_RDONLY);
+    if(fd<0)
     {
         printError("could not open file.", __FILE__, __FUNCTION__, __LINE__);
         return NULL;
     }
-    char * inputString = NULL;
-    char fileChar = getc(fp);
-    int length=0;
-    while(fileChar!=EOF)
+    inputBuffer * input = malloc(sizeof(inputBuffer));
+    if(input==NULL)
     {
-        ++length;
-        char * tmp = realloc( inputString, length);
-        if(!tmp)
+        printError("malloc in readFile() failed.", __FILE__, __FUNCTION__, __LINE__);
+        exit(1);
+    }
+    struct stat info;
+    if(fstat(fd, &info)==0 && S_ISREG(info.st_mode) && info.st_size>0)
+    {
+        void * mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapped!=MAP_FAILED)
         {
-            printError("realloc in readFile() failed.", __FILE__, __FUNCTION__, __LINE__);
-            return NULL;
+            posix_madvise(mapped, info.st_size, POSIX_MADV_SEQUENTIAL);
+            input->data = mapped;
+            input->length = info.st_size;
+            input->isMapped = 1;
+            if(fd!=STDIN_FILENO) close(fd);
+            return input;
         }
-        inputString = tmp;
-        inputString[length-1]=fileChar;
-        fileChar = getc(fp);
     }
-    char * tmp = realloc( inputString, length);
-    if(!tmp)
+    if(readStream(fd, input)==0)
     {
-        printError("realloc in readFile() failed.", __FILE__, __FUNCTION__, __LINE__);
-        return NULL;
+        free(input);
+        input = NULL;
+    }
+    if(fd!=STDIN_FILENO) close(fd);
+    return input;
+}
+
+/*
+ *  Reads fd to the end in to a heap buffer that doubles in size whenever it fills.
+    Returns 1 if successful, 0 if not.
+ */
+int readStream(int fd, inputBuffer * input)
+{
+    unsigned long capacity = INPUT_CHUNK_SIZE, length = 0;
+    char * data = malloc(capacity);
+    if(data==NULL)
+    {
+        printError("malloc in readStream() failed.", __FILE__, __FUNCTION__, __LINE__);
+        exit(1);
+    }
+    ssize_t bytesRead;
+    while((bytesRead = read(fd, data+length, capacity-length))!=0)
+    {
+        if(bytesRead<0)
+        {
+            printError("read in readStream() failed.", __FILE__, __FUNCTION__, __LINE__);
+            free(data);
+            return 0;
+        }
+        length += bytesRead;
+        if(length==capacity)
+        {
+            capacity *= 2;
+            char * tmp = realloc(data, capacity);
+            if(!tmp)
+            {
+                printError("realloc in readStream() failed.", __FILE__, __FUNCTION__, __LINE__);
+                exit(1);
+            }
+            data = tmp;
+        }
+    }
+    input->data = data;
+    input->length = length;
+    input->isMapped = 0;
+    return 1;
+}
+
+/*
+ *  Feeds fd to the stream parser INPUT_CHUNK_SIZE bytes at a time, so top level instructions
+    are run as they arrive and memory is bounded by the chunk size rather than the program.
+    Returns the symList of the whole program or NULL if it is invalid.
+ */
+symbolList * parseInputStream(int fd)
+{
+    char * chunk = malloc(INPUT_CHUNK_SIZE);
+    if(chunk==NULL)
+    {
+        printError("malloc in parseInputStream() failed.", __FILE__, __FUNCTION__, __LINE__);
+        exit(1);
+    }
+    streamParser * s = initStreamParser();
+    ssize_t bytesRead;
+    while((bytesRead = read(fd, chunk, INPUT_CHUNK_SIZE))!=0)
+    {
+        if(bytesRead<0)
+        {
+            printError("read in parseInputStream() failed.", __FILE__, __FUNCTION__, __LINE__);
+            break;
+        }
+        if(feedStreamParser(s, chunk, bytesRead)==0) break;
     }
-    inputString = tmp;
-    inputString[length]='\0';
-    return inputString;
+    free(chunk);
+    return finishStreamParser(s);
 }
 
+/*
+ *  Unmaps or frees input.
+ */
+void freeInput(inputBuffer * input)
+{
+    if(input->isMapped) munmap((void *)input->data, input->length);
+    else free((void *)input->data);
+    free(input);
+}
 
+/*
+ *  Parses the program at inputPath and writes it out as C to outputPath.
+ */
+int emitCFile(const char * inputPath, const char * outputPath)
+{
+    inputBuffer * input = readFile(inputPath);
+    if(input==NULL) return 0;
+    instructionList * program = parseProgram(input->data, input->length);
+    freeInput(input);
+    if(program==NULL) return 0;
+    if(OPTIMISE) optimiseProgram(program, 1);
+    FILE * out = fopen(outputPath, "w");
+    if(!out)
+    {
+        printError("could not open output file.", __FILE__, __FUNCTION__, __LINE__);
+        freeInstructionList(program);
+        return 0;
+    }
+    int emitted = emitC(program, out);
+    fclose(out);
+    freeInstructionList(program);
+    if(emitted)
+    {
+        printf("Wrote %s. Build it with:\n    cc -O2 -shared -fPIC %s -o program.so -lm\n"
+               "then run it with:\n    logo --load ./program.so\n", outputPath, outputPath);
+    }
+    return emitted;
+}
 
 
 
@@ -145,13 +309,8 @@ int floatCompare(float a, float b)
  */
 void freeSymList(symbolList * symList)
 {
-    symbolNode * current = symList->start;
-    while(current!=NULL)
-    {
-        symbolNode * toBeFreed = current;
-        current = current->next;
-        free(toBeFreed);
-    }
+    free(symList->syms);
+    free(symList->values);
     free(symList);
 }
 
@@ -175,20 +334,52 @@ void unitTests()
     printf("********************************************************************\n\n");
     unitTests_main();
     
+    printf("\n\n\n********************************************************************\n");
+    printf("\n*                       Testing arena.c                            *\n\n");
+    printf("********************************************************************\n\n");
+    unitTests_arena();
+    
     printf("\n\n\n********************************************************************\n");
     printf("\n*                       Testing parser.c                           *\n\n");
     printf("********************************************************************\n\n");
     unitTests_parser();
     
+    printf("\n\n\n********************************************************************\n");
+    printf("\n*                       Testing optimiser.c                        *\n\n");
+    printf("********************************************************************\n\n");
+    unitTests_optimiser();
+    
+    printf("\n\n\n********************************************************************\n");
+    printf("\n*                       Testing vm.c                               *\n\n");
+    printf("********************************************************************\n\n");
+    unitTests_vm();
+    
+    printf("\n\n\n********************************************************************\n");
+    printf("\n*                       Testing emitc.c                            *\n\n");
+    printf("********************************************************************\n\n");
+    unitTests_emitc();
+    
     printf("\n\n\n********************************************************************\n");
     printf("\n*                       Testing path.c                             *\n\n");
     printf("********************************************************************\n\n");
     unitTests_path();
     
+    printf("\n\n\n********************************************************************\n");
+    printf("\n*                       Testing view.c                             *\n\n");
+    printf("********************************************************************\n\n");
+    unitTests_view();
+    
+    printf("\n\n\n********************************************************************\n");
+    printf("\n*                       Testing raster.c                           *\n\n");
+    printf("********************************************************************\n\n");
+    unitTests_raster();
+    
+#if !HEADLESS
     printf("\n\n\n********************************************************************\n");
     printf("\n*                       Testing draw.c                             *\n\n");
     printf("********************************************************************\n\n");
     unitTests_draw();
+#endif
     
 
 }
@@ -202,6 +393,10 @@ void unitTests_main()
     sput_run_test(testReadFile);
     sput_leave_suite();
     
+    sput_enter_suite("testReadStream()");
+    sput_run_test(testReadStream);
+    sput_leave_suite();
+    
     sput_enter_suite("testStrDup()");
     sput_run_test(testStrDup);
     sput_leave_suite();
@@ -222,25 +417,50 @@ void unitTests_main()
 void testReadFile()
 {
     sput_fail_unless(readFile("thisIsNotAFile.txt")==NULL, "trying to open a file that doesnt exist should print error and return NULL");
-    char * returnedString = readFile("readFileTest.txt");
+    inputBuffer * input = readFile("readFileTest.txt");
+    sput_fail_unless(input!=NULL && input->isMapped, "A regular file should be mapped rather than read.");
     FILE * fp = NULL;
     fp = fopen("readFileTest.txt", "r");
     if(!fp)
     {
         printError("could not open test file.", __FILE__, __FUNCTION__, __LINE__);
     }
-    int charFromTheReturnedStringPostion=0;
-    int returnedStringLength = (int)strlen(returnedString);
-    char charFromFile = getc(fp);
-    char charFromTheReturnedString = returnedString[charFromTheReturnedStringPostion];
-    while(charFromFile!=EOF && charFromTheReturnedStringPostion<=returnedStringLength)
+    unsigned long position=0;
+    int charFromFile = getc(fp);
+    while(charFromFile!=EOF && position<input->length)
     {
         char str[500];
-        sprintf(str, "Checks each char of the file with that of the returned string. Now checking %c == %c.(file == returned)",charFromFile,charFromTheReturnedString);
-        sput_fail_unless(charFromFile==charFromTheReturnedString,str);
+        sprintf(str, "Checks each char of the file with that of the returned buffer. Now checking %c == %c.(file == returned)",charFromFile,input->data[position]);
+        sput_fail_unless(charFromFile==input->data[position],str);
         charFromFile = getc(fp);
-        charFromTheReturnedString = returnedString[++charFromTheReturnedStringPostion];
+        ++position;
+    }
+    sput_fail_unless(charFromFile==EOF && position==input->length, "The buffer should be exactly as long as the file.");
+    fclose(fp);
+    freeInput(input);
+}
+
+void testReadStream()
+{
+    FILE * fp = tmpfile();
+    unsigned long length = 3*INPUT_CHUNK_SIZE+17;
+    for(unsigned long i=0; i<length; ++i)
+    {
+        putc('a'+i%26, fp);
+    }
+    fflush(fp);
+    rewind(fp);
+    inputBuffer input;
+    sput_fail_unless(readStream(fileno(fp), &input)==1 && input.length==length && !input.isMapped,
+                     "readStream should read everything across several chunks.");
+    int matches = 1;
+    for(unsigned long i=0; matches && i<length; ++i)
+    {
+        matches = input.data[i]=='a'+i%26;
     }
+    sput_fail_unless(matches, "Every byte read should match what was written.");
+    free((void *)input.data);
+    fclose(fp);
 }
 
 void testStrDup()
@@ -16,6 +16,21 @@
 #define VERBOSE 1//prints info to terminal disable for speed.
 #define PRINT_ERRORS 1 //turn on/off stderr error messages.
 #define MAX_ERROR_STRING_SIZE 600
+#define USE_BYTECODE_VM 1 //run programs on the bytecode VM rather than walking the instruction tree.
+#define BENCHMARK 0 //times the tree walker against the bytecode VM before running a program.
+#define BENCHMARK_RUNS 20
+#define INPUT_CHUNK_SIZE (1<<16) //bytes read from a pipe or stdin at a time
+#define ARENA_STATS 0 //prints the bytes and allocations each stage carved from its arenas on exit.
+#define BATCHED_PATH_KERNEL 1 //builds the path a block of FDs at a time using a vectorised sin/cos.
+#define SINCOS_TERMS 5 //polynomial terms per sin/cos in that kernel, max error 3: 4e-4, 4: 4e-6, 5: 1e-7.
+#define HEADING_TABLE_STEPS 4 //sin/cos table entries per degree, headings on this grid need no trig at all.
+#define PATH_THREADS 4 //threads buildPath splits a long program between, 1 builds every path serially.
+#define PATH_SYMS_PER_THREAD (1<<15) //fewest instructions worth giving a thread of their own
+#define VIEW_THREADS 4 //threads a long path is split between when it is moved on to the window.
+#define VIEW_POINTS_PER_THREAD (1<<18) //fewest points worth giving a thread of their own
+#define REPEAT_NODES 1 //keeps a loop whose every iteration draws the same thing as one REPEAT on the symList.
+#define OPTIMISE 1 //runs the optimiser passes over each program before it is run.
+#define PEEPHOLE 1 //merges adjacent turns and FDs on the symList before the path is built.
 
 #define FPS 50
 #define SDL_WINDOW_WIDTH 900
@@ -24,6 +39,17 @@
 #define ZOOM_SENSITIVITY 0.1 //zooming will increase scale by a factor of ZOOM_SENSITIVITY*100 %
 #define SCALE_AT_START 0.3 //of screen width
 #define ROTATION_SENSITIVITY 0.05
+#ifndef HEADLESS
+#define HEADLESS 0 //builds without SDL, the path is written to HEADLESS_IMAGE instead. make headless sets it.
+#endif
+#define HEADLESS_IMAGE "logo.ppm"
+#define IMAGE_WIDTH 1800 //px, of images written by --render or a headless build
+#define IMAGE_HEIGHT 1320
+#define RENDER_BATCH_POINTS (1<<14) //points handed to SDL per draw call
+#define RENDER_STATS 0 //prints the time spent submitting lines each frame on exit.
+#define TEXTURE_CACHE 0 //draws the path in to a texture once and rotates and zooms copies of it.
+#define TEXTURE_SIZE 2048 //px square, big enough to cover the window at any rotation.
+#define TEXTURE_ZOOM_LIMIT 2.0 //the texture is drawn again once it is zoomed more than this either way.
 
 #ifndef M_PI
 #define M_PI 3.14159265359
@@ -35,26 +61,132 @@
 #define M_PI_4 3.14159265359/4
 #endif
 
+/******************************************************************************/
+//Arena Module
+#define ARENA_BLOCK_SIZE (1<<16) //bytes malloc'd at a time, bigger allocations get a block of their own
+
+typedef struct arenaBlock arenaBlock;
+
+typedef struct arena {
+    const char * stage;//name its use is reported under by printArenaStats()
+    arenaBlock * blocks;//newest first
+    unsigned long allocations, bytes;//since the arena was made or last reset
+    unsigned long mallocs;//calls to malloc or realloc since then
+    unsigned long numberOfBlocks, blockBytes, peakBytes;
+} arena;
+
+arena * initArena(const char * stage);
+void * arenaAlloc(arena * a, unsigned long size);
+void * arenaGrow(arena * a, void * old, unsigned long oldSize, unsigned long newSize);
+char * arenaStrdup(arena * a, const char * string);
+void resetArena(arena * a);
+void freeArena(arena * a);
+void printArenaStats();
+
+
+
 /******************************************************************************/
 //Parser Module
 typedef enum symbol {
     symMAIN, symINSTRCTLST, symINSTRUCTION, symFD, symLT, symRT, symDO, symVAR,
-    symVARNUM, symSET, symPOLISH, symOP
+    symVARNUM, symSET, symPOLISH, symOP,
+    symREPEAT, symENDREPEAT//symList only, see symbolList
 } symbol;
 
-typedef struct symNode {
-    symbol sym;
-    float value;
-    struct symNode * next;
-} symbolNode;
+#define REPEAT_MAX_TRIPS (1<<24) //every trip count up to here is exact as a float value
 
+/* The expanded program as a structure of arrays, instruction i is syms[i] by values[i].
+   Both arrays grow geometrically so appending is amortised O(1) and buildPath can walk
+   them in order. A loop that draws the same thing every time round is kept as
+   symREPEAT (value: trips), its body once, then symENDREPEAT (value: body length). */
 typedef struct symbolList {
-    symbolNode * start;
-    symbolNode * end;
+    unsigned char * syms;//symFD, symLT, symRT or a REPEAT marker
+    float * values;
     unsigned long length;
+    unsigned long capacity;
 } symbolList;
 
-symbolList * parse(char * inputString);
+typedef enum operator {
+    opPlus = '+',
+    opMinus = '-',
+    opMultiply = '*',
+    opDivide = '/',
+    opExpo = '^'
+} operator;
+
+/* A <VARNUM> operand. If var is '\0' it is the number value, otherwise it is
+   the variable var multiplied by value (1 or -1 for "-VAR"). */
+typedef struct varnum {
+    char var;
+    float value;
+} varnum;
+
+typedef struct polishTerm {
+    int isOperator;
+    operator op;
+    varnum operand;
+} polishTerm;
+
+typedef struct polish {
+    polishTerm * terms;
+    int numberOfTerms;
+} polish;
+
+struct instructionList;
+
+/* One parsed <INSTRUCTION>. FD/LT/RT keep their amount in operand[0], DO keeps
+   its FROM and TO bounds in operand[0] and operand[1]. */
+typedef struct instruction {
+    symbol sym;
+    char var;//DO loop variable or SET target
+    varnum operand[2];
+    polish expression;//SET only
+    struct instructionList * body;//DO only
+    int repeatable;//DO only, every iteration draws the same thing so it can become a REPEAT
+} instruction;
+
+typedef struct instructionList {
+    instruction * array;
+    int numberOfInstructions;
+    int capacity;
+    arena * memory;//every list, array and expression in the tree is carved from this
+} instructionList;
+
+symbolList * parse(const char * source, unsigned long length);
+instructionList * parseProgram(const char * source, unsigned long length);
+symbolList * executeProgram(instructionList * program);
+void freeInstructionList(instructionList * list);
+symbolList * initSymList();
+int appendSym(symbolList * symList, symbol sym, float value);
+int repeatTrips(int repeatable, float from, float to);
+int loopIsRepeatable(instruction * loop);
+unsigned int varsWrittenIn(instructionList * list);
+
+typedef struct streamParser streamParser;
+streamParser * initStreamParser();
+int feedStreamParser(streamParser * s, const char * chunk, unsigned long length);
+symbolList * finishStreamParser(streamParser * s);
+
+
+
+/******************************************************************************/
+//Optimiser Module
+int optimiseProgram(instructionList * program, int isWholeProgram);
+unsigned long peepholeSymList(symbolList * symList);
+
+
+
+/******************************************************************************/
+//Bytecode VM Module
+symbolList * runProgramOnVM(instructionList * program);
+void benchmarkVM(instructionList * program, int runs);
+
+
+
+/******************************************************************************/
+//C Emitter Module
+int emitC(instructionList * program, FILE * out);
+symbolList * runCompiledProgram(const char * soPath);
 
 
 
@@ -76,9 +208,46 @@ typedef struct point {
 typedef struct pointArray {
     point * array;
     int numberOfPoints;
+    int capacity;//points array has room for
 } pointArray;
 
 pointArray * buildPath( symbolList * symList);
+pointArray * initPath();
+int reservePath(pointArray * path, int capacity);
+
+
+
+/******************************************************************************/
+//View Transform Module
+
+/* The affine map on to the window, a point's x' is m[X][0]*x + m[X][1]*y + m[X][2]
+   and its y' likewise from m[Y]. */
+typedef struct viewTransform {
+    float m[NUMBER_OF_DIMENSIONS][3];
+} viewTransform;
+
+/* How a path is fitted on to a window, getScaler works it out for the path as a whole
+   and draw.c zooms and rotates it from there. */
+typedef struct scaler {
+    float scale[NUMBER_OF_DIMENSIONS];//pixcels per unit distance
+    float offset[NUMBER_OF_DIMENSIONS];
+    float centreOfPath[NUMBER_OF_DIMENSIONS];
+    float centreOfWindow[NUMBER_OF_DIMENSIONS];
+    float spanOfPath[NUMBER_OF_DIMENSIONS];
+    float rotation;
+    int changed;//set by zoom and rotate, the scaled path is out of date until scale() is called
+} scaler;
+
+scaler * getScaler(const int winSize[], pointArray * path);
+viewTransform makeViewTransform(const float scale[], const float offset[], float rotation);
+void transformPath(const pointArray * path, const viewTransform * view, pointArray * out);
+void benchmarkView(pointArray * path, int runs);
+
+
+
+/******************************************************************************/
+//Raster Module
+int writePathImage(pointArray * path, const char * imagePath);
 
 
 
@@ -101,8 +270,14 @@ void freePath(pointArray * path );
 /******************************************************************************/
 //Module Unit Tests
 void unitTests_main();
+void unitTests_arena();
 void unitTests_parser();
+void unitTests_optimiser();
+void unitTests_vm();
+void unitTests_emitc();
 void unitTests_path();
+void unitTests_view();
+void unitTests_raster();
 void unitTests_draw();
 
 
@@ -0,0 +1,1092 @@
+//
+//  optimiser.c
+//  logo
+//
+//  Passes that rewrite a validated instruction tree in to one that draws exactly
+//  the same thing with less work, run before the tree is handed to a back end.
+//
+#include "main.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define VAR_BIT(var) (1u<<((var)-'A'))
+#define FLOAT_MANTISSA_BITS 24 //integers up to 2^24 are exact in a float
+
+/* What is known about the variables at a point in the program. */
+typedef struct constants {
+    unsigned int known;//a VAR_BIT for each variable whose value is known
+    float value['Z'+1];//indexed by the variable's ascii value, like the parser's
+} constants;
+
+/* How a polish stack entry depends on the loop variable: not at all, as step*var plus
+   something invariant, or some other way. */
+typedef enum affineKind {
+    affINVARIANT, affAFFINE, affOTHER
+} affineKind;
+
+typedef struct affineTerm {
+    affineKind kind;
+    int isNumber;//affINVARIANT only, the entry is just the number value
+    float value;//affINVARIANT: that number, affAFFINE: how much it changes each iteration
+} affineTerm;
+
+/* The largest a polish stack entry gets and the binary places it can need. */
+typedef struct exactBound {
+    double magnitude;
+    int places;
+} exactBound;
+
+#pragma mark prototypes
+int foldConstants(instructionList * list, constants * known);
+int foldPolish(polish * expression, constants * known);
+varnum foldVarnum(varnum operand, constants * known);
+float applyOperator(operator op, float lhs, float rhs);
+int removeDeadSETs(instructionList * list, unsigned int liveAfter, double trips, double * evaluations);
+unsigned int varsReadFirstIn(instructionList * list);
+double constantTrips(instruction * loop);
+int reduceInductionSETs(instructionList * list, instructionList * program, int isWholeProgram);
+int reduceInLoop(instructionList * list, int at, instructionList * program, int isWholeProgram);
+int affineStep(polish * expression, char loopVar, float * step);
+int reductionIsExact(polish * expression, instruction * loop, float step, float seed);
+int binaryPlaces(float value);
+int isExactInFloat(exactBound bound);
+affineTerm combineAffine(operator op, affineTerm lhs, affineTerm rhs);
+unsigned int varsReadOutside(instructionList * list, instructionList * skip);
+int hoistInvariantSETs(instructionList * list);
+int hoistFromLoop(instructionList * list, int at);
+int loopRunsAtLeastOnce(instruction * loop);
+int writesOf(instructionList * list, char var);
+unsigned int varsReadIn(instructionList * list, int from, int to);
+unsigned int varsReadByPolish(polish * expression);
+unsigned int varsReadByVarnum(varnum operand);
+void insertInstruction(instructionList * list, int at, instruction * newInstruction);
+void removeInstruction(instructionList * list, int at);
+void markRepeatableLoops(instructionList * list);
+unsigned long appendMergedSym(symbolList * symList, unsigned long length, symbol sym, float value);
+
+#pragma mark Unit Test Prototypes
+void testFoldConstants();
+void testHoistInvariantSETs();
+void testHoistingKeepsOutput();
+void testRemoveDeadSETs();
+void testPeepholeSymList();
+void testReduceInductionSETs();
+
+#pragma mark Optimiser Functions
+/**
+ Module interface,
+ Runs each of the optimiser passes over program, then works out again which loops can
+ be kept as REPEATs now their bodies have changed. If isWholeProgram is 0 more
+ instructions may follow that read any of its variables, as when streaming.
+ Returns the number of instructions that were moved or removed.
+ */
+int optimiseProgram(instructionList * program, int isWholeProgram)
+{
+    constants known = { 0 };//the stream parser may have set any of them
+    int folded = foldConstants(program, &known);
+    int removed = 0, removedThisPass;
+    double evaluations = 0;
+    do//removing one SET can leave the ones it read dead too
+    {
+        removedThisPass = removeDeadSETs(program, isWholeProgram ? 0 : ~0u, 1, &evaluations);
+        removed += removedThisPass;
+    } while(removedThisPass);
+    int reduced = reduceInductionSETs(program, program, isWholeProgram);
+    int hoisted = hoistInvariantSETs(program);
+    markRepeatableLoops(program);
+    if(VERBOSE)
+    {
+        printf("\noptimiser: folded away %d expression terms.\n", folded);
+        printf("optimiser: removed %d dead SETs, saving at least %.0f evaluations.\n", removed, evaluations);
+        printf("optimiser: reduced %d SETs to induction variable updates.\n", reduced);
+        printf("optimiser: hoisted %d loop invariant SETs.\n", hoisted);
+    }
+    return folded+removed+reduced+hoisted;
+}
+
+#pragma mark Constant Folding
+/**
+ Works forward through list replacing each variable read while its value is known with
+ that value, then folds every operator whose operands are both numbers so an expression
+ made only of those becomes a single number. known holds what is known as list starts
+ and is left holding what is known after it.
+ Returns the number of expression terms folded away.
+ */
+int foldConstants(instructionList * list, constants * known)
+{
+    int folded = 0;
+    for(int i=0; i<list->numberOfInstructions; ++i)
+    {
+        instruction * current = &list->array[i];
+        switch(current->sym)
+        {
+            case symFD:
+            case symLT:
+            case symRT:
+                current->operand[0] = foldVarnum(current->operand[0], known);
+                break;
+            case symSET:
+            {
+                polish * expression = &current->expression;
+                folded += foldPolish(expression, known);
+                if(expression->numberOfTerms==1 && expression->terms[0].operand.var=='\0')
+                {
+                    known->known |= VAR_BIT(current->var);
+                    known->value[(int)current->var] = expression->terms[0].operand.value;
+                }
+                else known->known &= ~VAR_BIT(current->var);
+                break;
+            }
+            case symDO:
+            {
+                //the bounds are read once on entry, the body may run any number of times
+                current->operand[0] = foldVarnum(current->operand[0], known);
+                current->operand[1] = foldVarnum(current->operand[1], known);
+                known->known &= ~(VAR_BIT(current->var) | varsWrittenIn(current->body));
+                constants inBody = *known;
+                folded += foldConstants(current->body, &inBody);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    return folded;
+}
+
+/**
+ Folds expression in place. The terms for a number on the stack are always just that
+ number, so an operator can be folded whenever the two terms before it are numbers.
+ Returns the number of terms folded away.
+ */
+int foldPolish(polish * expression, constants * known)
+{
+    int numberOfTerms = 0;
+    for(int i=0; i<expression->numberOfTerms; ++i)
+    {
+        polishTerm term = expression->terms[i];
+        if(!term.isOperator)
+        {
+            term.operand = foldVarnum(term.operand, known);
+        }
+        else if(numberOfTerms>=2)
+        {
+            polishTerm * lhs = &expression->terms[numberOfTerms-2], * rhs = &expression->terms[numberOfTerms-1];
+            if(!lhs->isOperator && lhs->operand.var=='\0' && !rhs->isOperator && rhs->operand.var=='\0')
+            {
+                float result = applyOperator(term.op, lhs->operand.value, rhs->operand.value);
+                if(!isnan(result))//the emitter cannot write a NaN literal, run time gets the same NaN anyway
+                {
+                    term = (polishTerm){ .isOperator = 0, .operand = { '\0', result } };
+                    numberOfTerms -= 2;
+                }
+            }
+        }
+        expression->terms[numberOfTerms++] = term;
+    }
+    int folded = expression->numberOfTerms - numberOfTerms;
+    expression->numberOfTerms = numberOfTerms;
+    return folded;
+}
+
+/**
+ Returns operand as a number if its variable is known, otherwise operand.
+ */
+varnum foldVarnum(varnum operand, constants * known)
+{
+    if(operand.var=='\0' || !(known->known & VAR_BIT(operand.var))) return operand;
+    return (varnum){ '\0', operand.value*known->value[(int)operand.var] };
+}
+
+/**
+ Returns lhs op rhs worked out exactly as popToOperator would at run time.
+ */
+float applyOperator(operator op, float lhs, float rhs)
+{
+    switch(op)
+    {
+        case opPlus: return lhs + rhs;
+        case opMinus: return lhs - rhs;
+        case opMultiply: return lhs * rhs;
+        case opDivide: return lhs / rhs;
+        case opExpo: return pow(lhs, rhs);
+    }
+    return 0;
+}
+
+#pragma mark Dead SET Elimination
+/**
+ Works back through list removing each SET whose variable is not live, that is it is
+ written again or never read before the program ends. liveAfter has a bit for each
+ variable that may be read after list. trips is how many times list runs, counting
+ loops without constant bounds once, and the SETs removed times that are added to
+ evaluations.
+ Returns the number of SETs removed.
+ */
+int removeDeadSETs(instructionList * list, unsigned int liveAfter, double trips, double * evaluations)
+{
+    int removed = 0;
+    unsigned int live = liveAfter;
+    for(int i=list->numberOfInstructions-1; i>=0; --i)
+    {
+        instruction * current = &list->array[i];
+        switch(current->sym)
+        {
+            case symFD:
+            case symLT:
+            case symRT:
+                live |= varsReadByVarnum(current->operand[0]);
+                break;
+            case symSET:
+                if(!(live & VAR_BIT(current->var)))
+                {
+                    removeInstruction(list, i);
+                    ++removed;
+                    *evaluations += trips;
+                    break;
+                }
+                live = (live & ~VAR_BIT(current->var)) | varsReadByPolish(&current->expression);
+                break;
+            case symDO:
+            {
+                //the end of the body runs in to the next iteration, which sets the loop variable first, or leaves the loop
+                unsigned int loopVar = VAR_BIT(current->var);
+                unsigned int bodyLiveAfter = live | (varsReadFirstIn(current->body) & ~loopVar);
+                removed += removeDeadSETs(current->body, bodyLiveAfter, trips*constantTrips(current), evaluations);
+                live |= (varsReadFirstIn(current->body) & ~loopVar) |
+                        varsReadByVarnum(current->operand[0]) | varsReadByVarnum(current->operand[1]);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    return removed;
+}
+
+/**
+ Returns a bit for each variable list might read before it has certainly written it.
+ A loop might not run so nothing written in one is certain.
+ */
+unsigned int varsReadFirstIn(instructionList * list)
+{
+    unsigned int readFirst = 0, written = 0;
+    for(int i=0; i<list->numberOfInstructions; ++i)
+    {
+        instruction * current = &list->array[i];
+        switch(current->sym)
+        {
+            case symFD:
+            case symLT:
+            case symRT:
+                readFirst |= varsReadByVarnum(current->operand[0]) & ~written;
+                break;
+            case symSET:
+                readFirst |= varsReadByPolish(&current->expression) & ~written;
+                written |= VAR_BIT(current->var);
+                break;
+            case symDO:
+                readFirst |= (varsReadByVarnum(current->operand[0]) | varsReadByVarnum(current->operand[1]) |
+                              (varsReadFirstIn(current->body) & ~VAR_BIT(current->var))) & ~written;
+                break;
+            default:
+                break;
+        }
+    }
+    return readFirst;
+}
+
+/**
+ Returns how many times loop runs if its bounds are constant, otherwise 1.
+ */
+double constantTrips(instruction * loop)
+{
+    if(loop->operand[0].var!='\0' || loop->operand[1].var!='\0') return 1;
+    double trips = floor(loop->operand[1].value) - (int)loop->operand[0].value + 1;
+    return trips>0 ? trips : 0;
+}
+
+#pragma mark Peephole Optimisation
+/**
+ Module interface,
+ Shrinks symList in place without changing the path it draws. Adjacent turns are merged
+ modulo 360 and dropped if they cancel, FDs in the same direction with no turn between
+ them become one, and a REPEAT left with a single FD or turn in its body becomes that
+ instruction scaled by its trips. Nothing is merged across a REPEAT marker.
+ Returns the number of instructions removed.
+ */
+unsigned long peepholeSymList(symbolList * symList)
+{
+    unsigned long before = symList->length, length = 0;
+    unsigned long * repeatAt = NULL;//where each open REPEAT was written
+    int depth = 0, capacity = 0;
+    for(unsigned long i=0; i<before; ++i)
+    {
+        symbol sym = symList->syms[i];
+        float value = symList->values[i];
+        if(sym==symREPEAT)
+        {
+            if(depth==capacity)
+            {
+                capacity = capacity ? 2*capacity : 8;
+                unsigned long * tmp = realloc(repeatAt, capacity*sizeof(unsigned long));
+                if(tmp==NULL)
+                {
+                    printError("realloc failed exiting.",__FILE__,__FUNCTION__,__LINE__);
+                    exit(1);
+                }
+                repeatAt = tmp;
+            }
+            repeatAt[depth++] = length;
+            symList->syms[length] = sym;
+            symList->values[length++] = value;
+            continue;
+        }
+        if(sym==symENDREPEAT)
+        {
+            unsigned long start = repeatAt[--depth], bodyLength = length-start-1;
+            if(bodyLength>1)
+            {
+                symList->syms[length] = sym;
+                symList->values[length++] = bodyLength;
+                continue;
+            }
+            length = start;
+            if(bodyLength==0) continue;
+            double trips = symList->values[start];
+            sym = symList->syms[start+1];
+            value = sym==symFD ? trips*symList->values[start+1] : fmod(trips*symList->values[start+1], 360);
+        }
+        length = appendMergedSym(symList, length, sym, value);
+    }
+    free(repeatAt);
+    symList->length = length;
+    if(VERBOSE) printf("\npeephole: %lu instructions down to %lu, a ratio of %.3f.\n",
+                       before, length, before ? (double)length/before : 1.0);
+    return before-length;
+}
+
+/**
+ Writes sym and value at symList->syms[length], merging them with the instruction
+ before if it is the same kind of move. Turns become a RT of 0 to 360 and go if that
+ is 0. An FD is only merged with one going the same way, FD 10 FD -20 draws over the
+ first 10 again.
+ Returns the new length.
+ */
+unsigned long appendMergedSym(symbolList * symList, unsigned long length, symbol sym, float value)
+{
+    symbol last = length ? symList->syms[length-1] : symMAIN;
+    float lastValue = length ? symList->values[length-1] : 0;
+    if((sym==symLT || sym==symRT) && isfinite(value))
+    {
+        double turn = sym==symLT ? -value : value;
+        if(last==symRT && isfinite(lastValue))//earlier turns are already RTs
+        {
+            turn += lastValue;
+            --length;
+        }
+        turn = fmod(turn, 360);
+        if(turn<0) turn += 360;
+        if(turn==0) return length;
+        sym = symRT;
+        value = turn;
+    }
+    else if(sym==symFD && last==symFD && isfinite(value) && isfinite(lastValue) && (value>0)==(lastValue>0))
+    {
+        value += lastValue;
+        --length;
+    }
+    symList->syms[length] = sym;
+    symList->values[length] = value;
+    return length+1;
+}
+
+#pragma mark Strength Reduction
+/**
+ Turns each SET X := e in a loop, where e is step*loop variable plus a number and is
+ made only of numbers and the loop variable with + - and *, into SET X := X step + ;
+ with X set to its value for the iteration before the first just before the loop.
+ Only done where that is shorter than e and where every value either way is exact in a
+ float, see reductionIsExact, so the output is bit for bit the same. That limits it to
+ integer and dyadic (0.5, 0.25...) steps and bounds that are numbers. Adding a step
+ like 0.1 over and over drifts further from e every iteration, and a step held in a
+ variable, SET D := C B * ;, is left alone as nothing here knows C is a whole number.
+ program is the whole tree list is in.
+ Returns the number of SETs reduced.
+ */
+int reduceInductionSETs(instructionList * list, instructionList * program, int isWholeProgram)
+{
+    int reduced = 0;
+    for(int i=0; i<list->numberOfInstructions; ++i)
+    {
+        if(list->array[i].sym!=symDO) continue;
+        reduced += reduceInductionSETs(list->array[i].body, program, isWholeProgram);
+        int added = reduceInLoop(list, i, program, isWholeProgram);
+        reduced += added;
+        i += added;//past the SETs put before the loop
+    }
+    return reduced;
+}
+
+/**
+ Reduces the SETs at the top level of the body of the loop at list->array[at]. The
+ loop variable must not be written in the body or the loop start from a variable, and X
+ must be written only by this SET and not read in the body before it. The SET put
+ before the loop changes X even if the loop never runs, so unless it certainly runs X
+ must not be read anywhere outside the body.
+ Returns the number of SETs reduced, each adds one SET before the loop.
+ */
+int reduceInLoop(instructionList * list, int at, instructionList * program, int isWholeProgram)
+{
+    instruction * loop = &list->array[at];
+    instructionList * body = loop->body;
+    char loopVar = loop->var;
+    varnum from = loop->operand[0];
+    unsigned int written = varsWrittenIn(body);
+    if((written & VAR_BIT(loopVar)) || from.var!='\0') return 0;
+    int alwaysRuns = loopRunsAtLeastOnce(loop), reduced = 0;
+    for(int k=0; k<body->numberOfInstructions; ++k)
+    {
+        instruction * current = &body->array[k];
+        polish * expression = &current->expression;
+        float step;
+        if(current->sym!=symSET || expression->numberOfTerms<=3 ||
+           !affineStep(expression, loopVar, &step) ||
+           writesOf(body, current->var)!=1 || (varsReadIn(body, 0, k) & VAR_BIT(current->var)))
+        {
+            continue;
+        }
+        if(!alwaysRuns && (!isWholeProgram || (varsReadOutside(program, body) & VAR_BIT(current->var))))
+        {
+            continue;
+        }
+        //before the loop: e with the loop variable at its first value, less one step
+        instruction first = { .sym = symSET, .var = current->var };
+        first.expression.numberOfTerms = expression->numberOfTerms+2;
+        first.expression.terms = arenaAlloc(list->memory, first.expression.numberOfTerms*sizeof(polishTerm));
+        for(int t=0; t<expression->numberOfTerms; ++t)
+        {
+            polishTerm term = expression->terms[t];
+            if(!term.isOperator && term.operand.var==loopVar)
+            {
+                term.operand = (varnum){ '\0', term.operand.value*(int)from.value };
+            }
+            first.expression.terms[t] = term;
+        }
+        first.expression.terms[expression->numberOfTerms] = (polishTerm){ .operand = { '\0', step } };
+        first.expression.terms[expression->numberOfTerms+1] = (polishTerm){ .isOperator = 1, .op = opMinus };
+        constants nothingKnown = { 0 };
+        foldPolish(&first.expression, &nothingKnown);
+        if(first.expression.numberOfTerms!=1 || first.expression.terms[0].operand.var!='\0' ||
+           !reductionIsExact(expression, loop, step, first.expression.terms[0].operand.value))
+        {
+            continue;
+        }
+        //in the body: X := X step +
+        expression->terms[0] = (polishTerm){ .operand = { current->var, 1 } };
+        expression->terms[1] = (polishTerm){ .operand = { '\0', step } };
+        expression->terms[2] = (polishTerm){ .isOperator = 1, .op = opPlus };
+        expression->numberOfTerms = 3;
+        insertInstruction(list, at+reduced, &first);//loop and current may have moved, body has not
+        ++reduced;
+    }
+    return reduced;
+}
+
+/**
+ 1 if every value the reduction deals in is exact in a float: each intermediate of
+ expression for every value of the loop variable, the seed X starts at and
+ seed + trips*step. That needs the bounds to be numbers and each value to need fewer
+ than 24 significant bits, its magnitude times 2^(binary places) under 2^24.
+ affineStep has already checked expression is only numbers and the loop variable.
+ */
+int reductionIsExact(polish * expression, instruction * loop, float step, float seed)
+{
+    if(loop->operand[0].var!='\0' || loop->operand[1].var!='\0') return 0;
+    double trips = constantTrips(loop);
+    double first = (int)loop->operand[0].value, last = first+trips-1;
+    double loopVarMagnitude = fmax(fabs(first), fabs(last));
+    exactBound * stack = malloc(expression->numberOfTerms*sizeof(exactBound));
+    if(stack==NULL)
+    {
+        printError("malloc failed exiting.",__FILE__,__FUNCTION__,__LINE__);
+        exit(1);
+    }
+    int itemsInStack = 0, exact = 1;
+    for(int i=0; exact && i<expression->numberOfTerms; ++i)
+    {
+        polishTerm * term = &expression->terms[i];
+        exactBound bound;
+        if(term->isOperator)
+        {
+            exactBound rhs = stack[--itemsInStack];
+            exactBound lhs = stack[--itemsInStack];
+            if(term->op==opPlus || term->op==opMinus)
+            {
+                bound = (exactBound){ lhs.magnitude+rhs.magnitude, lhs.places>rhs.places ? lhs.places : rhs.places };
+            }
+            else if(term->op==opMultiply)
+            {
+                bound = (exactBound){ lhs.magnitude*rhs.magnitude, lhs.places+rhs.places };
+            }
+            else exact = 0;
+        }
+        else if(term->operand.var==loop->var)
+        {
+            bound = (exactBound){ fabs(term->operand.value)*loopVarMagnitude, binaryPlaces(term->operand.value) };
+        }
+        else bound = (exactBound){ fabs(term->operand.value), binaryPlaces(term->operand.value) };
+        exact = exact && isExactInFloat(bound);
+        stack[itemsInStack++] = bound;
+    }
+    free(stack);
+    int seedPlaces = binaryPlaces(seed), stepPlaces = binaryPlaces(step);
+    exactBound sequence = { fabs(seed)+trips*fabs(step), seedPlaces>stepPlaces ? seedPlaces : stepPlaces };
+    return exact && isExactInFloat(sequence);
+}
+
+/**
+ Returns how many binary places value needs, more than FLOAT_MANTISSA_BITS if it has
+ no short binary expansion (0.1) or is not a number.
+ */
+int binaryPlaces(float value)
+{
+    int places = 0;
+    while(value!=floorf(value) && places<=FLOAT_MANTISSA_BITS)
+    {
+        value *= 2;
+        ++places;
+    }
+    return places;
+}
+
+/**
+ 1 if every multiple of 2^-places up to magnitude is exact in a float.
+ */
+int isExactInFloat(exactBound bound)
+{
+    return bound.places<=FLOAT_MANTISSA_BITS && ldexp(bound.magnitude, bound.places) < ldexp(1, FLOAT_MANTISSA_BITS);
+}
+
+/**
+ Works out whether expression is step*loopVar plus numbers, made of nothing but numbers
+ and loopVar with + - and *. Any other variable, even one the loop does not write,
+ makes it 0 as its value isn't known here.
+ Returns 1 and sets step if it is, 0 if not.
+ */
+int affineStep(polish * expression, char loopVar, float * step)
+{
+    affineTerm * stack = malloc(expression->numberOfTerms*sizeof(affineTerm));
+    if(stack==NULL)
+    {
+        printError("malloc failed exiting.",__FILE__,__FUNCTION__,__LINE__);
+        exit(1);
+    }
+    int itemsInStack = 0;
+    for(int i=0; i<expression->numberOfTerms; ++i)
+    {
+        polishTerm * term = &expression->terms[i];
+        if(term->isOperator)
+        {
+            affineTerm rhs = stack[--itemsInStack];
+            affineTerm lhs = stack[--itemsInStack];
+            stack[itemsInStack++] = combineAffine(term->op, lhs, rhs);
+        }
+        else if(term->operand.var==loopVar)
+        {
+            stack[itemsInStack++] = (affineTerm){ affAFFINE, 0, term->operand.value };
+        }
+        else if(term->operand.var!='\0')
+        {
+            stack[itemsInStack++] = (affineTerm){ affOTHER };
+        }
+        else
+        {
+            stack[itemsInStack++] = (affineTerm){ affINVARIANT, 1, term->operand.value };
+        }
+    }
+    affineTerm result = stack[0];//parsePOLISH has checked there is exactly one item left
+    free(stack);
+    if(result.kind!=affAFFINE) return 0;
+    *step = result.value;
+    return 1;
+}
+
+/**
+ Returns how lhs op rhs depends on the loop variable.
+ */
+affineTerm combineAffine(operator op, affineTerm lhs, affineTerm rhs)
+{
+    affineTerm other = { affOTHER };
+    if(lhs.kind==affOTHER || rhs.kind==affOTHER) return other;
+    if(lhs.kind==affINVARIANT && rhs.kind==affINVARIANT) return (affineTerm){ affINVARIANT };
+    switch(op)
+    {
+        case opMinus:
+            if(rhs.kind==affAFFINE) rhs.value = -rhs.value;
+            //fall through, lhs - rhs is lhs + -rhs
+        case opPlus:
+            if(lhs.kind==affINVARIANT) return rhs;
+            if(rhs.kind==affINVARIANT) return lhs;
+            lhs.value += rhs.value;
+            return lhs;
+        case opMultiply:
+        {
+            affineTerm affine = lhs.kind==affAFFINE ? lhs : rhs, factor = lhs.kind==affAFFINE ? rhs : lhs;
+            if(factor.kind!=affINVARIANT || !factor.isNumber) return other;
+            affine.value *= factor.value;
+            return affine;
+        }
+        default://dividing can round
+            return other;
+    }
+}
+
+/**
+ Returns a bit for each variable read anywhere in list except in the list skip.
+ */
+unsigned int varsReadOutside(instructionList * list, instructionList * skip)
+{
+    if(list==skip) return 0;
+    unsigned int read = 0;
+    for(int i=0; i<list->numberOfInstructions; ++i)
+    {
+        instruction * current = &list->array[i];
+        if(current->sym!=symDO) read |= varsReadIn(list, i, i+1);
+        else read |= varsReadByVarnum(current->operand[0]) | varsReadByVarnum(current->operand[1]) |
+                     varsReadOutside(current->body, skip);
+    }
+    return read;
+}
+
+#pragma mark Loop Invariant Hoisting
+/**
+ Moves every SET whose value is the same on each iteration of the loop around it to just
+ before that loop. Inner loops are done first so a SET can move out through several.
+ Returns the number of SETs moved.
+ */
+int hoistInvariantSETs(instructionList * list)
+{
+    int hoisted = 0;
+    for(int i=0; i<list->numberOfInstructions; ++i)
+    {
+        if(list->array[i].sym!=symDO) continue;
+        hoisted += hoistInvariantSETs(list->array[i].body);
+        int moved = hoistFromLoop(list, i);
+        hoisted += moved;
+        i += moved;//the loop is now after the SETs that came out of it
+    }
+    return hoisted;
+}
+
+/**
+ Moves the invariant SETs at the top level of the body of the loop at list->array[at] to
+ just before it, in order. SET X := e is invariant if the loop always runs, e reads
+ nothing the body or loop writes, it is the only write of X in the body, and nothing in
+ the body reads X before it. Running it once first then leaves every read the same.
+ Returns the number of SETs moved.
+ */
+int hoistFromLoop(instructionList * list, int at)
+{
+    if(!loopRunsAtLeastOnce(&list->array[at])) return 0;
+    int moved = 0;
+    instructionList * body = list->array[at].body;
+    char loopVar = list->array[at].var;
+    for(int k=0; k<body->numberOfInstructions; ++k)
+    {
+        instruction * current = &body->array[k];
+        if(current->sym!=symSET) continue;
+        unsigned int written = varsWrittenIn(body) | VAR_BIT(loopVar);
+        if(current->var==loopVar || (varsReadByPolish(&current->expression) & written) ||
+           writesOf(body, current->var)!=1 || (varsReadIn(body, 0, k) & VAR_BIT(current->var)))
+        {
+            continue;
+        }
+        instruction hoisted = *current;
+        removeInstruction(body, k--);
+        insertInstruction(list, at+moved, &hoisted);//body is unchanged, only the array it is in moves
+        ++moved;
+    }
+    return moved;
+}
+
+/**
+ Returns 1 if loop has constant bounds and runs at least once, 0 if it might not run.
+ */
+int loopRunsAtLeastOnce(instruction * loop)
+{
+    if(loop->operand[0].var!='\0' || loop->operand[1].var!='\0') return 0;
+    return (int)loop->operand[0].value <= loop->operand[1].value;
+}
+
+/**
+ Returns how many SETs and DOs anywhere in list write to var.
+ */
+int writesOf(instructionList * list, char var)
+{
+    int writes = 0;
+    for(int i=0; i<list->numberOfInstructions; ++i)
+    {
+        instruction * current = &list->array[i];
+        if((current->sym==symSET || current->sym==symDO) && current->var==var) ++writes;
+        if(current->sym==symDO) writes += writesOf(current->body, var);
+    }
+    return writes;
+}
+
+/**
+ Returns a bit for each variable read by list->array[from] up to (not including)
+ list->array[to], and anything nested in them.
+ */
+unsigned int varsReadIn(instructionList * list, int from, int to)
+{
+    unsigned int read = 0;
+    for(int i=from; i<to; ++i)
+    {
+        instruction * current = &list->array[i];
+        switch(current->sym)
+        {
+            case symFD:
+            case symLT:
+            case symRT:
+                read |= varsReadByVarnum(current->operand[0]);
+                break;
+            case symSET:
+                read |= varsReadByPolish(&current->expression);
+                break;
+            case symDO:
+                read |= varsReadByVarnum(current->operand[0]) | varsReadByVarnum(current->operand[1]);
+                read |= varsReadIn(current->body, 0, current->body->numberOfInstructions);
+                break;
+            default:
+                break;
+        }
+    }
+    return read;
+}
+
+unsigned int varsReadByPolish(polish * expression)
+{
+    unsigned int read = 0;
+    for(int t=0; t<expression->numberOfTerms; ++t)
+    {
+        if(!expression->terms[t].isOperator) read |= varsReadByVarnum(expression->terms[t].operand);
+    }
+    return read;
+}
+
+unsigned int varsReadByVarnum(varnum operand)
+{
+    return operand.var=='\0' ? 0 : VAR_BIT(operand.var);
+}
+
+#pragma mark Tree Editing Functions
+/**
+ Inserts a copy of newInstruction at list->array[at], moving the rest along.
+ */
+void insertInstruction(instructionList * list, int at, instruction * newInstruction)
+{
+    if(list->numberOfInstructions==list->capacity)
+    {
+        int newCapacity = list->capacity ? 2*list->capacity : 8;
+        list->array = arenaGrow(list->memory, list->array, list->capacity*sizeof(instruction), newCapacity*sizeof(instruction));
+        list->capacity = newCapacity;
+    }
+    memmove(&list->array[at+1], &list->array[at], (list->numberOfInstructions-at)*sizeof(instruction));
+    list->array[at] = *newInstruction;
+    ++list->numberOfInstructions;
+}
+
+/**
+ Removes list->array[at], moving the rest back. Anything it owns stays in the arena.
+ */
+void removeInstruction(instructionList * list, int at)
+{
+    memmove(&list->array[at], &list->array[at+1], (list->numberOfInstructions-at-1)*sizeof(instruction));
+    --list->numberOfInstructions;
+}
+
+/**
+ Works out again which DO loops in list can be kept as a REPEAT.
+ */
+void markRepeatableLoops(instructionList * list)
+{
+    for(int i=0; i<list->numberOfInstructions; ++i)
+    {
+        if(list->array[i].sym!=symDO) continue;
+        markRepeatableLoops(list->array[i].body);
+        list->array[i].repeatable = loopIsRepeatable(&list->array[i]);
+    }
+}
+
+#pragma mark Unit Test Functions
+void unitTests_optimiser()
+{
+    sput_start_testing();
+    sput_set_output_stream(NULL);
+
+    sput_enter_suite("testFoldConstants()");
+    sput_run_test(testFoldConstants);
+    sput_leave_suite();
+
+    sput_enter_suite("testHoistInvariantSETs()");
+    sput_run_test(testHoistInvariantSETs);
+    sput_leave_suite();
+
+    sput_enter_suite("testHoistingKeepsOutput()");
+    sput_run_test(testHoistingKeepsOutput);
+    sput_leave_suite();
+
+    sput_enter_suite("testRemoveDeadSETs()");
+    sput_run_test(testRemoveDeadSETs);
+    sput_leave_suite();
+
+    sput_enter_suite("testReduceInductionSETs()");
+    sput_run_test(testReduceInductionSETs);
+    sput_leave_suite();
+
+    sput_enter_suite("testPeepholeSymList()");
+    sput_run_test(testPeepholeSymList);
+    sput_leave_suite();
+
+    sput_finish_testing();
+}
+
+void testFoldConstants()
+{
+    const char source[] = "{ SET K := 2 ; DO A FROM K TO 10 { SET B := 3 4 * 2 / A + K 1 + * ; FD K "
+                          "SET K := K 1 + ; FD K } SET C := 1 0 / ; SET D := 0 0 / ; RT C }";
+    instructionList * program = parseProgram(source, strlen(source));
+    constants known = { 0 };
+    int folded = foldConstants(program, &known);
+    instruction * loop = &program->array[1];
+    polish * b = &loop->body->array[0].expression;
+    sput_fail_unless(loop->operand[0].var=='\0' && floatCompare(loop->operand[0].value, 2),
+                     "K is known to be 2 when the loop bounds are read.");
+    sput_fail_unless(b->numberOfTerms==7 && floatCompare(b->terms[0].operand.value, 6) &&
+                     b->terms[1].operand.var=='A' && b->terms[3].operand.var=='K' && b->terms[6].op==opMultiply,
+                     "3 4 * 2 / folds to 6, A and K change in the loop so A + K 1 + * stays.");
+    sput_fail_unless(loop->body->array[1].operand[0].var=='K',
+                     "K is written in the loop so it is not known anywhere in it.");
+    sput_fail_unless(program->array[2].expression.numberOfTerms==1 &&
+                     program->array[3].expression.numberOfTerms==3 &&
+                     program->array[4].operand[0].var=='\0' && isinf(program->array[4].operand[0].value),
+                     "1 0 / folds to infinity, 0 0 / is NaN so is left for run time.");
+    sput_fail_unless(folded==6, "Folding should report the 4 terms of B and 2 of C it removed.");
+    freeInstructionList(program);
+}
+
+void testHoistInvariantSETs()
+{
+    const char test1[] = "{ DO A FROM -25 TO 25 { DO B FROM 1 TO 300 { SET C := 12.14 A ^ ; SET I := C 1.034 * ; "
+                         "SET J := I C + ; SET Q := 1 J / ; RT 134 SET D := C B * ; FD D } } }";
+    instructionList * program = parseProgram(test1, strlen(test1));
+    sput_fail_unless(hoistInvariantSETs(program)==4, "test1.txt's C, I, J and Q should all come out of the B loop.");
+    instructionList * outerBody = program->array[0].body;
+    sput_fail_unless(outerBody->numberOfInstructions==5 && outerBody->array[0].var=='C' &&
+                     outerBody->array[3].var=='Q' && outerBody->array[4].sym==symDO,
+                     "They should be in their original order just before it.");
+    sput_fail_unless(outerBody->array[4].body->numberOfInstructions==3,
+                     "SET D reads B so it should stay, as should the RT and FD.");
+    freeInstructionList(program);
+
+    const char * unmoved[] = {
+        "{ DO A FROM 3 TO 1 { SET C := 2 ; } FD C }",//the loop never runs
+        "{ DO A FROM 1 TO B { SET C := 2 ; } }",//it might not
+        "{ DO A FROM 1 TO 3 { FD C SET C := 2 ; } }",//C is read before it is set
+        "{ DO A FROM 1 TO 3 { SET C := 2 ; SET C := 3 ; } }",//C is set twice
+        "{ DO A FROM 1 TO 3 { SET C := C 1 + ; } }"//it reads itself
+    };
+    for(int i=0; i<5; ++i)
+    {
+        program = parseProgram(unmoved[i], strlen(unmoved[i]));
+        char str[MAX_ERROR_STRING_SIZE];
+        sprintf(str, "Nothing should be hoisted from %s", unmoved[i]);
+        sput_fail_unless(hoistInvariantSETs(program)==0, str);
+        freeInstructionList(program);
+    }
+}
+
+void testHoistingKeepsOutput()
+{
+    const char * programs[] = {
+        "{ DO A FROM -3 TO 3 { DO B FROM 1 TO 30 { SET C := 1.2 A ^ ; SET D := C B * ; RT 134 FD D } } }",
+        "{ SET C := 1 ; DO A FROM 1 TO 4 { FD C DO B FROM 1 TO 2 { SET E := 5 ; FD E RT 90 } SET C := 2 ; } FD C }",
+        "{ DO A FROM 1 TO 5 { SET C := 7 ; FD C RT 72 } }",
+        "{ DO A FROM 1 TO 20 { SET C := A 5 / ; DO B FROM 1 TO A { SET D := C B * 2 * 1 + ; FD D RT 41 } RT 217 } }",
+        "{ DO A FROM 2 TO 9 { DO B FROM -4 TO A { SET D := 1 B 3 * - A + ; FD D RT 72 } } }"
+    };
+    for(int i=0; i<5; ++i)
+    {
+        instructionList * plain = parseProgram(programs[i], strlen(programs[i]));
+        instructionList * optimised = parseProgram(programs[i], strlen(programs[i]));
+        optimiseProgram(optimised, 1);
+        symbolList * expected = executeProgram(plain);
+        symbolList * actual = executeProgram(optimised);
+        pointArray * expectedPath = buildPath(expected);
+        pointArray * actualPath = buildPath(actual);
+        int matches = expectedPath->numberOfPoints==actualPath->numberOfPoints;
+        for(int p=0; matches && p<expectedPath->numberOfPoints; ++p)
+        {
+            matches = floatCompare(expectedPath->array[p].r[X], actualPath->array[p].r[X]) &&
+                      floatCompare(expectedPath->array[p].r[Y], actualPath->array[p].r[Y]);
+        }
+        char str[MAX_ERROR_STRING_SIZE];
+        sprintf(str, "The optimised program should draw the same path as %s", programs[i]);
+        sput_fail_unless(matches, str);
+        freePath(expectedPath);
+        freePath(actualPath);
+        freeInstructionList(plain);
+        freeInstructionList(optimised);
+    }
+}
+
+void testRemoveDeadSETs()
+{
+    const char test1[] = "{ DO A FROM -25 TO 25 { DO B FROM 1 TO 300 { SET C := 12.14 A ^ ; SET I := C 1.034 * ; "
+                         "SET J := I C + ; SET Q := 1 J / ; RT 134 SET D := C B * ; FD D } } }";
+    instructionList * program = parseProgram(test1, strlen(test1));
+    double evaluations = 0;
+    int removed = removeDeadSETs(program, 0, 1, &evaluations);
+    sput_fail_unless(removed==3 && floatCompare(evaluations, 3*51*300) &&
+                     program->array[0].body->array[0].body->numberOfInstructions==4,
+                     "Q, J then I are dead, each set 51 x 300 times, leaving C, RT, D and FD.");
+    freeInstructionList(program);
+
+    const char * programs[] = {
+        "{ SET A := 1 ; SET A := 2 ; FD A }",//the first is overwritten before it is read
+        "{ DO A FROM 1 TO 3 { FD B SET B := A ; } }",//B is read on the next iteration
+        "{ DO A FROM 1 TO 3 { SET A := 5 ; } FD A }",//the loop variable is read after the loop
+        "{ SET B := 2 ; DO A FROM 1 TO B { } }"//B is read by a bound
+    };
+    int expectedRemoved[] = { 1, 0, 0, 0 };
+    for(int i=0; i<4; ++i)
+    {
+        program = parseProgram(programs[i], strlen(programs[i]));
+        char str[MAX_ERROR_STRING_SIZE];
+        sprintf(str, "%d SETs should be dead in %s", expectedRemoved[i], programs[i]);
+        sput_fail_unless(removeDeadSETs(program, 0, 1, &evaluations)==expectedRemoved[i], str);
+        freeInstructionList(program);
+    }
+    program = parseProgram(programs[0], strlen(programs[0]));
+    sput_fail_unless(removeDeadSETs(program, ~0u, 1, &evaluations)==1 && program->numberOfInstructions==2,
+                     "Streamed instructions keep their last SETs, later ones may read them.");
+    freeInstructionList(program);
+}
+
+void testPeepholeSymList()
+{
+    symbolList * symList = initSymList();
+    appendSym(symList, symRT, 217);
+    appendSym(symList, symRT, 41);
+    appendSym(symList, symLT, 258);//cancels both
+    appendSym(symList, symFD, 5);
+    appendSym(symList, symFD, 5);
+    appendSym(symList, symFD, -3);//turns back, keep the point at 10
+    appendSym(symList, symLT, 90);
+    appendSym(symList, symRT, 45);
+    sput_fail_unless(peepholeSymList(symList)==5 && symList->length==3 &&
+                     symList->syms[0]==symFD && floatCompare(symList->values[0], 10) &&
+                     symList->syms[1]==symFD && floatCompare(symList->values[1], -3) &&
+                     symList->syms[2]==symRT && floatCompare(symList->values[2], 315),
+                     "RT 217 RT 41 LT 258 cancel, FD 5 FD 5 merge, LT 90 RT 45 is RT 315.");
+    freeSymList(symList);
+
+    symList = initSymList();
+    appendSym(symList, symFD, 1);
+    appendSym(symList, symREPEAT, 3);
+    appendSym(symList, symFD, 2);
+    appendSym(symList, symENDREPEAT, 1);
+    appendSym(symList, symREPEAT, 10);
+    appendSym(symList, symRT, 36);
+    appendSym(symList, symENDREPEAT, 1);
+    appendSym(symList, symREPEAT, 4);
+    appendSym(symList, symFD, 5);
+    appendSym(symList, symRT, 45);
+    appendSym(symList, symRT, 45);
+    appendSym(symList, symENDREPEAT, 3);
+    peepholeSymList(symList);
+    sput_fail_unless(symList->length==5 && symList->syms[0]==symFD && floatCompare(symList->values[0], 7) &&
+                     symList->syms[1]==symREPEAT && symList->syms[3]==symRT && floatCompare(symList->values[3], 90) &&
+                     symList->syms[4]==symENDREPEAT && floatCompare(symList->values[4], 2),
+                     "REPEAT 3 FD 2 joins the FD 1, the full circle goes and the square's body shrinks to 2.");
+    freeSymList(symList);
+
+    const char source[] = "{ DO A FROM 1 TO 40 { DO B FROM 1 TO A { FD B RT 41 } RT 217 } }";
+    instructionList * program = parseProgram(source, strlen(source));
+    symbolList * plain = executeProgram(program), * merged = executeProgram(program);
+    sput_fail_unless(peepholeSymList(merged)>0, "The RT 41 at the end of each inner loop merges with the RT 217.");
+    pointArray * plainPath = buildPath(plain), * mergedPath = buildPath(merged);//frees the symLists
+    point * a = &plainPath->array[plainPath->numberOfPoints-1], * b = &mergedPath->array[mergedPath->numberOfPoints-1];
+    sput_fail_unless(floatCompare(a->r[X], b->r[X]) && floatCompare(a->r[Y], b->r[Y]),
+                     "Merging the turns across loops should leave the path ending in the same place.");
+    freePath(plainPath);
+    freePath(mergedPath);
+    freeInstructionList(program);
+}
+
+void testReduceInductionSETs()
+{
+    const char source[] = "{ DO A FROM 1 TO 20 { DO B FROM 1 TO 30 "
+                          "{ SET D := B 0.25 * 2 * 1 + ; FD D RT 41 } RT 217 } }";
+    instructionList * program = parseProgram(source, strlen(source));
+    instructionList * outer = program->array[0].body;
+    sput_fail_unless(reduceInductionSETs(program, program, 1)==1, "D is B/2 + 1, every value of it is exact.");
+    polish * before = &outer->array[0].expression, * update = &outer->array[1].body->array[0].expression;
+    sput_fail_unless(outer->array[0].sym==symSET && outer->array[0].var=='D' && before->numberOfTerms==1 &&
+                     before->terms[0].operand.var=='\0' && before->terms[0].operand.value==1,
+                     "Before the B loop D is set to 1, its value with B at 0.");
+    sput_fail_unless(update->numberOfTerms==3 && update->terms[0].operand.var=='D' &&
+                     update->terms[1].operand.var=='\0' && update->terms[1].operand.value==0.5f &&
+                     update->terms[2].op==opPlus, "In the B loop D goes up by 0.5 each time.");
+    freeInstructionList(program);
+
+    const char * unreduced[] = {
+        "{ DO B FROM 1 TO 9 { SET D := B B * 1 + ; FD D } }",//not affine
+        "{ SET C := 2 ; DO B FROM 1 TO 9 { SET D := C B * 1 + ; FD D } }",//the step is a variable
+        "{ DO B FROM 1 TO 9 { FD D SET D := B 2 * 1 + ; } }",//D is read first
+        "{ DO B FROM 1 TO A { SET D := B 2 * 1 + ; } FD D }",//the loop might not run and D is read after
+        "{ DO B FROM 1 TO 9 { SET D := B 2 * ; FD D } }",//already as short as the update
+        "{ DO B FROM 1 TO 100000 { SET D := B 0.1 * 1000 + ; } FD D }",//0.1 is not exact
+        "{ DO B FROM 1 TO 20000000 { SET D := B 2 * 1 + ; FD D } }",//D passes 2^24
+        "{ SET C := 3 ; DO B FROM 1 TO 9 { SET D := B 2 * C + ; FD D } }",//C's value is not known
+        "{ DO B FROM 1 TO 9 { SET D := B 2 * 3 / 1 + ; FD D } }"//dividing can round
+    };
+    for(int i=0; i<9; ++i)
+    {
+        program = parseProgram(unreduced[i], strlen(unreduced[i]));
+        char str[MAX_ERROR_STRING_SIZE];
+        sprintf(str, "Nothing should be reduced in %s", unreduced[i]);
+        sput_fail_unless(reduceInductionSETs(program, program, 1)==0, str);
+        freeInstructionList(program);
+    }
+
+    const char * programs[] = {
+        "{ DO A FROM 1 TO 100000 { SET D := A 0.1 * 1000 + ; } FD D }",
+        "{ DO A FROM 1 TO 5000 { SET D := A 0.3 * 7 + ; FD D RT 89 } }",
+        "{ DO A FROM 1 TO 5000 { SET D := A 0.25 * 7 + ; FD D RT 89 } }",
+        "{ DO A FROM -300 TO 300 { SET D := 0.125 A * 3 - -2 * ; FD D RT 61 } }"
+    };
+    for(int i=0; i<4; ++i)
+    {
+        instructionList * plain = parseProgram(programs[i], strlen(programs[i]));
+        instructionList * optimised = parseProgram(programs[i], strlen(programs[i]));
+        optimiseProgram(optimised, 1);
+        symbolList * expected = executeProgram(plain);
+        symbolList * actual = executeProgram(optimised);
+        int matches = expected->length==actual->length;
+        for(unsigned long k=0; matches && k<expected->length; ++k)
+        {
+            matches = expected->syms[k]==actual->syms[k] && expected->values[k]==actual->values[k];
+        }
+        char str[MAX_ERROR_STRING_SIZE];
+        sprintf(str, "The optimised program should draw exactly what %s does", programs[i]);
+        sput_fail_unless(matches, str);
+        freeSymList(expected);
+        freeSymList(actual);
+        freeInstructionList(plain);
+        freeInstructionList(optimised);
+    }
+}
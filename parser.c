@@ -12,29 +12,88 @@
 #include <ctype.h>
 #include <math.h>
 
-typedef enum operator {
-  opPlus = '+',
-  opMinus = '-',
-  opMultiply = '*',
-  opDivide = '/',
-  opExpo = '^'
-} operator;
-
 typedef struct stack {
   int itemsInStack;
+  int capacity;//array has room for, it is kept between expressions
   float * array;
 } stack;
 
+typedef enum tokenKind {
+  tokFD, tokLT, tokRT, tokDO, tokFROM, tokTO, tokSET,
+  tokASSIGN,//:=
+  tokOPENBRACE, tokCLOSEBRACE, tokSEMICOLON,
+  tokOP,//+ - * / ^
+  tokNUMBER,//a digit or - then a digit
+  tokVAR,//any other word starting A-Z or - then A-Z
+  tokOTHER
+} tokenKind;
+
+/* A view of one token in tokenArray->source, nothing is copied. Tokens are classified
+   as they are scanned so the parser can switch on kind rather than compare strings. */
+typedef struct token {
+  unsigned long offset;
+  int length;
+  tokenKind kind;
+  char var;//'A'-'Z' if the token can be read as a <VAR>, keywords included, else '\0'
+  float value;//tokNUMBER: the number. tokens with a var: -1 for -VAR else 1
+} token;
+
+typedef struct tokenArray {
+  const char * source;
+  token * array;
+  int numberOfTokens, capacity;
+  arena * memory;
+} tokenArray;
+
 typedef struct parser {
-  char ** progArray;
-  int numberOfTokens, atToken;
+  tokenArray * tokens;
+  int atToken;
   float * varValues;
+  instructionList * program;
+  instructionList * currentList;
   symbolList * symList;
   stack * polishCalcStack;
   char ** errorList;
   int numberOfErrors;
+  arena * memory;//the parser, its variables, stack and errors. the tree and tokens have their own
 } parser;
 
+/* A DO whose body parseINSTRCTLST is reading. */
+typedef struct openLoop {
+  instruction loop;
+  instructionList * enclosingList;//the list loop goes in once its body is closed
+} openLoop;
+
+/* A list executeInstrctlst is running, and the loop running it if there is one. */
+typedef struct loopFrame {
+  instructionList * list;
+  int at;//next instruction in list
+  instruction * loop;//NULL for the list executeInstrctlst was given
+  int iter;//this iteration's value of the loop variable, or its first if it is a REPEAT
+  float to;
+  int trips;//if not 0 the loop is kept as a REPEAT and its body runs once
+  unsigned long repeatStart;//index of its symREPEAT
+} loopFrame;
+
+typedef enum streamState {
+  streamMAIN,//waiting for the opening "{"
+  streamINSTRCTLST,//reading top level instructions
+  streamFINISHED,//read the closing "}", anything after it is ignored like parseINSTRCTLST does
+  streamFAILED
+} streamState;
+
+/* Incremental front end. Text is appended a chunk at a time and scanned in to p->tokens,
+   a word cut off by the end of a chunk is left to be rescanned once the rest arrives. Each
+   top level instruction is parsed and run as soon as its last token is read, then its text
+   and tokens are dropped, so only the instruction being read is ever held. */
+struct streamParser {
+  parser * p;
+  char * buffer;//from start, the text of the unfinished instruction then input not yet scanned
+  unsigned long start, length, capacity, scanned;
+  streamState state;
+  int braceDepth;//of the DO being read
+};
+
 //symbol parsers
 int parseMAIN(parser * p);
 int parseINSTRCTLST(parser * p);
@@ -42,12 +101,27 @@ int parseINSTRUCTION(parser * p);
 int parseFD(parser * p);
 int parseRT(parser * p);
 int parseLT(parser * p);
-int parseVARNUM(parser * p, float * result);
+int parseVARNUM(parser * p, varnum * result);
 char parseVAR(parser * p);
 int parseDO(parser * p);
+int parseDOHeader(parser * p, instruction * loop);
+int closeDO(parser * p, instruction * loop);
 int parseSET(parser * p);
 int parseOP(parser * p, operator * op);
-int parsePOLISH(parser * p, float * result);
+int parsePOLISH(parser * p, polish * expression);
+
+//instruction tree functions
+instructionList * initInstructionList(arena * memory);
+int addInstructionToList(parser * p, instruction * newInstruction);
+int addTermToPolish(arena * memory, polish * expression, polishTerm term);
+
+//instruction tree execution
+int executeInstrctlst(parser * p, instructionList * list);
+int finishRepeat(parser * p, loopFrame * frame);
+int readsAreInvariant(instructionList * list, unsigned int unsafe, unsigned int bound);
+int varnumIsInvariant(varnum operand, unsigned int unsafe, unsigned int bound);
+float getVarnumValue(parser * p, varnum operand);
+int evaluatePOLISH(parser * p, polish * expression, float * result);
 
 //parserStruct functions
 parser * initParser();
@@ -61,25 +135,40 @@ int setVarValue(parser *p, char var, float newValue);
 
 //parserStruct -> symbol list funcs
 int addSymToList(parser * p, symbol sym, float value);
-int printSymList(parser * p);
-int printSymNode(symbolNode * node);
+int printSymList(symbolList * symList);
+int printSym(symbol sym, float value);
 
 //parserStruct -> polish calc functions
 int pushValue(parser *p, float value);
 int popToOperator(parser * p, operator op);
 void clearStack(stack * s);
+void reserveStack(stack * s, int capacity);
 
 //parserStruct -> error list functions
 int addErrorToList(parser * p,char * errorString);
 int displayErrors(parser * p);
 int syntaxError(parser * p, const char * errorString);
 int addWhatDoWeExpectStringToErrorList(parser * p, symbol context);
+void clearErrorList(parser * p);
+
+//streamParser functions
+int scanStream(streamParser * s, int atEnd);
+int streamTokenScanned(streamParser * s);
+int runStreamInstruction(streamParser * s);
+void discardStreamText(streamParser * s, unsigned long upTo);
+void compactStream(streamParser * s);
+int failStream(streamParser * s);
 
 //parserStruct -> token array functions
-char ** tokenise(const char * inputString, int * numberOfTokensPtr, const char * delimiter);
-void testTokenArray(char ** tokenArray, int numberOfTokens);
-void freeTokenArray(char **tokenArray,int numberOfTokens);
-int isStringWhiteSpace(char * string);
+tokenArray * tokenise(const char * inputString);
+tokenArray * tokeniseBuffer(const char * source, unsigned long length);
+int addToken(tokenArray * tokens, unsigned long offset, int length);
+void classifyToken(token * newToken, const char * text);
+int tokenIsString(tokenArray * tokens, int index, const char * string);
+int currentTokenIs(parser * p, tokenKind kind);
+float readNumber(const char * text, int length);
+void testTokenArray(tokenArray * tokens);
+void freeTokenArray(tokenArray * tokens);
 
 
 //Unit tests
@@ -92,6 +181,7 @@ void testParserErrors();
 void testVarValueFunctions();
 void testSymListFunctions();
 void testPolishCalcFunctions();
+void testInstructionListFunctions();
 
 void testParseVar();
 void testParseVarnum();
@@ -105,35 +195,83 @@ void testParseInstruction();
 void testParseDo();
 void testParseInstrctlst();
 void testParseMain();
+void testExecuteInstrctlst();
+void testRepeatNodes();
+void testStreamParser();
+void testLongPrograms();
+
+/**
+   Module interface,
+   Validates the length chars at source and expands them into a list of FD, LT and RT
+   instructions which is returned. source need not be NUL terminated.
+   Returns NULL if the program is invalid.
+*/
+symbolList * parse(const char * source, unsigned long length)
+{
+  instructionList * program = parseProgram(source, length);
+  if(program==NULL) return NULL;
+  if(OPTIMISE)
+    {
+      optimiseProgram(program, 1);
+    }
+  if(BENCHMARK)
+    {
+      benchmarkVM(program, BENCHMARK_RUNS);
+    }
+  symbolList * symList = USE_BYTECODE_VM ? runProgramOnVM(program) : executeProgram(program);
+  freeInstructionList(program);
+  if(VERBOSE && symList)
+    {
+      printSymList(symList);
+    }
+  return symList;
+}
 
-symbolList * parse(char * inputString)
+/**
+   Tokenises and validates source, returning its instruction tree or NULL if it is invalid.
+*/
+instructionList * parseProgram(const char * source, unsigned long length)
 {
-  unsigned long inputStringLength = strlen(inputString);
-  if(!inputStringLength)
+  if(!length)
     {
       printError("Parser recieved a empty string. Exiting.",__FILE__,__FUNCTION__,__LINE__);
       return NULL;
     }
   parser * p = initParser();
    
-  p->progArray = tokenise(inputString, &p->numberOfTokens, " \n\r\t\v\f");
+  p->tokens = tokeniseBuffer(source, length);
 
   if(VERBOSE)
     {
-      testTokenArray(p->progArray, p->numberOfTokens);
+      testTokenArray(p->tokens);
     }
-  if(parseMAIN(p))
+  if(!parseMAIN(p))
     {
-      if(VERBOSE)
-        {
-	  printf("\n\nProgram was validated successfully.\n");
-	  printSymList(p);
-        }
+      displayErrors(p);
+      freeSymList(p->symList);
+      freeParser(p);
+      return NULL;
     }
-  else
+  if(VERBOSE)
     {
-      printSymList(p);
-      displayErrors(p);
+      printf("\n\nProgram was validated successfully.\n");
+    }
+  instructionList * program = p->program;
+  p->program = NULL;//so freeParser leaves it alone
+  freeSymList(p->symList);
+  freeParser(p);
+  return program;
+}
+
+/**
+   Runs program with the tree walking interpreter and returns the resulting symList.
+*/
+symbolList * executeProgram(instructionList * program)
+{
+  parser * p = initParser();
+  if(executeInstrctlst(p, program)==0)
+    {
+      freeSymList(p->symList);
       freeParser(p);
       return NULL;
     }
@@ -141,13 +279,252 @@ symbolList * parse(char * inputString)
   freeParser(p);
   return symList;
 }
+
+#pragma mark stream parser
+/**
+   Module interface,
+   Returns an empty streamParser, feed it the program with feedStreamParser().
+*/
+streamParser * initStreamParser()
+{
+  streamParser * s = malloc(sizeof(streamParser));
+  if(s==NULL)
+    {
+      printError("streamParser * s = malloc(sizeof(streamParser)) failed exiting.",__FILE__,__FUNCTION__,__LINE__);
+      exit(1);
+    }
+  s->p = initParser();
+  s->p->tokens = tokeniseBuffer(NULL, 0);
+  s->buffer = NULL;
+  s->start = 0;
+  s->length = 0;
+  s->capacity = 0;
+  s->scanned = 0;
+  s->state = streamMAIN;
+  s->braceDepth = 0;
+  return s;
+}
+
+/**
+   Module interface,
+   Appends the length chars at chunk to the program and runs any top level instructions
+   they complete. chunk can end part way through a word.
+   Returns 0 once the program is known to be invalid, there is no need to feed it more.
+*/
+int feedStreamParser(streamParser * s, const char * chunk, unsigned long length)
+{
+  if(s->state==streamFAILED) return 0;
+  if(s->state==streamFINISHED) return 1;
+  compactStream(s);
+  if(s->length+length+1 > s->capacity)//+1 so runStreamInstruction can always write its "}"
+    {
+      unsigned long newCapacity = s->capacity ? s->capacity : 64;
+      while(newCapacity < s->length+length+1) newCapacity *= 2;
+      char * tmp = realloc(s->buffer, newCapacity);
+      if(tmp==NULL)
+	{
+	  printError("realloc failed exiting.",__FILE__,__FUNCTION__,__LINE__);
+	  exit(1);
+	}
+      s->buffer = tmp;
+      s->capacity = newCapacity;
+      s->p->tokens->source = s->buffer;
+    }
+  memcpy(s->buffer+s->length, chunk, length);
+  s->length += length;
+  return scanStream(s, 0);
+}
+
+/**
+   Module interface,
+   Ends the input, frees s and returns the symList of the whole program or NULL if it was
+   invalid or never closed its "}".
+*/
+symbolList * finishStreamParser(streamParser * s)
+{
+  parser * p = s->p;
+  symbolList * symList = NULL;
+  if(s->state!=streamFAILED) scanStream(s, 1);
+  switch(s->state)
+    {
+    case streamMAIN:
+      printError("Parser recieved a empty string. Exiting.",__FILE__,__FUNCTION__,__LINE__);
+      break;
+    case streamINSTRCTLST:
+      //an instruction that never finished fails to parse, reporting what it was missing
+      p->atToken = 0;
+      if(p->tokens->numberOfTokens==0 || parseINSTRCTLST(p))
+	{
+	  addErrorToList(p,"ERROR: expected program to end with a ""}""\n");
+	}
+      displayErrors(p);
+      break;
+    case streamFINISHED:
+      if(VERBOSE)
+	{
+	  printf("\n\nProgram was validated successfully.\n");
+	  printSymList(p->symList);
+	}
+      symList = p->symList;
+      p->symList = NULL;
+      break;
+    case streamFAILED:
+      break;
+    }
+  if(p->symList) freeSymList(p->symList);
+  freeParser(p);
+  free(s->buffer);
+  free(s);
+  return symList;
+}
+
+/*
+ *  Scans the whitespace separated words after s->scanned in to s->p->tokens, handing each to
+ *  streamTokenScanned. Unless atEnd, a word running up to the end of the buffer may be
+ *  cut short so it is left for the next chunk.
+ *  Returns 0 if the program is invalid, 1 otherwise.
+ */
+int scanStream(streamParser * s, int atEnd)
+{
+  while(s->state==streamMAIN || s->state==streamINSTRCTLST)
+    {
+      unsigned long start = s->scanned;
+      while(start<s->length && isspace((unsigned char)s->buffer[start])) ++start;
+      unsigned long end = start;
+      while(end<s->length && !isspace((unsigned char)s->buffer[end])) ++end;
+      if(end==start || (end==s->length && !atEnd))
+	{
+	  s->scanned = start;
+	  if(s->p->tokens->numberOfTokens==0) discardStreamText(s, s->scanned);
+	  break;
+	}
+      s->scanned = end;
+      addToken(s->p->tokens, start, (int)(end-start));
+      if(streamTokenScanned(s)==0) return failStream(s);
+    }
+  return s->state!=streamFAILED;
+}
+
+/*
+ *  Called with each new token. Works out from the kind of token that started the current
+ *  top level instruction whether the new token ends it, and if so runs it.
+ *  Returns 0 if the program is invalid.
+ */
+int streamTokenScanned(streamParser * s)
+{
+  parser * p = s->p;
+  tokenArray * tokens = p->tokens;
+  token * last = &tokens->array[tokens->numberOfTokens-1];
+  if(s->state==streamMAIN)
+    {
+      p->atToken = 0;
+      if(!currentTokenIs(p, tokOPENBRACE))
+	{
+	  parseMAIN(p);//for its error message
+	  displayErrors(p);
+	  return 0;
+	}
+      s->state = streamINSTRCTLST;
+      discardStreamText(s, s->scanned);
+      return 1;
+    }
+  switch(tokens->array[0].kind)
+    {
+    case tokCLOSEBRACE:
+      s->state = streamFINISHED;
+      return 1;
+    case tokFD:
+    case tokLT:
+    case tokRT:
+      if(tokens->numberOfTokens<2) return 1;
+      break;
+    case tokSET:
+      if(last->kind!=tokSEMICOLON) return 1;
+      break;
+    case tokDO:
+      if(last->kind==tokOPENBRACE) ++s->braceDepth;
+      if(last->kind!=tokCLOSEBRACE || --s->braceDepth>0) return 1;
+      break;
+    default:
+      break;//not an instruction, parse it now for the error
+    }
+  return runStreamInstruction(s);
+}
+
+/*
+ *  Parses the tokens of one complete top level instruction as an <INSTRCTLST> closed by a
+ *  "}" written over the whitespace after it, runs it with the tree walker so variables
+ *  carry over to later instructions, then drops it.
+ *  Returns 0 if the instruction is invalid.
+ */
+int runStreamInstruction(streamParser * s)
+{
+  parser * p = s->p;
+  unsigned long end = s->scanned;
+  s->buffer[end] = '}';
+  addToken(p->tokens, end, 1);
+  p->atToken = 0;
+  if(!parseINSTRCTLST(p))
+    {
+      displayErrors(p);
+      return 0;
+    }
+  if(OPTIMISE) optimiseProgram(p->program, 0);//later instructions may read its variables
+  if(executeInstrctlst(p, p->program)==0) return 0;
+  arena * memory = p->program->memory;
+  resetArena(memory);//drops the instruction just run, keeping a block for the next
+  p->program = initInstructionList(memory);
+  p->currentList = p->program;
+  clearErrorList(p);//only warnings are left, don't let them build up
+  s->braceDepth = 0;
+  discardStreamText(s, end<s->length ? end+1 : end);
+  return 1;
+}
+
+/*
+ *  Drops the tokens read so far and the text before upTo. The text is only moved out of
+ *  the buffer by compactStream, once per chunk rather than once per instruction.
+ */
+void discardStreamText(streamParser * s, unsigned long upTo)
+{
+  s->start = upTo;
+  if(s->scanned<upTo) s->scanned = upTo;//upTo can include the whitespace after the last token
+  s->p->tokens->numberOfTokens = 0;
+}
+
+/*
+ *  Moves the text from s->start to the front of the buffer, shifting the tokens that view it.
+ */
+void compactStream(streamParser * s)
+{
+  if(s->start==0) return;
+  memmove(s->buffer, s->buffer+s->start, s->length-s->start);
+  tokenArray * tokens = s->p->tokens;
+  for(int i=0; i<tokens->numberOfTokens; ++i)
+    {
+      tokens->array[i].offset -= s->start;
+    }
+  s->length -= s->start;
+  s->scanned -= s->start;
+  s->start = 0;
+}
+
+/*
+ *  Marks s as invalid, returns 0.
+ */
+int failStream(streamParser * s)
+{
+  s->state = streamFAILED;
+  return 0;
+}
+
 /**
  *<MAIN>        ::= ""{"" <INSTRCTLST>
  */
 #pragma mark symbol parsers
 int parseMAIN(parser * p)
 {
-  if(stringsMatch(p->progArray[p->atToken], "{"))
+  if(currentTokenIs(p, tokOPENBRACE))
     {
       if(incrementAtToken(p))
         {
@@ -166,50 +543,69 @@ int parseMAIN(parser * p)
 }
 /**
  * <INSTRCTLST>  ::= <INSTRUCTION><INSTRCTLST> | ""}"" 
+ *
+ * Read with a loop rather than recursion, keeping the DOs whose bodies are still open
+ * on a stack, so neither a program's length nor how deep its loops nest is limited by
+ * the C stack. Stops at the "}" closing the list p->currentList is on entry.
  */
 int parseINSTRCTLST(parser * p)
 {
-  if(stringsMatch(p->progArray[p->atToken], "}"))
-    {
-      return 1;
-    }
-  else if(parseINSTRUCTION(p))
-    {
-      return parseINSTRCTLST(p);
-    }
-  else
-    {
-      syntaxError(p,"Expected to read an instruction or a ""}"".");
-      return 0;
+  openLoop * open = NULL;
+  int depth = 0, capacity = 0, parsed = 1;
+  instructionList * outermost = p->currentList;
+  while(parsed && !(depth==0 && currentTokenIs(p, tokCLOSEBRACE)))
+    {
+      if(currentTokenIs(p, tokCLOSEBRACE))
+	{
+	  openLoop * innermost = &open[--depth];
+	  p->currentList = innermost->enclosingList;
+	  parsed = closeDO(p, &innermost->loop);
+	}
+      else if(currentTokenIs(p, tokDO))
+	{
+	  if(depth==capacity)
+	    {
+	      capacity = capacity ? 2*capacity : 16;
+	      openLoop * tmp = realloc(open, capacity*sizeof(openLoop));
+	      if(tmp==NULL)
+		{
+		  printError("openLoop * tmp = realloc(open, capacity*sizeof(openLoop)) failed exiting.",__FILE__,__FUNCTION__,__LINE__);
+		  exit(1);
+		}
+	      open = tmp;
+	    }
+	  open[depth].enclosingList = p->currentList;
+	  parsed = parseDOHeader(p, &open[depth].loop);
+	  if(parsed) p->currentList = open[depth++].loop.body;
+	}
+      else
+	{
+	  parsed = parseINSTRUCTION(p);
+	}
+      if(!parsed) syntaxError(p,"Expected to read an instruction or a ""}"".");
     }
+  free(open);
+  p->currentList = outermost;
+  return parsed ? 1 : 0;
 }
 /**
    <INSTRUCTION> ::= <FD> | <LT> | <RT> | <DO> | <SET>
 */
 int parseINSTRUCTION(parser * p)
 {
-  if(parseFD(p))
-    {
-      return 1;
-    }
-  else if(parseLT(p))
-    {
-      return 1;
-    }
-  else if(parseRT(p))
-    {
-      return 1;
-    }
-  else if(parseDO(p))
-    {
-      return 1;
-    }
-  else if(parseSET(p))
-    {
-      return 1;
-    }
-  else
-    {
+  switch(p->tokens->array[p->atToken].kind)
+    {
+    case tokFD:
+      return parseFD(p);
+    case tokLT:
+      return parseLT(p);
+    case tokRT:
+      return parseRT(p);
+    case tokDO:
+      return parseDO(p);
+    case tokSET:
+      return parseSET(p);
+    default:
       //error handled in parseINSTRCTLST()
       return 0;
     }
@@ -219,24 +615,24 @@ int parseINSTRUCTION(parser * p)
  */
 int parseFD(parser * p)
 {
-  if(stringsMatch(p->progArray[p->atToken], "FD"))
+  if(currentTokenIs(p, tokFD))
     {
       if(incrementAtToken(p)==0) return 0;
       else
         {
-	  float value;
-	  if(parseVARNUM(p,&value)==0)
+	  instruction newInstruction = { .sym = symFD };
+	  if(parseVARNUM(p,&newInstruction.operand[0])==0)
             {
 	      addWhatDoWeExpectStringToErrorList(p, symFD);
 	      syntaxError(p,"FD could not read VARNUM.");
 	      return 0;
             }
-	  if(value==0)
+	  if(newInstruction.operand[0].var=='\0' && newInstruction.operand[0].value==0)
             {
 	      syntaxError(p,"FD 0 is a redundant instruction.");
 	      return 1;
             }
-	  return addSymToList(p, symFD, value);
+	  return addInstructionToList(p, &newInstruction);
         }
     }
   return 0;
@@ -246,24 +642,24 @@ int parseFD(parser * p)
  */
 int parseLT(parser * p)
 {
-  if(stringsMatch(p->progArray[p->atToken], "LT"))
+  if(currentTokenIs(p, tokLT))
     {
       if(incrementAtToken(p)==0) return 0;
       else
         {
-	  float value;
-	  if(parseVARNUM(p,&value)==0)
+	  instruction newInstruction = { .sym = symLT };
+	  if(parseVARNUM(p,&newInstruction.operand[0])==0)
             {
 	      addWhatDoWeExpectStringToErrorList(p, symLT);
 	      syntaxError(p,"LT could not read VARNUM.");
 	      return 0;
             }
-	  if(value==0)
+	  if(newInstruction.operand[0].var=='\0' && newInstruction.operand[0].value==0)
             {
 	      syntaxError(p,"LT 0 is a redundant instruction.");
 	      return 1;
             }
-	  return addSymToList(p, symLT, value);
+	  return addInstructionToList(p, &newInstruction);
         }
    
     }
@@ -274,95 +670,68 @@ int parseLT(parser * p)
  */
 int parseRT(parser * p)
 {
-  if(!stringsMatch(p->progArray[p->atToken], "RT")) return 0;
+  if(!currentTokenIs(p, tokRT)) return 0;
   else
     {
       if(incrementAtToken(p)==0) return 0;
       else
         {
-	  float value;
-	  if(parseVARNUM(p,&value)==0)
+	  instruction newInstruction = { .sym = symRT };
+	  if(parseVARNUM(p,&newInstruction.operand[0])==0)
             {
 	      addWhatDoWeExpectStringToErrorList(p, symRT);
 	      syntaxError(p,"RT could not read VARNUM.");
 	      return 0;
             }
-	  if(value==0)
+	  if(newInstruction.operand[0].var=='\0' && newInstruction.operand[0].value==0)
             {
 	      syntaxError(p,"RT 0 is a redundant instruction.");
 	      return 1;
             }
-	  return addSymToList(p, symRT, value);
+	  return addInstructionToList(p, &newInstruction);
         }
     }
 }
 /*
  * <VARNUM>      ::= number | <VAR>
  */
-int parseVARNUM(parser * p, float * result)
+int parseVARNUM(parser * p, varnum * result)
 {
-  float value;
-  if(strlen(p->progArray[p->atToken])<1)
+  token * current = &p->tokens->array[p->atToken];
+  if(current->kind==tokNUMBER)
     {
-      printError("parseVARNUM recieved a empty string.",__FILE__,__FUNCTION__,__LINE__);
-      return 0;
-    }
-  if(isdigit(p->progArray[p->atToken][0]) ||
-     ( p->progArray[p->atToken][0]=='-' &&
-       strlen(p->progArray[p->atToken])>1 &&
-       isdigit(p->progArray[p->atToken][1]))) 
-    {
-      value = atof(p->progArray[p->atToken]);
+      float value = current->value;
       if(incrementAtToken(p)==0) return 0;
-      *result = value;
+      result->var = '\0';
+      result->value = value;
       return 1;
     }
-  else if(isupper(p->progArray[p->atToken][0]))
+  else if(current->var!='\0')
     {
+      float sign = current->value;
       char var = parseVAR(p);
       if(var=='\0') return 0; //could not read a valid VAR. error sent in func
-      value = getVarValue(p,var);//retrieves the value of the specified variable
-      *result = value;
+      result->var = var;//value is looked up when the instruction is executed
+      result->value = sign;
       return 1;
     }
-  else if(p->progArray[p->atToken][0]=='-' &&
-	  strlen(p->progArray[p->atToken])>1 &&
-	  isupper(p->progArray[p->atToken][1])) {
-      char var = parseVAR(p);
-      if(var=='\0') return 0; //could not read a valid VAR. error sent in func
-      value = getVarValue(p,var);//retrieves the value of the specified variable
-      *result = -value;
-      return 1;
-    } else {
+  else
+    {
       return 0;
     }
 }
 
 /**
-   Reads the token p->progArray[p->atToken], if it is a valid VAR i.e. a char 'A'-'Z' 
+   Reads the token p->tokens->array[p->atToken], if it is a valid VAR i.e. a char 'A'-'Z' 
    then that charecter is return, other wise 0 is.
  
    <VAR>         ::= [A-Z]
 */
 char parseVAR(parser * p)
 {
-  if(strlen(p->progArray[p->atToken])<1)
-    {
-      printError("parseVAR recieved a empty string. Exiting.",__FILE__,__FUNCTION__,__LINE__);
-      return '\0';
-    }
-  if(isupper(p->progArray[p->atToken][0]))
-    {
-      return incrementAtToken(p) ? p->progArray[p->atToken-1][0] : '\0';
-    }
-  else if(p->progArray[p->atToken][0]=='-' &&
-       strlen(p->progArray[p->atToken])>1 &&
-       isupper(p->progArray[p->atToken][1])) 
-    {
-      return incrementAtToken(p) ? p->progArray[p->atToken-1][1] : '\0';     
-    } else {
-    return '\0';
-  }
+  char var = p->tokens->array[p->atToken].var;
+  if(var=='\0') return '\0';
+  return incrementAtToken(p) ? var : '\0';
 }
 
 /*
@@ -370,9 +739,25 @@ char parseVAR(parser * p)
  *
  */
 int parseDO(parser * p)
+{
+  instruction newInstruction;
+  if(parseDOHeader(p, &newInstruction)==0) return 0;
+  instructionList * enclosingList = p->currentList;
+  p->currentList = newInstruction.body;
+  int bodyParsed = parseINSTRCTLST(p);
+  p->currentList = enclosingList;
+  if(!bodyParsed) return 0;//the body is freed with the rest of the tree
+  return closeDO(p, &newInstruction);
+}
+
+/*
+ * Reads "DO" <VAR> "FROM" <VARNUM> "TO" <VARNUM> "{" into loop and gives it an empty
+ * body, the body is parsed once into its own list and run by executeInstrctlst.
+ */
+int parseDOHeader(parser * p, instruction * loop)
 {
   //"DO"
-  if(!stringsMatch(p->progArray[p->atToken], "DO")) return 0;
+  if(!currentTokenIs(p, tokDO)) return 0;
   else
     {
       if(incrementAtToken(p)==0) return 0;
@@ -387,7 +772,7 @@ int parseDO(parser * p)
         }
         
       // "FROM"
-      if(!stringsMatch(p->progArray[p->atToken], "FROM"))
+      if(!currentTokenIs(p, tokFROM))
         {
 	  addWhatDoWeExpectStringToErrorList(p,symDO);
 	  syntaxError(p,"Could not read ""FROM"".");
@@ -396,8 +781,8 @@ int parseDO(parser * p)
       if(incrementAtToken(p)==0) return 0;
  
       // <VARNUM> start
-      float fromVarNum;
-      if(!parseVARNUM(p,&fromVarNum))
+      *loop = (instruction){ .sym = symDO, .var = var };
+      if(!parseVARNUM(p,&loop->operand[0]))
         {
 	  addWhatDoWeExpectStringToErrorList(p,symDO);
 	  syntaxError(p,"Could not read 1st <VARNUM>.");
@@ -405,7 +790,7 @@ int parseDO(parser * p)
         }
         
       // "TO"
-      if(!stringsMatch(p->progArray[p->atToken], "TO"))
+      if(!currentTokenIs(p, tokTO))
         {
 	  addWhatDoWeExpectStringToErrorList(p,symDO);
 	  syntaxError(p,"Could not read ""TO"".");
@@ -414,8 +799,7 @@ int parseDO(parser * p)
       if(incrementAtToken(p)==0) return 0;
         
       // <VARNUM> end
-      float toVarNum;
-      if(!parseVARNUM(p,&toVarNum))
+      if(!parseVARNUM(p,&loop->operand[1]))
         {
 	  addWhatDoWeExpectStringToErrorList(p,symDO);
 	  syntaxError(p,"Could not read 2nd <VARNUM>.");
@@ -423,32 +807,35 @@ int parseDO(parser * p)
         }
         
       // get "{"
-      if(!stringsMatch(p->progArray[p->atToken], "{"))
+      if(!currentTokenIs(p, tokOPENBRACE))
         {
 	  addWhatDoWeExpectStringToErrorList(p,symDO);
 	  syntaxError(p,"Could not read ""{"".");
 	  return 0;
         }
       if(incrementAtToken(p)==0) return 0;
-      //now loop:
-      int loopStartToken = p->atToken;
-      for(int iter = fromVarNum; iter<=toVarNum; ++iter)
-        {
-	  p->varValues[(int)var]=iter;
-	  if(parseINSTRCTLST(p)==0) return 0;
-	  p->atToken = loopStartToken;
-        }
+      loop->body = initInstructionList(p->program->memory);
       return 1;
     }
 }
 
+/*
+ * Steps past the "}" closing the body of loop and adds it to p->currentList.
+ */
+int closeDO(parser * p, instruction * loop)
+{
+  if(incrementAtToken(p)==0) return 0;
+  loop->repeatable = loopIsRepeatable(loop);
+  return addInstructionToList(p, loop);
+}
+
 /* 
  * <SET> ::= "SET" <VAR> ":=" <POLISH>
  */
 int parseSET(parser * p)
 {
   // "SET"
-  if(!stringsMatch(p->progArray[p->atToken], "SET")) return 0;
+  if(!currentTokenIs(p, tokSET)) return 0;
   else
     {
       if(incrementAtToken(p)==0) return 0;
@@ -462,7 +849,7 @@ int parseSET(parser * p)
         }
         
       // ":="
-      if(!stringsMatch(p->progArray[p->atToken], ":="))
+      if(!currentTokenIs(p, tokASSIGN))
         {
 	  addWhatDoWeExpectStringToErrorList(p,symDO);
 	  syntaxError(p,"Could not read "":="".");
@@ -470,51 +857,58 @@ int parseSET(parser * p)
         }
       if(incrementAtToken(p)==0) return 0;
         
-      clearStack(p->polishCalcStack);
-      float setToValue;
-      if(parsePOLISH(p, &setToValue)==0) return 0;
-      if(setVarValue(p, var, setToValue)==0) return 0;
-        
-      return 1;
+      instruction newInstruction = { .sym = symSET, .var = var };
+      if(parsePOLISH(p, &newInstruction.expression)==0)
+        {
+	  return 0;//the terms are freed with the rest of the tree
+        }
+      return addInstructionToList(p, &newInstruction);
     }
 }
 
 /*
  * <POLISH> ::= <OP> <POLISH> | <VARNUM> <POLISH> | ";"
+ *
+ * Reads the terms of the expression into expression. The stack depth is
+ * tracked as we go so a badly formed expression is rejected here rather than
+ * when it is evaluated.
  */
-int parsePOLISH(parser * p, float * result)
+int parsePOLISH(parser * p, polish * expression)
 {
-  if(stringsMatch(p->progArray[p->atToken], ";"))
+  int depth = 0;
+  expression->terms = NULL;
+  expression->numberOfTerms = 0;
+  while(!currentTokenIs(p, tokSEMICOLON))
     {
-      if(p->polishCalcStack->itemsInStack!=1)
+      polishTerm term = { 0 };
+      if(parseVARNUM(p,&term.operand))
         {
-	  syntaxError(p,"polish expression incorrectly formatted.");
-	  return 0;
+	  ++depth;
         }
-      if(incrementAtToken(p)==0) return 0;
-      *result = p->polishCalcStack->array[0];
-      return 1;
-    }
-  // <VARNUM> end
-  float varnumValue;
-  operator op;
-  if(parseVARNUM(p,&varnumValue))
-    {
-      pushValue(p, varnumValue);
-      return parsePOLISH(p, result);
-    }
-  if(parseOP(p,&op))
-    {
-      if(popToOperator(p, op)==0)
+      else if(parseOP(p,&term.op))
+        {
+	  if(depth<2)
+	    {
+	      syntaxError(p,"polish expression incorrectly formatted.");
+	      return 0;
+	    }
+	  --depth;
+	  term.isOperator = 1;
+        }
+      else
         {
-	  syntaxError(p,"polish expression incorrectly formatted.");
+	  addWhatDoWeExpectStringToErrorList(p, symPOLISH);
+	  syntaxError(p,"could not read VARNUM or OP or ;.");
 	  return 0;
         }
-      return parsePOLISH(p, result);
+      addTermToPolish(p->program->memory, expression, term);
     }
-  addWhatDoWeExpectStringToErrorList(p, symPOLISH);
-  syntaxError(p,"could not read VARNUM or OP or ;.");
-  return 0;
+  if(depth!=1)
+    {
+      syntaxError(p,"polish expression incorrectly formatted.");
+      return 0;
+    }
+  return incrementAtToken(p);
 }
 
 /*
@@ -522,28 +916,9 @@ int parsePOLISH(parser * p, float * result)
 */
 int parseOP(parser * p, operator * op)
 {
-  if(stringsMatch(p->progArray[p->atToken], "+"))
-    {
-      *op = opPlus;
-    }
-  else if(stringsMatch(p->progArray[p->atToken], "-"))
-    {
-      *op = opMinus;
-    }
-  else if(stringsMatch(p->progArray[p->atToken], "*"))
-    {
-      *op = opMultiply;
-    }
-  else if(stringsMatch(p->progArray[p->atToken], "/"))
-    {
-      *op = opDivide;
-    }
-  else if(stringsMatch(p->progArray[p->atToken], "^"))
-    {
-      *op = opExpo;
-    }
-  else return 0;
-    
+  token * current = &p->tokens->array[p->atToken];
+  if(current->kind!=tokOP) return 0;
+  *op = p->tokens->source[current->offset];//operator values are their chars
   return incrementAtToken(p) ? 1 : 0;
 }
 
@@ -553,29 +928,21 @@ int parseOP(parser * p, operator * op)
 */
 parser * initParser()
 {
-  parser * p = malloc(sizeof(parser));
-  if(p==NULL)
-    {
-      printError("parser * p = malloc(sizeof(parser)) failed exiting.",__FILE__,__FUNCTION__,__LINE__);
-      exit(1);
-    }
-  p->progArray = NULL;
-  p->numberOfTokens = 0;
+  arena * memory = initArena("parse");
+  parser * p = arenaAlloc(memory, sizeof(parser));
+  p->memory = memory;
+  p->tokens = NULL;
   p->atToken=0;
-  p->varValues = calloc('Z'+1, sizeof(int));//over sized array, variables can be indexed by their ascii values
-  p->symList = malloc(sizeof(symbolList));
-  if(p->symList==NULL)
-    {
-      printError(" p->symList = malloc(sizeof(symbolList)) failed exiting.",__FILE__,__FUNCTION__,__LINE__);
-      exit(1);
-    }
-  p->symList->length=0;
-  p->symList->start=NULL;
-  p->symList->end=NULL;
+  p->varValues = arenaAlloc(memory, ('Z'+1)*sizeof(float));//over sized array, variables can be indexed by their ascii values
+  memset(p->varValues, 0, ('Z'+1)*sizeof(float));
+  p->program = initInstructionList(initArena("program"));
+  p->currentList = p->program;
+  p->symList = initSymList();
     
-  p->polishCalcStack = malloc(sizeof(stack));
+  p->polishCalcStack = arenaAlloc(memory, sizeof(stack));
   p->polishCalcStack->array = NULL;
   p->polishCalcStack->itemsInStack=0;
+  p->polishCalcStack->capacity=0;
   p->errorList=NULL;
   p->numberOfErrors=0;
   return p;
@@ -586,16 +953,10 @@ parser * initParser()
 */
 void freeParser(parser * p)
 {
-  freeTokenArray(p->progArray, p->numberOfTokens);
-  //free error list:
-  for(int i=0; i<p->numberOfErrors; ++i)
-    {
-      free(p->errorList[i]);
-    }
-  free(p->errorList);
+  freeTokenArray(p->tokens);
+  freeInstructionList(p->program);
   free(p->polishCalcStack->array);
-  free(p->polishCalcStack);
-  free(p);
+  freeArena(p->memory);//p itself is in here
   //do not want to free symlist as this is returned.
 }
 
@@ -605,10 +966,9 @@ void freeParser(parser * p)
 */
 int incrementAtToken(parser * p)
 {
-  if(p->atToken < p->numberOfTokens-1)
+  if(p->atToken < p->tokens->numberOfTokens-1)
     {
       ++p->atToken;
-      //if(VERBOSE) printf("moved to token %d [%s]\n",p->atToken, p->progArray[p->atToken]);
       return 1;
     }
   else
@@ -654,64 +1014,86 @@ float getVarValue(parser *p, char var)
        
 #pragma mark symbol list functions
 /**
-   Creates a symbolNode for the input values and ands it to p->symList linked list
+   Appends sym and value to p->symList.
    symList only needs to contain FD LT and RT instructions, all others can be expanded to these.
    if this function is called with a sym other than these, it prints an error and returns 0.
    otherwise it returns the new length of the list
 */
 int addSymToList(parser * p, symbol sym, float value)
 {
-  symbolNode * newNode = malloc(sizeof(symbolNode));
-  if(newNode==NULL)
+  return appendSym(p->symList, sym, value);
+}
+
+/**
+   builds and returns a * to an empty symbolList.
+*/
+symbolList * initSymList()
+{
+  symbolList * symList = malloc(sizeof(symbolList));
+  if(symList==NULL)
     {
-      printError("symbolNode * newNode = malloc(sizeof(symbolNode)) failed.", __FILE__, __FUNCTION__, __LINE__);
+      printError("symbolList * symList = malloc(sizeof(symbolList)) failed exiting.",__FILE__,__FUNCTION__,__LINE__);
       exit(1);
     }
-  newNode->sym = sym;
-  newNode->value = value;
-  newNode->next = NULL;
-  if(sym!=symFD && sym!=symLT && sym!=symRT)
+  symList->syms=NULL;
+  symList->values=NULL;
+  symList->length=0;
+  symList->capacity=0;
+  return symList;
+}
+
+/**
+   Does the work of addSymToList for any symList, so the bytecode VM can
+   build its output without a parser.
+*/
+int appendSym(symbolList * symList, symbol sym, float value)
+{
+  if(sym!=symFD && sym!=symLT && sym!=symRT && sym!=symREPEAT && sym!=symENDREPEAT)
     {
       printError("addSymToList called a sym type that doesnt need to be placed on symList.", __FILE__, __FUNCTION__, __LINE__);
       return 0;
     }
-  if(p->symList->length==0)
-    {//if first node:
-      p->symList->start = newNode;
-      p->symList->end = newNode;
-    }
-  else
+  if(symList->length==symList->capacity)
     {
-      p->symList->end->next = newNode;
-      p->symList->end = newNode;
+      unsigned long newCapacity = symList->capacity ? 2*symList->capacity : 256;
+      unsigned char * syms = realloc(symList->syms, newCapacity*sizeof(unsigned char));
+      float * values = realloc(symList->values, newCapacity*sizeof(float));
+      if(syms==NULL || values==NULL)
+	{
+	  printError("realloc failed exiting.", __FILE__, __FUNCTION__, __LINE__);
+	  exit(1);
+	}
+      symList->syms = syms;
+      symList->values = values;
+      symList->capacity = newCapacity;
     }
-  return (int)++p->symList->length;
+  symList->syms[symList->length] = (unsigned char)sym;
+  symList->values[symList->length] = value;
+  return (int)++symList->length;
 }
 
 /**
-   Prints each node of p->symList to stdout.
+   Prints each instruction in symList to stdout.
    Returns 1 if completed succesfully, 0 if there is unexpected symbols in the list.
 */
-int printSymList(parser * p)
+int printSymList(symbolList * symList)
 {
-  symbolNode * current = p->symList->start;
   printf("{\n");
-  while(current)
+  for(unsigned long i=0; i<symList->length; ++i)
     {
-      if(printSymNode(current)==0) return 0;
-      current=current->next;
+      if(printSym(symList->syms[i], symList->values[i])==0) return 0;
     }
   printf("}\n");
   return 1;
 }
 
 /**
-   Prints a line detailing the contents of node to stdout.
+   Prints a line detailing sym and value to stdout.
    Returns 1 if completed succesfully, 0 if there is an unexpected symbols.
 */
-int printSymNode(symbolNode * node)
+int printSym(symbol sym, float value)
 {
-  switch (node->sym)
+  switch (sym)
     {
     case symFD:
       {
@@ -728,13 +1110,332 @@ int printSymNode(symbolNode * node)
 	printf("    LT   ");
 	break;
       }
+    case symREPEAT:
+      {
+	printf("    REPEAT ");
+	break;
+      }
+    case symENDREPEAT:
+      {
+	printf("    END REPEAT of ");
+	break;
+      }
     default:
       {
 	printError("symList contained a unexpected symbol. Only FD, RT, and LT instructions are neccessary to be added to symList, others can be expanded to just these.", __FILE__, __FUNCTION__, __LINE__);
 	return 0;
       }
     }
-  printf("%f\n",node->value);
+  printf("%f\n",value);
+  return 1;
+}
+
+#pragma mark instruction tree functions
+/**
+   builds and returns a * to an empty instructionList carved from memory, the arena of the
+   tree it will be part of.
+*/
+instructionList * initInstructionList(arena * memory)
+{
+  instructionList * list = arenaAlloc(memory, sizeof(instructionList));
+  list->array = NULL;
+  list->numberOfInstructions = 0;
+  list->capacity = 0;
+  list->memory = memory;
+  return list;
+}
+
+/**
+   frees the whole tree list belongs to, the bodies of its DO instructions and the terms of its
+   SET expressions, in one go. Only call it on the root of a tree.
+*/
+void freeInstructionList(instructionList * list)
+{
+  if(list==NULL) return;
+  freeArena(list->memory);
+}
+
+/**
+   Copies newInstruction on to the end of p->currentList, growing the array geometrically.
+   Returns the new length of the list.
+*/
+int addInstructionToList(parser * p, instruction * newInstruction)
+{
+  instructionList * list = p->currentList;
+  if(list->numberOfInstructions==list->capacity)
+    {
+      int newCapacity = list->capacity ? 2*list->capacity : 8;
+      list->array = arenaGrow(list->memory, list->array, list->capacity*sizeof(instruction), newCapacity*sizeof(instruction));
+      list->capacity = newCapacity;
+    }
+  list->array[list->numberOfInstructions] = *newInstruction;
+  return ++list->numberOfInstructions;
+}
+
+/**
+   Appends term to the end of expression, whose terms are carved from memory.
+   While an expression is being parsed it is the newest allocation, so it grows in place.
+   Returns the new number of terms.
+*/
+int addTermToPolish(arena * memory, polish * expression, polishTerm term)
+{
+  expression->terms = arenaGrow(memory, expression->terms, expression->numberOfTerms*sizeof(polishTerm),
+				(expression->numberOfTerms+1)*sizeof(polishTerm));
+  expression->terms[expression->numberOfTerms] = term;
+  return ++expression->numberOfTerms;
+}
+
+#pragma mark instruction execution
+/**
+   Runs the instructions in list, expanding them into FD, LT and RT entries on p->symList.
+   The tokens have already been validated by the symbol parsers so this only has to
+   look up variables and do the arithmetic. The loops being run are kept on a stack of
+   frames rather than recursing, so how deep they nest is limited only by the heap.
+   Returns 1 if successful, 0 if not.
+*/
+int executeInstrctlst(parser * p, instructionList * list)
+{
+  loopFrame * frames = malloc(16*sizeof(loopFrame));
+  if(frames==NULL)
+    {
+      printError("loopFrame * frames = malloc(16*sizeof(loopFrame)) failed exiting.",__FILE__,__FUNCTION__,__LINE__);
+      exit(1);
+    }
+  int depth = 1, capacity = 16, executed = 1;
+  frames[0] = (loopFrame){ .list = list };
+  while(executed && depth>0)
+    {
+      loopFrame * frame = &frames[depth-1];
+      if(frame->at==frame->list->numberOfInstructions)
+	{
+	  if(frame->loop==NULL)
+	    {
+	      --depth;
+	    }
+	  else if(frame->trips)
+	    {
+	      executed = finishRepeat(p, frame);
+	      --depth;
+	    }
+	  else if(++frame->iter<=frame->to)
+	    {
+	      p->varValues[(int)frame->loop->var]=frame->iter;
+	      frame->at = 0;
+	    }
+	  else --depth;
+	  continue;
+	}
+      instruction * current = &frame->list->array[frame->at++];
+      switch(current->sym)
+	{
+	case symFD:
+	case symLT:
+	case symRT:
+	  {
+	    float value = getVarnumValue(p, current->operand[0]);
+	    if(value!=0 && addSymToList(p, current->sym, value)==0) executed = 0;
+	    break;
+	  }
+	case symDO:
+	  {
+	    float fromVarNum = getVarnumValue(p, current->operand[0]);
+	    float toVarNum = getVarnumValue(p, current->operand[1]);
+	    loopFrame loop = { .list = current->body, .loop = current, .iter = fromVarNum, .to = toVarNum };
+	    loop.trips = repeatTrips(current->repeatable, fromVarNum, toVarNum);
+	    if(loop.trips)//its body runs once between a symREPEAT and symENDREPEAT
+	      {
+		loop.repeatStart = p->symList->length;
+		if(addSymToList(p, symREPEAT, loop.trips)==0)
+		  {
+		    executed = 0;
+		    break;
+		  }
+	      }
+	    else if(!(loop.iter<=loop.to)) break;
+	    p->varValues[(int)current->var]=loop.iter;
+	    if(depth==capacity)
+	      {
+		capacity *= 2;
+		loopFrame * tmp = realloc(frames, capacity*sizeof(loopFrame));
+		if(tmp==NULL)
+		  {
+		    printError("loopFrame * tmp = realloc(frames, capacity*sizeof(loopFrame)) failed exiting.",__FILE__,__FUNCTION__,__LINE__);
+		    exit(1);
+		  }
+		frames = tmp;
+	      }
+	    frames[depth++] = loop;
+	    break;
+	  }
+	case symSET:
+	  {
+	    float setToValue;
+	    if(evaluatePOLISH(p, &current->expression, &setToValue)==0 ||
+	       setVarValue(p, current->var, setToValue)==0)
+	      {
+		executed = 0;
+	      }
+	    break;
+	  }
+	default:
+	  {
+	    printError("instructionList contained an unexpected symbol.", __FILE__, __FUNCTION__, __LINE__);
+	    executed = 0;
+	  }
+	}
+    }
+  free(frames);
+  return executed;
+}
+
+/**
+   Ends the REPEAT frame has just run the body of once, marking where its body ends or
+   removing its symREPEAT if the body drew nothing, then leaves the loop variable as
+   the last iteration would.
+   Returns 1 if successful, 0 if not.
+*/
+int finishRepeat(parser * p, loopFrame * frame)
+{
+  unsigned long bodyLength = p->symList->length-frame->repeatStart-1;
+  if(bodyLength==0) p->symList->length = frame->repeatStart;//it drew nothing, no need to mark it
+  else if(addSymToList(p, symENDREPEAT, bodyLength)==0) return 0;
+  p->varValues[(int)frame->loop->var] = frame->iter+frame->trips-1;
+  return 1;
+}
+
+/**
+   Module interface,
+   If a repeatable loop can be kept as a REPEAT returns how many times DO from TO to
+   would run, otherwise (or if it would run less than twice) 0. Mirrors the int counting
+   loop executeInstrctlst and the VM run.
+*/
+int repeatTrips(int repeatable, float from, float to)
+{
+  if(!REPEAT_NODES || !repeatable) return 0;
+  double trips = floor(to) - (int)from + 1;
+  if(!(trips>=2 && trips<=REPEAT_MAX_TRIPS)) return 0;//catches NaN and infinity too
+  return (int)trips;
+}
+
+#pragma mark repeat analysis
+/**
+   Module interface,
+   A loop can be kept as a REPEAT if every iteration draws the same thing. That holds if
+   its body never reads the loop variable, or a variable the body writes before it has
+   written it, and never writes the loop variable itself. Variables of loops nested in
+   the body are safe to read inside those loops, as they count the same way every time.
+*/
+int loopIsRepeatable(instruction * loop)
+{
+  unsigned int loopVar = 1u<<(loop->var-'A');
+  unsigned int written = varsWrittenIn(loop->body);
+  if(written & loopVar) return 0;
+  return readsAreInvariant(loop->body, written|loopVar, 0);
+}
+
+/**
+   Module interface,
+   Returns a bit for each variable (A is bit 0) a SET or DO anywhere in list writes to.
+*/
+unsigned int varsWrittenIn(instructionList * list)
+{
+  unsigned int written = 0;
+  for(int i=0; i<list->numberOfInstructions; ++i)
+    {
+      instruction * current = &list->array[i];
+      if(current->sym==symSET || current->sym==symDO) written |= 1u<<(current->var-'A');
+      if(current->sym==symDO) written |= varsWrittenIn(current->body);
+    }
+  return written;
+}
+
+/**
+   Returns 1 if no instruction in list reads a variable in unsafe, other than those in
+   bound by the loops around it, 0 if one does.
+*/
+int readsAreInvariant(instructionList * list, unsigned int unsafe, unsigned int bound)
+{
+  for(int i=0; i<list->numberOfInstructions; ++i)
+    {
+      instruction * current = &list->array[i];
+      switch(current->sym)
+	{
+	case symFD:
+	case symLT:
+	case symRT:
+	  {
+	    if(!varnumIsInvariant(current->operand[0], unsafe, bound)) return 0;
+	    break;
+	  }
+	case symSET:
+	  {
+	    for(int t=0; t<current->expression.numberOfTerms; ++t)
+	      {
+		polishTerm * term = &current->expression.terms[t];
+		if(!term->isOperator && !varnumIsInvariant(term->operand, unsafe, bound)) return 0;
+	      }
+	    break;
+	  }
+	case symDO:
+	  {
+	    if(!varnumIsInvariant(current->operand[0], unsafe, bound) ||
+	       !varnumIsInvariant(current->operand[1], unsafe, bound)) return 0;
+	    if(!readsAreInvariant(current->body, unsafe, bound | 1u<<(current->var-'A'))) return 0;
+	    break;
+	  }
+	default:
+	  {
+	    return 0;
+	  }
+	}
+    }
+  return 1;
+}
+
+int varnumIsInvariant(varnum operand, unsigned int unsafe, unsigned int bound)
+{
+  if(operand.var=='\0') return 1;
+  unsigned int var = 1u<<(operand.var-'A');
+  return (bound & var) || !(unsafe & var);
+}
+
+/**
+   Returns the current value of operand.
+*/
+float getVarnumValue(parser * p, varnum operand)
+{
+  if(operand.var=='\0') return operand.value;
+  return operand.value*getVarValue(p, operand.var);
+}
+
+/**
+   Evaluates expression on p->polishCalcStack and puts the answer in result.
+   The stack is made big enough for every term up front so nothing is allocated
+   while the terms run.
+   Returns 1 if successful, 0 if not.
+*/
+int evaluatePOLISH(parser * p, polish * expression, float * result)
+{
+  clearStack(p->polishCalcStack);
+  reserveStack(p->polishCalcStack, expression->numberOfTerms);
+  for(int i=0; i<expression->numberOfTerms; ++i)
+    {
+      polishTerm * term = &expression->terms[i];
+      if(term->isOperator)
+	{
+	  if(popToOperator(p, term->op)==0) return 0;
+	}
+      else
+	{
+	  pushValue(p, getVarnumValue(p, term->operand));
+	}
+    }
+  if(p->polishCalcStack->itemsInStack!=1)
+    {
+      printError("polish expression left more than one value on the stack.", __FILE__, __FUNCTION__, __LINE__);
+      return 0;
+    }
+  *result = p->polishCalcStack->array[0];
   return 1;
 }
 
@@ -745,17 +1446,13 @@ int printSymNode(symbolNode * node)
 */
 int pushValue(parser *p, float value)
 {
-  ++p->polishCalcStack->itemsInStack;
-    
-  float * tmp = realloc(p->polishCalcStack->array, p->polishCalcStack->itemsInStack*sizeof(int));
-  if(tmp==NULL)
+  stack * s = p->polishCalcStack;
+  if(s->itemsInStack==s->capacity)
     {
-      printError(" float * tmp = realloc(p->polishCalcStack->array, p->polishCalcStack->itemsInStack*sizeof(int)) failed. Exiting.", __FILE__, __FUNCTION__, __LINE__);
-      exit(1);
+      reserveStack(s, s->capacity ? 2*s->capacity : 8);
     }
-  p->polishCalcStack->array = tmp;
-  p->polishCalcStack->array[p->polishCalcStack->itemsInStack-1]=value;
-  return p->polishCalcStack->itemsInStack;
+  s->array[s->itemsInStack++]=value;
+  return s->itemsInStack;
 }
 
 /**
@@ -808,26 +1505,33 @@ int popToOperator(parser * p, operator op)
       }
     }
   p->polishCalcStack->itemsInStack -= 2;
-  float * tmp = realloc(p->polishCalcStack->array, p->polishCalcStack->itemsInStack*sizeof(int));
-  if(!tmp)
-    {
-      printError("realloc failed. Exiting.", __FILE__, __FUNCTION__, __LINE__);
-      exit(1);
-    }
-  p->polishCalcStack->array = tmp;
   return pushValue(p, result) ? 1 : 0;
 }
 
 /**
-   resets stack struct.
+   resets stack struct. the array is kept for the next expression.
 */
 void clearStack(stack * s)
 {
-  if(s->array) free(s->array);
-  s->array=NULL;
   s->itemsInStack=0;
 }
 
+/**
+   makes sure s has room for at least capacity items, never shrinks it.
+*/
+void reserveStack(stack * s, int capacity)
+{
+  if(capacity<=s->capacity) return;
+  float * tmp = realloc(s->array, capacity*sizeof(float));
+  if(tmp==NULL)
+    {
+      printError("float * tmp = realloc(s->array, capacity*sizeof(float)) failed. Exiting.", __FILE__, __FUNCTION__, __LINE__);
+      exit(1);
+    }
+  s->array = tmp;
+  s->capacity = capacity;
+}
+
 
 #pragma mark error messaging functions
 /**
@@ -837,14 +1541,8 @@ void clearStack(stack * s)
 int addErrorToList(parser * p, char * errorString)
 {
   ++p->numberOfErrors;
-  char ** tmp = realloc(p->errorList,p->numberOfErrors*sizeof(char*));
-  if(tmp==NULL)
-    {
-      printError("realloc failed exiting.",__FILE__,__FUNCTION__,__LINE__);
-      exit(1);
-    }
-  p->errorList = tmp;
-  p->errorList[p->numberOfErrors-1] = strdup(errorString);
+  p->errorList = arenaGrow(p->memory, p->errorList, (p->numberOfErrors-1)*sizeof(char*), p->numberOfErrors*sizeof(char*));
+  p->errorList[p->numberOfErrors-1] = arenaStrdup(p->memory, errorString);
   return 1;
 }
 
@@ -864,6 +1562,15 @@ int displayErrors(parser * p)
   return 1;
 }
 
+/**
+   Empties p->errorList. The strings go back when p->memory is freed.
+*/
+void clearErrorList(parser * p)
+{
+  p->errorList = NULL;
+  p->numberOfErrors = 0;
+}
+
 /**
    Adds a syntax error to p->errorList array.
    @returns 1 if successful. returns 0 and a Error message if unsuccessful.
@@ -875,7 +1582,7 @@ int syntaxError(parser * p, const char * errorString)
       printError("Function was called with empty string.", __FILE__, __FUNCTION__, __LINE__);
       return 0;
     }
-  if(p->numberOfTokens<1)
+  if(p->tokens==NULL || p->tokens->numberOfTokens<1)
     {
       printError("Syntax error called but there are no tokens yet.", __FILE__, __FUNCTION__, __LINE__);
       return 0;
@@ -885,9 +1592,10 @@ int syntaxError(parser * p, const char * errorString)
     
   if(p->atToken>=1)
     {
-      sprintf(stringStart,"ERROR: invalid syntax at token %d ""%s"" previous token %d ""%s"". \n",
-	      p->atToken, p->progArray[p->atToken],
-	      p->atToken-1,  p->progArray[p->atToken-1]);
+      token * current = &p->tokens->array[p->atToken], * previous = current-1;
+      sprintf(stringStart,"ERROR: invalid syntax at token %d ""%.*s"" previous token %d ""%.*s"". \n",
+	      p->atToken, current->length, p->tokens->source+current->offset,
+	      p->atToken-1, previous->length, p->tokens->source+previous->offset);
     }
   strcat(stringStart,editableErrorString);
   free(editableErrorString);
@@ -951,90 +1659,165 @@ int addWhatDoWeExpectStringToErrorList(parser * p, symbol context)
 
 #pragma mark tokenArray
 /*
- *  Takes the input string and breaks into separate words where ever it finds a charecter contained in the delimeter string each of these words is stored in the returned array which is an array of strings. the number of strings is stored in numberOfTokensPtr.
+ *  Splits the NUL terminated inputString in to whitespace separated tokens.
  */
-char ** tokenise(const char * inputString, int * numberOfTokensPtr, const char * delimiter)
+tokenArray * tokenise(const char * inputString)
 {
-  static int calls=1;
-  char    *stringToken,                       //holds the chunks on the input string as we break it up
-    *inputStringDuplicate = strdup(inputString),//duplicate input string for editting
-    **tokenArray = NULL;              //this will be an array to hold each of the chunk strings
-  int     numberOfTokens=0;
-    
-  //using http://www.tutorialspoint.com/c_standard_library/c_function_strtok.htm
-  stringToken = strtok(inputStringDuplicate, delimiter); // gets the first chunk (up to the first space)
-    
-  // walk through rest of string
-  while( stringToken != NULL )
+  return tokeniseBuffer(inputString, strlen(inputString));
+}
+
+/*
+ *  Scans the first length chars of source once, recording an (offset, length, kind) view of
+ *  each whitespace separated word. The views point in to source, which must outlive the
+ *  returned tokenArray, so the only allocations are the struct and its one growing array.
+ */
+tokenArray * tokeniseBuffer(const char * source, unsigned long length)
+{
+  arena * memory = initArena("tokenise");
+  tokenArray * tokens = arenaAlloc(memory, sizeof(tokenArray));
+  tokens->memory = memory;
+  tokens->source = source;
+  tokens->array = NULL;
+  tokens->numberOfTokens = 0;
+  tokens->capacity = 0;
+  unsigned long at = 0;
+  while(at<length)
+    {
+      while(at<length && isspace((unsigned char)source[at])) ++at;
+      unsigned long start = at;
+      while(at<length && !isspace((unsigned char)source[at])) ++at;
+      if(at>start) addToken(tokens, start, (int)(at-start));
+    }
+  return tokens;
+}
+
+/*
+ *  Appends a view of source[offset] to source[offset+length-1], growing the array geometrically.
+ *  Returns the new number of tokens.
+ */
+int addToken(tokenArray * tokens, unsigned long offset, int length)
+{
+  if(tokens->numberOfTokens==tokens->capacity)
     {
-      if(isStringWhiteSpace(stringToken))
-        {
-	  //discard this token, do nothing
-        }
-      else
-        {
-	  ++numberOfTokens;
-	  char ** tmp = (char **)realloc(tokenArray,numberOfTokens*sizeof(char*));//array of strings
-	  if(!tmp)
-            {
-	      printError("realloc failed, exiting.",__FILE__,__FUNCTION__,__LINE__);
-	      exit(1);
-            }
-	  tokenArray = tmp;
-	  tokenArray[numberOfTokens-1]=(char *)malloc((size_t)(strlen(stringToken)*sizeof(char)+1));
-	  if(!tokenArray[numberOfTokens-1])
-            {
-	      printError("malloc failed, exiting.",__FILE__,__FUNCTION__,__LINE__);
-	      exit(1);
-            }
-	  strcpy(tokenArray[numberOfTokens-1],stringToken);
-        }
-      stringToken = strtok(NULL, delimiter);
+      int newCapacity = tokens->capacity ? 2*tokens->capacity : 64;
+      tokens->array = arenaGrow(tokens->memory, tokens->array, tokens->capacity*sizeof(token), newCapacity*sizeof(token));
+      tokens->capacity = newCapacity;
     }
-  free(inputStringDuplicate);//frees the malloc made in strdup()
-  //$(numberOfChunks) strings now stored in the commandArray
-  *numberOfTokensPtr=numberOfTokens;
-  ++calls;
-  return tokenArray;
+  token * newToken = &tokens->array[tokens->numberOfTokens];
+  newToken->offset = offset;
+  newToken->length = length;
+  classifyToken(newToken, tokens->source+offset);
+  return ++tokens->numberOfTokens;
 }
 
-/**
-   Returns 1 if string is entirly whitespace ( \t\r\v\f\n)
-*/
-int isStringWhiteSpace(char * string)
+/*
+ *  Sets newToken's kind, var and value. Keywords are found with a switch on length and
+ *  first char, so each needs at most one short compare.
+ */
+void classifyToken(token * newToken, const char * text)
 {
-  for(int i=0;string[i];++i)
+  int length = newToken->length;
+  int first = text[0]=='-' && length>1 ? 1 : 0;
+  newToken->kind = tokOTHER;
+  newToken->var = isupper((unsigned char)text[first]) ? text[first] : '\0';
+  newToken->value = first ? -1 : 1;
+  switch(length)
+    {
+    case 1:
+      switch(text[0])
+	{
+	case '{': newToken->kind = tokOPENBRACE; break;
+	case '}': newToken->kind = tokCLOSEBRACE; break;
+	case ';': newToken->kind = tokSEMICOLON; break;
+	case '+': case '-': case '*': case '/': case '^': newToken->kind = tokOP; break;
+	}
+      break;
+    case 2:
+      switch(text[0])
+	{
+	case 'F': if(text[1]=='D') newToken->kind = tokFD; break;
+	case 'L': if(text[1]=='T') newToken->kind = tokLT; break;
+	case 'R': if(text[1]=='T') newToken->kind = tokRT; break;
+	case 'D': if(text[1]=='O') newToken->kind = tokDO; break;
+	case 'T': if(text[1]=='O') newToken->kind = tokTO; break;
+	case ':': if(text[1]=='=') newToken->kind = tokASSIGN; break;
+	}
+      break;
+    case 3:
+      if(memcmp(text, "SET", 3)==0) newToken->kind = tokSET;
+      break;
+    case 4:
+      if(memcmp(text, "FROM", 4)==0) newToken->kind = tokFROM;
+      break;
+    }
+  if(newToken->kind!=tokOTHER) return;
+  if(isdigit((unsigned char)text[first]))
     {
-      if(!isspace(string[i])) return 0;
+      newToken->kind = tokNUMBER;
+      newToken->value = readNumber(text, length);
     }
-  return 1;
+  else if(newToken->var!='\0')
+    {
+      newToken->kind = tokVAR;
+    }
+}
+
+/*
+ *  Returns 1 if the token at index is exactly string.
+ */
+int tokenIsString(tokenArray * tokens, int index, const char * string)
+{
+  token * t = &tokens->array[index];
+  return strlen(string)==(size_t)t->length && memcmp(tokens->source+t->offset, string, t->length)==0;
+}
+
+/*
+ *  Returns 1 if the token the parser is at is of kind.
+ */
+int currentTokenIs(parser * p, tokenKind kind)
+{
+  return p->tokens->array[p->atToken].kind==kind;
 }
 
 /*
- *  frees the memory allocated to a tokenArray in tokenise func
+ *  Reads the number at the start of text, as atof would.
+ *  The token is copied out first as source need not be NUL terminated.
  */
-void freeTokenArray(char **tokenArray,int numberOfTokens)
+float readNumber(const char * text, int length)
 {
-  for(int i=0; i<numberOfTokens; ++i)
+  char buffer[64];
+  char * copy = length<(int)sizeof(buffer) ? buffer : malloc(length+1);
+  if(!copy)
     {
-      free(tokenArray[i]);
-      printf("freed row");
+      printError("malloc failed, exiting.",__FILE__,__FUNCTION__,__LINE__);
+      exit(1);
     }
-  free(tokenArray);
-  printf("freed col");
-    
+  memcpy(copy, text, length);
+  copy[length] = '\0';
+  float value = atof(copy);
+  if(copy!=buffer) free(copy);
+  return value;
+}
+
+/*
+ *  frees the memory allocated to a tokenArray in tokenise func, but not the source it views.
+ */
+void freeTokenArray(tokenArray * tokens)
+{
+  if(tokens==NULL) return;
+  freeArena(tokens->memory);
 }
 
 #pragma mark developement tests
 /*
  *  Test function for developement. Prints contents of a tokenArray
  */
-void testTokenArray(char ** tokenArray, int numberOfTokens)
+void testTokenArray(tokenArray * tokens)
 {
   printf("\ntestTokenArray:\n");
-  for(int i=0; i<numberOfTokens; ++i)
+  for(int i=0; i<tokens->numberOfTokens; ++i)
     {
-      printf("%d:[%s]   ",i,tokenArray[i]);
+      printf("%d:[%.*s]   ",i,tokens->array[i].length,tokens->source+tokens->array[i].offset);
     }
   printf("\n\n");
 }
@@ -1077,6 +1860,10 @@ void unitTests_parser()
   sput_run_test(testPolishCalcFunctions);
   sput_leave_suite();
 
+  sput_enter_suite("testInstructionListFunctions()");
+  sput_run_test(testInstructionListFunctions);
+  sput_leave_suite();
+
   sput_enter_suite("testParseVar()");
   sput_run_test(testParseVar);
   sput_leave_suite();
@@ -1125,6 +1912,22 @@ void unitTests_parser()
   sput_run_test(testParseMain);
   sput_leave_suite();
 
+  sput_enter_suite("testRepeatNodes()");
+  sput_run_test(testRepeatNodes);
+  sput_leave_suite();
+
+  sput_enter_suite("testExecuteInstrctlst()");
+  sput_run_test(testExecuteInstrctlst);
+  sput_leave_suite();
+
+  sput_enter_suite("testStreamParser()");
+  sput_run_test(testStreamParser);
+  sput_leave_suite();
+
+  sput_enter_suite("testLongPrograms()");
+  sput_run_test(testLongPrograms);
+  sput_leave_suite();
+
 
   sput_finish_testing();
 
@@ -1136,36 +1939,70 @@ void unitTests_parser()
 */
 void testTokenise()
 {
-  int numberOfTokensTest1=0;
-  char ** test1 = tokenise("break this string up",&numberOfTokensTest1," ");
-  if(VERBOSE) testTokenArray(test1,numberOfTokensTest1);
-  sput_fail_unless(!strcmp(test1[0],"break")  &&
-		   !strcmp(test1[1],"this")   &&
-		   !strcmp(test1[2],"string") &&
-		   !strcmp(test1[3],"up")     &&
-		   numberOfTokensTest1==4 ,
-		   "Checks basic functionality. Tested with ""break this string up"" and space & comma delimeters, should return each seperate word.");
-  freeTokenArray(test1,numberOfTokensTest1);
-    
-  test1 = tokenise("\tbreak\nthis string\tup\r\n",&numberOfTokensTest1," \t\r\n");
-  if(VERBOSE) testTokenArray(test1,numberOfTokensTest1);
-  sput_fail_unless(!strcmp(test1[0],"break")  &&
-		   !strcmp(test1[1],"this")   &&
-		   !strcmp(test1[2],"string") &&
-		   !strcmp(test1[3],"up")     &&
-		   numberOfTokensTest1==4,
-		   "Checks that \r \t \n are handled correctly. Tested with ""\\tbreak\\nthis string\\tup\\r\\n"" and "" \\t\\r\\n"" delim, should return each seperate word.");
-  freeTokenArray(test1,numberOfTokensTest1);
-    
-  test1 = tokenise("  break\t   \r   this\n    \t  \r  string \r\n\t up\t    ",&numberOfTokensTest1," \t\r\n");
-  if(VERBOSE) testTokenArray(test1,numberOfTokensTest1);
-  sput_fail_unless(!strcmp(test1[0],"break")  &&
-		   !strcmp(test1[1],"this")   &&
-		   !strcmp(test1[2],"string") &&
-		   !strcmp(test1[3],"up")     &&
-		   numberOfTokensTest1==4,
-		   "Checks that tokens that contain only spaces are discarded even when it is not a delimeter. Tested with ""  break\\t   \\r   this\\n    \\t  \\r  string \\r\\n\\t up\\t    "" and ""\\t\\r\\n"" delim it should return each seperate word.");
-  freeTokenArray(test1,numberOfTokensTest1);
+  tokenArray * test1 = tokenise("break this string up");
+  if(VERBOSE) testTokenArray(test1);
+  sput_fail_unless(tokenIsString(test1,0,"break")  &&
+		   tokenIsString(test1,1,"this")   &&
+		   tokenIsString(test1,2,"string") &&
+		   tokenIsString(test1,3,"up")     &&
+		   test1->numberOfTokens==4 ,
+		   "Checks basic functionality. Tested with ""break this string up"", should return each seperate word.");
+  freeTokenArray(test1);
+    
+  test1 = tokenise("\tbreak\nthis string\tup\r\n");
+  if(VERBOSE) testTokenArray(test1);
+  sput_fail_unless(tokenIsString(test1,0,"break")  &&
+		   tokenIsString(test1,1,"this")   &&
+		   tokenIsString(test1,2,"string") &&
+		   tokenIsString(test1,3,"up")     &&
+		   test1->numberOfTokens==4,
+		   "Checks that \r \t \n are handled correctly. Tested with ""\\tbreak\\nthis string\\tup\\r\\n"", should return each seperate word.");
+  freeTokenArray(test1);
+    
+  test1 = tokenise("  break\t   \r   this\n    \t  \r  string \r\n\t up\t    ");
+  if(VERBOSE) testTokenArray(test1);
+  sput_fail_unless(tokenIsString(test1,0,"break")  &&
+		   tokenIsString(test1,1,"this")   &&
+		   tokenIsString(test1,2,"string") &&
+		   tokenIsString(test1,3,"up")     &&
+		   test1->numberOfTokens==4,
+		   "Checks that runs of mixed whitespace are skipped. Tested with ""  break\\t   \\r   this\\n    \\t  \\r  string \\r\\n\\t up\\t    "" it should return each seperate word.");
+  freeTokenArray(test1);
+
+  const char source[] = "FD 10 -A -2.5 := }";
+  test1 = tokeniseBuffer(source, 11);
+  sput_fail_unless(test1->numberOfTokens==4 &&
+		   test1->source==source &&
+		   test1->array[2].offset==6 && test1->array[2].length==2,
+		   "tokeniseBuffer should only scan length chars and the tokens should be views in to source.");
+  freeTokenArray(test1);
+
+  test1 = tokenise(source);
+  sput_fail_unless(test1->array[0].kind==tokFD &&
+		   test1->array[1].kind==tokNUMBER &&
+		   test1->array[2].kind==tokVAR &&
+		   test1->array[3].kind==tokNUMBER &&
+		   test1->array[4].kind==tokASSIGN &&
+		   test1->array[5].kind==tokCLOSEBRACE,
+		   "Each token should be classified as it is scanned.");
+  sput_fail_unless(floatCompare(test1->array[1].value, 10) && floatCompare(test1->array[3].value, -2.5),
+		   "Numbers should be read as they are scanned.");
+  sput_fail_unless(test1->array[0].var=='F' && test1->array[2].var=='A' && test1->array[2].value==-1,
+		   "Words starting A-Z, keywords included, can still be read as a VAR.");
+  freeTokenArray(test1);
+
+  test1 = tokenise("{ } ; + - * / ^ LT RT DO TO FROM SET FDX F -5x -");
+  tokenKind expected[] = {
+    tokOPENBRACE, tokCLOSEBRACE, tokSEMICOLON, tokOP, tokOP, tokOP, tokOP, tokOP,
+    tokLT, tokRT, tokDO, tokTO, tokFROM, tokSET, tokVAR, tokVAR, tokNUMBER, tokOP
+  };
+  int matches = test1->numberOfTokens==(int)(sizeof(expected)/sizeof(tokenKind));
+  for(int i=0; matches && i<test1->numberOfTokens; ++i)
+    {
+      matches = test1->array[i].kind==expected[i];
+    }
+  sput_fail_unless(matches, "Checks the kind of every keyword, brace and operator, and near misses.");
+  freeTokenArray(test1);
 }
 
 /**
@@ -1175,14 +2012,15 @@ void testTokenise()
 void testInitParser()
 {
   parser * p = initParser();
-  sput_fail_unless(p->progArray == NULL,"Checking that all structure elements are accessible and set correctly.");
-  sput_fail_unless(p->numberOfTokens == 0,"Checking that all structure elements are accessible and set correctly.");
+  sput_fail_unless(p->tokens == NULL,"Checking that all structure elements are accessible and set correctly.");
   sput_fail_unless(p->atToken==0,"Checking that all structure elements are accessible and set correctly.");
   sput_fail_unless(p->varValues[0]==0,"Checking that all structure elements are accessible and set correctly.");
   sput_fail_unless(p->varValues['Z']==0,"Checking that all structure elements are accessible and set correctly.");
+  sput_fail_unless(p->program->numberOfInstructions==0,"Checking that all structure elements are accessible and set correctly.");
+  sput_fail_unless(p->currentList==p->program,"Checking that all structure elements are accessible and set correctly.");
   sput_fail_unless(p->symList->length==0,"Checking that all structure elements are accessible and set correctly.");
-  sput_fail_unless(p->symList->start==NULL,"Checking that all structure elements are accessible and set correctly.");
-  sput_fail_unless(p->symList->end==NULL,"Checking that all structure elements are accessible and set correctly.");
+  sput_fail_unless(p->symList->syms==NULL && p->symList->values==NULL,"Checking that all structure elements are accessible and set correctly.");
+  sput_fail_unless(p->symList->capacity==0,"Checking that all structure elements are accessible and set correctly.");
   sput_fail_unless(p->polishCalcStack->array==NULL,"Checking that all structure elements are accessible and set correctly.");
   sput_fail_unless(p->polishCalcStack->itemsInStack==0,"Checking that all structure elements are accessible and set correctly.");
   sput_fail_unless(p->errorList==NULL,"Checking that all structure elements are accessible and set correctly.");
@@ -1198,10 +2036,10 @@ void testInitParser()
 void testIncrementToken()
 {
   parser * p = initParser();
-  p->progArray = tokenise("0 1 2 3 4 5 6 7 8 9", &p->numberOfTokens, " \n\r\t\v\f");
+  p->tokens = tokenise("0 1 2 3 4 5 6 7 8 9");
   for(int i = 0; i<9; ++i)
     {
-      sput_fail_unless(incrementAtToken(p)==1, "We have made 10 tokens in progArray, check that we can then incrementAtToken 10 times successfully.");
+      sput_fail_unless(incrementAtToken(p)==1, "We have made 10 tokens in p->tokens, check that we can then incrementAtToken 10 times successfully.");
     }
   sput_fail_unless(incrementAtToken(p)==0, "and on the 11th it should fail.");
   freeParser(p);
@@ -1223,7 +2061,7 @@ void testParserErrors()
   sput_fail_unless(syntaxError(p, "")==0, "calling syntaxError with an empty string should print error and return 0.");
     
   //test valid syntaxError()
-  p->progArray = tokenise("0 1 2 3 4 5 6 7 8 9", &p->numberOfTokens, " \n\r\t\v\f");
+  p->tokens = tokenise("0 1 2 3 4 5 6 7 8 9");
   sput_fail_unless(syntaxError(p, "testing syntaxError")==1 && p->numberOfErrors==2, "Checks valid call of syntaxError with 0->atToken=0. ");
   sput_fail_unless(strcmp(p->errorList[p->numberOfErrors-1], "testing syntaxError")==0, "Since p->atToken = 0 at last call we should see no tokens printed in message.");
     
@@ -1289,6 +2127,18 @@ void testSymListFunctions()
 	  sput_fail_unless(addSymToList(p, sym, value)==0, "should  not be able to add other syms to list.");
         }
     }
+  for(int i=3; i<1000; ++i)
+    {
+      addSymToList(p, i%2 ? symLT : symFD, i);
+    }
+  int inOrder = p->symList->length==1000 && p->symList->capacity>=1000;
+  for(int i=3; inOrder && i<1000; ++i)
+    {
+      inOrder = p->symList->syms[i]==(i%2 ? symLT : symFD) && p->symList->values[i]==i;
+    }
+  sput_fail_unless(inOrder && p->symList->syms[1]==symRT && floatCompare(p->symList->values[1], value),
+		   "The list should grow past its first allocation and keep every instruction in order.");
+  freeSymList(p->symList);
   freeParser(p);
 }
 
@@ -1307,8 +2157,18 @@ void testPolishCalcFunctions()
   //test clearStack()
   clearStack(p->polishCalcStack);
   sput_fail_unless(p->polishCalcStack->itemsInStack==0 &&
-		   p->polishCalcStack->array==NULL,
-		   "Checks that itemsInStack=0 && array==NULL after clearStack.");
+		   p->polishCalcStack->array!=NULL,
+		   "Checks that itemsInStack=0 after clearStack and the array is kept for the next expression.");
+  //test reserveStack()
+  reserveStack(p->polishCalcStack, 100);
+  float * reserved = p->polishCalcStack->array;
+  for(int i=0; i<100; ++i) pushValue(p, value);
+  sput_fail_unless(p->polishCalcStack->array==reserved && p->polishCalcStack->capacity==100 &&
+		   p->polishCalcStack->array[99]==value,
+		   "Pushing up to the reserved capacity should not move the stack.");
+  reserveStack(p->polishCalcStack, 10);
+  sput_fail_unless(p->polishCalcStack->capacity==100, "reserveStack should never shrink the stack.");
+  clearStack(p->polishCalcStack);
   float epsilon = 0.0002;
   //test popToOperator
   pushValue(p, value);
@@ -1335,22 +2195,48 @@ void testPolishCalcFunctions()
   freeParser(p);
 }
 
+/**
+   Parse unit test suite.
+   tests the addInstructionToList and addTermToPolish functions.
+*/
+void testInstructionListFunctions()
+{
+  parser * p = initParser();
+  instruction newInstruction = { .sym = symFD, .operand = { { '\0', 10 } } };
+  for(int i=1; i<=20; ++i)
+    {
+      sput_fail_unless(addInstructionToList(p, &newInstruction)==i, "addInstructionToList should return the new length of the list as it grows.");
+    }
+  sput_fail_unless(p->program->capacity>=p->program->numberOfInstructions &&
+		   p->program->array[19].sym==symFD &&
+		   p->program->array[19].operand[0].value==10,
+		   "The last instruction added should be at the end of the list.");
+
+  polish expression = { NULL, 0 };
+  polishTerm term = { .operand = { 'A', -1 } };
+  sput_fail_unless(addTermToPolish(p->program->memory, &expression, term)==1 &&
+		   expression.terms[0].operand.var=='A' &&
+		   expression.terms[0].operand.value==-1,
+		   "addTermToPolish should copy term on to the end of the expression.");
+  freeParser(p);
+}
+
 #pragma mark Sym Parser Unit Tests
 void testParseVar()
 {
   parser * p = initParser();
     
-  p->progArray = tokenise("s }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("s }");
   sput_fail_unless(parseVAR(p)=='\0', "s is not a valid variable so should return '\0'");
-  freeTokenArray(p->progArray, p->numberOfTokens);
+  freeTokenArray(p->tokens);
   p->atToken=0;
 
-  p->progArray = tokenise("A", &p->numberOfTokens, " ");
+  p->tokens = tokenise("A");
   sput_fail_unless(parseVAR(p)==0, "can not increment token since there is only one, should return 0");
-  freeTokenArray(p->progArray, p->numberOfTokens);
+  freeTokenArray(p->tokens);
   p->atToken=0;
 
-  p->progArray = tokenise("S }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("S }");
   sput_fail_unless(parseVAR(p)=='S', "is valid, should return 'S'");
   freeParser(p);
 }
@@ -1358,40 +2244,41 @@ void testParseVar()
 void testParseVarnum()
 {
   parser * p = initParser();
-  float result=0, epsilon=0.002;
+  varnum result;
+  float epsilon=0.002;
     
-  p->progArray = tokenise("1992.232", &p->numberOfTokens, " ");
+  p->tokens = tokenise("1992.232");
   sput_fail_unless(parseVARNUM(p,&result)==0, "Should read the value, but since there is only 1 token, incrementing should fail and return 0.");
-  freeTokenArray(p->progArray, p->numberOfTokens);
+  freeTokenArray(p->tokens);
   p->atToken=0;
 
-  p->progArray = tokenise("1992.232 }", &p->numberOfTokens, " ");
-  sput_fail_unless(parseVARNUM(p,&result)==1 && fabs(result-1992.232)<epsilon, "Valid. Should read value 1992.232.");
-  freeTokenArray(p->progArray, p->numberOfTokens);
+  p->tokens = tokenise("1992.232 }");
+  sput_fail_unless(parseVARNUM(p,&result)==1 && fabs(getVarnumValue(p, result)-1992.232)<epsilon, "Valid. Should read value 1992.232.");
+  freeTokenArray(p->tokens);
   p->atToken=0;
 
-  p->progArray = tokenise("a", &p->numberOfTokens, " ");
+  p->tokens = tokenise("a");
   sput_fail_unless(parseVARNUM(p,&result)==0, "can not increment token since there is only one, should return 0");
-  freeTokenArray(p->progArray, p->numberOfTokens);
+  freeTokenArray(p->tokens);
   p->atToken=0;
 
   setVarValue(p, 'S', 33.3);
-  p->progArray = tokenise("S }", &p->numberOfTokens, " ");
-  sput_fail_unless(parseVARNUM(p,&result)==1 && fabs(result-33.3)<epsilon, "is valid, should return value of 'S'");
-  freeTokenArray(p->progArray, p->numberOfTokens);
+  p->tokens = tokenise("S }");
+  sput_fail_unless(parseVARNUM(p,&result)==1 && result.var=='S' && fabs(getVarnumValue(p, result)-33.3)<epsilon, "is valid, should return value of 'S'");
+  freeTokenArray(p->tokens);
   p->atToken=0;
 
   setVarValue(p, 'S', 33.3);
-  p->progArray = tokenise("-S }", &p->numberOfTokens, " ");
-  testTokenArray(p->progArray, p->numberOfTokens);
-  sput_fail_unless(parseVARNUM(p,&result)==1 && fabs(result+33.3)<epsilon, "is valid, should return value of '-S'");
-  freeTokenArray(p->progArray, p->numberOfTokens);
+  p->tokens = tokenise("-S }");
+  testTokenArray(p->tokens);
+  sput_fail_unless(parseVARNUM(p,&result)==1 && result.var=='S' && fabs(getVarnumValue(p, result)+33.3)<epsilon, "is valid, should return value of '-S'");
+  freeTokenArray(p->tokens);
   p->atToken=0;
   
   //read -ve val
-  p->progArray = tokenise("-120 }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("-120 }");
   sput_fail_unless(parseVARNUM(p,&result)==1 &&
-		   fabs(result+120)<epsilon, "Valid. Should read value -120.");
+		   fabs(getVarnumValue(p, result)+120)<epsilon, "Valid. Should read value -120.");
   p->atToken=0;
 
   freeParser(p);//will free last token array in call 
@@ -1403,30 +2290,31 @@ void testParseOp()
   parser * p = initParser();
   operator op;
     
-  p->progArray = tokenise("+", &p->numberOfTokens, " ");
+  p->tokens = tokenise("+");
   sput_fail_unless(parseOP(p,&op)==0, "should read + but then only one token so cannot increment should return 0.");
-  freeTokenArray(p->progArray, p->numberOfTokens);
+  freeTokenArray(p->tokens);
   p->atToken=0;
 
-  p->progArray = tokenise("+ }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("+ }");
   sput_fail_unless(parseOP(p,&op)==1 && op==opPlus, "Valid, should read +.");
-  freeTokenArray(p->progArray, p->numberOfTokens);
+  freeTokenArray(p->tokens);
   p->atToken=0;
 
-  p->progArray = tokenise("- }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("- }");
   sput_fail_unless(parseOP(p,&op)==1 && op==opMinus, "Valid, should read -.");
-  freeTokenArray(p->progArray, p->numberOfTokens);
+  freeTokenArray(p->tokens);
   p->atToken=0;
 
-  p->progArray = tokenise("* }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("* }");
   sput_fail_unless(parseOP(p,&op)==1 && op==opMultiply, "Valid, should read *.");
-  freeTokenArray(p->progArray, p->numberOfTokens);
+  freeTokenArray(p->tokens);
   p->atToken=0;
 
-  p->progArray = tokenise("/ }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("/ }");
   sput_fail_unless(parseOP(p,&op)==1 && op==opDivide, "Valid, should read /.");
 
-  p->progArray = tokenise("^ }", &p->numberOfTokens, " ");
+  p->atToken=0;
+  p->tokens = tokenise("^ }");
   sput_fail_unless(parseOP(p,&op)==1 && op==opExpo, "Valid, should read ^.");
 
   freeParser(p);
@@ -1435,73 +2323,76 @@ void testParseOp()
 void testParsePolish()
 {
   parser * p = initParser();
+  polish expression;
   float result, epsilon=0.02;
     
-  p->progArray = tokenise(";", &p->numberOfTokens, " ");
-  sput_fail_unless(parsePOLISH(p,&result)==0, " just ; is invalid syntax, should add error and return 0.");
+  p->tokens = tokenise(";");
+  sput_fail_unless(parsePOLISH(p,&expression)==0, " just ; is invalid syntax, should add error and return 0.");
   displayErrors(p);
 
   freeParser(p);
   p=initParser();
 
-  p->progArray = tokenise("20.2 ; }", &p->numberOfTokens, " ");
-  sput_fail_unless(parsePOLISH(p,&result)==1 && fabs(result-20.2)<epsilon, " just  20.2 ; } is valid syntax, should result is 20.2 and return 1.");
+  p->tokens = tokenise("20.2 ; }");
+  sput_fail_unless(parsePOLISH(p,&expression)==1 && evaluatePOLISH(p,&expression,&result)==1 && fabs(result-20.2)<epsilon, " just  20.2 ; } is valid syntax, should result is 20.2 and return 1.");
   displayErrors(p);
 
   freeParser(p);
   p=initParser();
 
   setVarValue(p, 'A', 20.2);
-  p->progArray = tokenise("A ; }", &p->numberOfTokens, " ");
-  sput_fail_unless(parsePOLISH(p,&result)==1 && fabs(result-20.2)<epsilon, " just  A ; } is valid syntax, result is 20.2 and return 1.");
+  p->tokens = tokenise("A ; }");
+  sput_fail_unless(parsePOLISH(p,&expression)==1 && evaluatePOLISH(p,&expression,&result)==1 && fabs(result-20.2)<epsilon, " just  A ; } is valid syntax, result is 20.2 and return 1.");
   displayErrors(p);
 
   freeParser(p);
   p=initParser();
   setVarValue(p, 'A', 20.2);
 
-  p->progArray = tokenise("A A ; }", &p->numberOfTokens, " ");
-  sput_fail_unless(parsePOLISH(p,&result)==0, "A A ; } is invalid syntax, should push error and return 0.");
+  p->tokens = tokenise("A A ; }");
+  sput_fail_unless(parsePOLISH(p,&expression)==0, "A A ; } is invalid syntax, should push error and return 0.");
   displayErrors(p);
 
   freeParser(p);
   p=initParser();
   setVarValue(p, 'A', 20.2);
 
-  p->progArray = tokenise("A A * ; }", &p->numberOfTokens, " ");
-  sput_fail_unless(parsePOLISH(p,&result)==1 && fabs(result-(20.2*20.2))<epsilon, "A A *; } is valid syntax, result should be 20.2^2 and return 1.");
+  p->tokens = tokenise("A A * ; }");
+  sput_fail_unless(parsePOLISH(p,&expression)==1 && evaluatePOLISH(p,&expression,&result)==1 && fabs(result-(20.2*20.2))<epsilon, "A A *; } is valid syntax, result should be 20.2^2 and return 1.");
   displayErrors(p);
 
-  p->progArray = tokenise("A 2 ^ ; }", &p->numberOfTokens, " ");
-  sput_fail_unless(parsePOLISH(p,&result)==1 && fabs(result-(20.2*20.2))<epsilon, "A 2 ^; } is valid syntax, result should be 20.2^2 and return 1.");
+  p->atToken=0;
+  p->tokens = tokenise("A 2 ^ ; }");
+  sput_fail_unless(parsePOLISH(p,&expression)==1 && evaluatePOLISH(p,&expression,&result)==1 && fabs(result-(20.2*20.2))<epsilon, "A 2 ^; } is valid syntax, result should be 20.2^2 and return 1.");
   displayErrors(p);
 
-    p->progArray = tokenise("A -3 ^ ; }", &p->numberOfTokens, " ");
-    sput_fail_unless(parsePOLISH(p,&result)==1 && fabs(result-pow(20.2,-3))<epsilon, "A -3 ^; } is valid syntax, result should be 20.2^-3 and return 1.");
+  p->atToken=0;
+  p->tokens = tokenise("A -3 ^ ; }");
+  sput_fail_unless(parsePOLISH(p,&expression)==1 && evaluatePOLISH(p,&expression,&result)==1 && fabs(result-pow(20.2,-3))<epsilon, "A -3 ^; } is valid syntax, result should be 20.2^-3 and return 1.");
   displayErrors(p);
 
   freeParser(p);
   p=initParser();
   setVarValue(p, 'A', 20.2);
 
-  p->progArray = tokenise("A A * - ; }", &p->numberOfTokens, " ");
-  sput_fail_unless(parsePOLISH(p,&result)==0, "A A * - ; } is invalid syntax, should push error and return 0.");
+  p->tokens = tokenise("A A * - ; }");
+  sput_fail_unless(parsePOLISH(p,&expression)==0, "A A * - ; } is invalid syntax, should push error and return 0.");
   displayErrors(p);
 
   freeParser(p);
   p=initParser();
   setVarValue(p, 'A', 20.2);
 
-  p->progArray = tokenise("A A * A - ; }", &p->numberOfTokens, " ");
-  sput_fail_unless(parsePOLISH(p,&result)==1 && fabs(result-(20.2*20.2-20.2))<epsilon, "A A * A - ; } is valid syntax, result should be A*A - A and returns 1.");
+  p->tokens = tokenise("A A * A - ; }");
+  sput_fail_unless(parsePOLISH(p,&expression)==1 && evaluatePOLISH(p,&expression,&result)==1 && fabs(result-(20.2*20.2-20.2))<epsilon, "A A * A - ; } is valid syntax, result should be A*A - A and returns 1.");
 
   displayErrors(p);
   freeParser(p);
   p=initParser();
   setVarValue(p, 'A', 20.2);
 
-  p->progArray = tokenise("A A * z - ;  }", &p->numberOfTokens, " ");
-  sput_fail_unless(parsePOLISH(p,&result)==0, "A A * z - ; } is invalid syntax, should push error & return 0.");
+  p->tokens = tokenise("A A * z - ;  }");
+  sput_fail_unless(parsePOLISH(p,&expression)==0, "A A * z - ; } is invalid syntax, should push error & return 0.");
   displayErrors(p);
 
   freeParser(p);
@@ -1510,40 +2401,40 @@ void testParsePolish()
 void testParseSet()
 {
   parser * p = initParser();
-  p->progArray = tokenise("NOTSET A * z - ;  }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("NOTSET A * z - ;  }");
   sput_fail_unless(parseSET(p)==0, "first token is not SET so should return 0");
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("SET", &p->numberOfTokens, " ");
+  p->tokens = tokenise("SET");
   sput_fail_unless(parseSET(p)==0, "Not enough tokens. Sould return 0.");
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("SET a }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("SET a }");
   sput_fail_unless(parseSET(p)==0, "a is not a valid variable. Sould return 0.");
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("SET A }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("SET A }");
   sput_fail_unless(parseSET(p)==0, "There should be a assignment after A. Sould return 0.");
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("SET A :=", &p->numberOfTokens, " ");
+  p->tokens = tokenise("SET A :=");
   sput_fail_unless(parseSET(p)==0, "Not enough tokens. Sould return 0.");
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("SET A := invalid", &p->numberOfTokens, " ");
+  p->tokens = tokenise("SET A := invalid");
   sput_fail_unless(parseSET(p)==0, "invalid polish epression. Sould return 0.");
   freeParser(p);
     
   p = initParser();
   setVarValue(p, 'B', 20.2);
   float epsilon = 0.02;
-  p->progArray = tokenise("SET A := B C + ; }", &p->numberOfTokens, " ");
-  sput_fail_unless(parseSET(p)==1 &&
+  p->tokens = tokenise("SET A := B C + ; }");
+  sput_fail_unless(parseSET(p)==1 && executeInstrctlst(p, p->program)==1 &&
 		   fabs( getVarValue(p, 'A')-(getVarValue(p, 'C')+getVarValue(p, 'B')) )<epsilon,
 		   "valid polish epression. Sould return 1 and set A to B^2.");
 
@@ -1555,28 +2446,28 @@ void testParseFd()
 {
   //test parseFD
   parser * p = initParser();
-  p->progArray = tokenise("notFD 50.2 }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("notFD 50.2 }");
   sput_fail_unless(parseFD(p)==0, "first token is not FD so should return 0");
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("FD x }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("FD x }");
   sput_fail_unless(parseFD(p)==0 && p->numberOfErrors>0, "2nd token is not a valid VARNUM. should add error and return 0.");
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("FD 0 }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("FD 0 }");
   sput_fail_unless(parseFD(p)==1 && p->numberOfErrors>0, "FD 0 }is a valid but redundant instruction. SHould add error and return 1.");
   freeParser(p);
     
   p = initParser();
   setVarValue(p, 'X', 202);
-  p->progArray = tokenise("FD X }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("FD X }");
   sput_fail_unless(parseFD(p)==1 && p->numberOfErrors==0, "FD X } is a valid. Should return 1.");
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("FD 200 }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("FD 200 }");
   sput_fail_unless(parseFD(p)==1 && p->numberOfErrors==0, "FD 200 } is a valid. Should return 1.");
   freeParser(p);
     
@@ -1587,29 +2478,29 @@ void testParseRt()
 {
   //test parseFD
   parser * p = initParser();
-  p->progArray = tokenise("notRT 50.2 }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("notRT 50.2 }");
   sput_fail_unless(parseFD(p)==0, "first token is not FD so should return 0");
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("RT x }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("RT x }");
   sput_fail_unless(parseRT(p)==0 && p->numberOfErrors>0, "2nd token is not a valid VARNUM. should add error and return 0.");
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("RT 0 }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("RT 0 }");
   sput_fail_unless(parseRT(p)==1 && p->numberOfErrors>0, "RT 0 is a valid but redundant instruction. SHould add error and return 1.");
   freeParser(p);
     
   p = initParser();
   setVarValue(p, 'X', 202);
-  p->progArray = tokenise("RT X }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("RT X }");
   sput_fail_unless(parseRT(p)==1 && p->numberOfErrors==0, "RT 0 is a valid. Should return 1.");
   freeParser(p);
     
   p = initParser();
   setVarValue(p, 'X', 202);
-  p->progArray = tokenise("RT 200 }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("RT 200 }");
   sput_fail_unless(parseRT(p)==1 && p->numberOfErrors==0, "RT 200 is a valid. Should return 1.");
   freeParser(p);
     
@@ -1618,29 +2509,29 @@ void testParseRt()
 void testParseLt()
 {
   parser * p = initParser();
-  p->progArray = tokenise("notLT 50.2 }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("notLT 50.2 }");
   sput_fail_unless(parseLT(p)==0, "first token is not LT so should return 0");
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("LT x }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("LT x }");
   sput_fail_unless(parseLT(p)==0 && p->numberOfErrors>0, "2nd token is not a valid VARNUM. should add error and return 0.");
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("LT 0 }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("LT 0 }");
   sput_fail_unless(parseLT(p)==1 && p->numberOfErrors>0, "LT 0 is a valid but redundant instruction. SHould add error and return 1.");
   freeParser(p);
     
   p = initParser();
   setVarValue(p, 'X', 202);
-  p->progArray = tokenise("LT X }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("LT X }");
   sput_fail_unless(parseLT(p)==1 && p->numberOfErrors==0, "LT 0 is a valid. Should return 1.");
   freeParser(p);
     
   p = initParser();
   setVarValue(p, 'X', 202);
-  p->progArray = tokenise("LT 200 }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("LT 200 }");
   sput_fail_unless(parseLT(p)==1 && p->numberOfErrors==0, "LT 200 is a valid. Should return 1.");
   freeParser(p);
     
@@ -1649,61 +2540,61 @@ void testParseLt()
 void testParseDo()
 {
   parser * p = initParser();
-  p->progArray = tokenise("notDO {", &p->numberOfTokens, " ");
+  p->tokens = tokenise("notDO {");
   sput_fail_unless(parseDO(p)==0 , "called with notDO } should return 0 as this is not DO.");
   displayErrors(p);
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("DO notAVar {", &p->numberOfTokens, " ");
+  p->tokens = tokenise("DO notAVar {");
   sput_fail_unless(parseDO(p)==0 && p->numberOfErrors>0, "called with DO notAVar } should return 0 and add an error as this is not a VAR.");
   displayErrors(p);
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("DO A", &p->numberOfTokens, " ");
+  p->tokens = tokenise("DO A");
   sput_fail_unless(parseDO(p)==0 && p->numberOfErrors>0, "called with DO A  should return 0 and add an error as A is the last token.");
   displayErrors(p);
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("DO A notFROM {", &p->numberOfTokens, " ");
+  p->tokens = tokenise("DO A notFROM {");
   sput_fail_unless(parseDO(p)==0 && p->numberOfErrors>0, "called with DO A notFROM  should return 0 and add an error as it expects to read FROM.");
   displayErrors(p);
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("DO A FROM notAVar {", &p->numberOfTokens, " ");
+  p->tokens = tokenise("DO A FROM notAVar {");
   sput_fail_unless(parseDO(p)==0 && p->numberOfErrors>0, "called with DO A FROM notAVar }  should return 0 and add an error as notAVar is not a VAR.");
   displayErrors(p);
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("DO A FROM 1 notTo {", &p->numberOfTokens, " ");
+  p->tokens = tokenise("DO A FROM 1 notTo {");
   sput_fail_unless(parseDO(p)==0 && p->numberOfErrors>0, "called with DO A FROM 1 noTo }  should return 0 and add an error it expects to read TO.");
   displayErrors(p);
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("DO A FROM 1 TO notAVar {", &p->numberOfTokens, " ");
+  p->tokens = tokenise("DO A FROM 1 TO notAVar {");
   sput_fail_unless(parseDO(p)==0 && p->numberOfErrors>0, "called with DO A FROM 1 To notAVar }  should return 0 and add an error it expects to read a Var.");
   displayErrors(p);
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("DO A FROM 1 TO 5 }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("DO A FROM 1 TO 5 }");
   sput_fail_unless(parseDO(p)==0 && p->numberOfErrors>0, "called with DO A FROM 1 TO 5 }  should return 0 and add an error it expects to read a {.");
   displayErrors(p);
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("DO A FROM 1 TO 5 {", &p->numberOfTokens, " ");
+  p->tokens = tokenise("DO A FROM 1 TO 5 {");
   sput_fail_unless(parseDO(p)==0 && p->numberOfErrors>0, "called with DO A FROM 1 TO 5 {  should return 0 and add an error it expects to read a an instructionList.");
   displayErrors(p);
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("DO A FROM 1 TO 5 { FD 5 } }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("DO A FROM 1 TO 5 { FD 5 } }");
   sput_fail_unless(parseDO(p)==1, "called with DO A FROM 1 TO 5 { FD 5 } }  should return 1.");
   displayErrors(p);
   freeParser(p);
@@ -1712,37 +2603,37 @@ void testParseDo()
 void testParseInstruction()
 {
   parser * p = initParser();
-  p->progArray = tokenise("z }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("z }");
   sput_fail_unless(parseINSTRUCTION(p)==0 , "called with z } should return 0 as this is not an instruction.");
   displayErrors(p);
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("FD 9 }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("FD 9 }");
   sput_fail_unless(parseINSTRUCTION(p)==1 , "called with FD 9 } should return 1.");
   displayErrors(p);
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("RT 9 }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("RT 9 }");
   sput_fail_unless(parseINSTRUCTION(p)==1 , "called with RT 9 } should return 1.");
   displayErrors(p);
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("LT 9 }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("LT 9 }");
   sput_fail_unless(parseINSTRUCTION(p)==1 , "called with LT 9 } should return 1.");
   displayErrors(p);
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("SET A := 9 ; }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("SET A := 9 ; }");
   sput_fail_unless(parseINSTRUCTION(p)==1 , "called with SET A := 9 } should return 1.");
   displayErrors(p);
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("DO A FROM 1 TO 5 { FD 5 } }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("DO A FROM 1 TO 5 { FD 5 } }");
   sput_fail_unless(parseINSTRUCTION(p)==1 , "called with DO A FROM 1 TO 5 { FD 5 }} should return 1.");
   displayErrors(p);
 
@@ -1752,13 +2643,13 @@ void testParseInstruction()
 void testParseInstrctlst()
 {
   parser * p = initParser();
-  p->progArray = tokenise("FD 9 }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("FD 9 }");
   sput_fail_unless(parseINSTRUCTION(p)==1 , "called with FD 9 } should return 1.");
   displayErrors(p);
   freeParser(p);
 
   p = initParser();
-  p->progArray = tokenise("FD z }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("FD z }");
   sput_fail_unless(parseINSTRUCTION(p)==0 , "called with FD 9 } should return 0 and add an error.");
   displayErrors(p);
   freeParser(p);
@@ -1767,41 +2658,230 @@ void testParseInstrctlst()
 void testParseMain()
 {
   parser * p = initParser();
-  p->progArray = tokenise(">", &p->numberOfTokens, " ");
+  p->tokens = tokenise(">");
   sput_fail_unless(parseMAIN(p)==0 , "called with > should return 0 and display an error.");
   displayErrors(p);
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("{", &p->numberOfTokens, " ");
+  p->tokens = tokenise("{");
   sput_fail_unless(parseMAIN(p)==0 , "called with {, not enough tokens, should return 0 and display an error.");
   displayErrors(p);
   freeParser(p);
     
   p = initParser();
-  p->progArray = tokenise("{ RT 9 } }", &p->numberOfTokens, " ");
+  p->tokens = tokenise("{ RT 9 } }");
   sput_fail_unless(parseMAIN(p)==1 , "called with { RT 9 }, this is valid, should return 1.");
   displayErrors(p);
   freeParser(p);
 }
 
+/**
+   Parses then runs whole programs, checking what ends up on p->symList.
+*/
+void testExecuteInstrctlst()
+{
+  parser * p = initParser();
+  p->tokens = tokenise("{ DO A FROM 1 TO 3 { FD A } RT 90 }");
+  sput_fail_unless(parseMAIN(p)==1 && p->program->numberOfInstructions==2 &&
+		   p->program->array[0].body->numberOfInstructions==1,
+		   "{ DO A FROM 1 TO 3 { FD A } RT 90 } should parse to a DO with a one instruction body and a RT.");
+  sput_fail_unless(executeInstrctlst(p, p->program)==1 && p->symList->length==4,
+		   "Running it should expand the loop to FD 1, FD 2, FD 3 then RT 90.");
+  for(int i=1; i<=3; ++i)
+    {
+      sput_fail_unless(p->symList->syms[i-1]==symFD && floatCompare(p->symList->values[i-1], i), "Each iteration should see the new value of A.");
+    }
+  sput_fail_unless(p->symList->syms[3]==symRT && floatCompare(p->symList->values[3], 90), "The loop should be followed by the instruction after its body.");
+  freeSymList(p->symList);
+  freeParser(p);
+
+  p = initParser();
+  p->tokens = tokenise("{ DO A FROM 1 TO 2 { SET B := A 2 * ; DO C FROM 1 TO B { LT C } } }");
+  sput_fail_unless(parseMAIN(p)==1 && executeInstrctlst(p, p->program)==1 && p->symList->length==6,
+		   "Nested loops whose bounds are SET in the outer body should run 2 + 4 times.");
+  freeSymList(p->symList);
+  freeParser(p);
+
+  p = initParser();
+  p->tokens = tokenise("{ DO A FROM 5 TO 1 { FD x } }");
+  sput_fail_unless(parseMAIN(p)==0,
+		   "The body of a loop that never runs should still be validated.");
+  freeSymList(p->symList);
+  freeParser(p);
+}
+
+void testRepeatNodes()
+{
+  const char * programs[] = {
+    "{ DO A FROM 1 TO 4 { FD 10 RT 90 } }",
+    "{ DO A FROM 1 TO 4 { DO B FROM 1 TO 3 { FD B } RT 90 } }",
+    "{ DO A FROM 1 TO 4 { FD A } }",
+    "{ DO A FROM 1 TO 4 { FD B SET B := 2 ; } }",
+    "{ DO A FROM 1 TO 4 { SET A := 2 ; FD 1 } }"
+  };
+  const int repeatable[] = { 1, 1, 0, 0, 0 };
+  for(int i=0; i<5; ++i)
+    {
+      instructionList * program = parseProgram(programs[i], strlen(programs[i]));
+      char str[MAX_ERROR_STRING_SIZE];
+      sprintf(str, "Checking which loops can be kept as a REPEAT: %s", programs[i]);
+      sput_fail_unless(program->array[0].repeatable==repeatable[i], str);
+      freeInstructionList(program);
+    }
+
+  const char nested[] = "{ DO A FROM 1 TO 4 { DO B FROM 1 TO 3 { FD 5 } RT 90 } }";
+  instructionList * program = parseProgram(nested, strlen(nested));
+  parser * p = initParser();
+  sput_fail_unless(executeInstrctlst(p, program)==1 && p->symList->length==6,
+		   "Nested repeatable loops should each be kept once, 6 entries rather than 16.");
+  symbol expected[] = { symREPEAT, symREPEAT, symFD, symENDREPEAT, symRT, symENDREPEAT };
+  float values[] = { 4, 3, 5, 1, 90, 4 };
+  int matches = 1;
+  for(int i=0; matches && i<6; ++i)
+    {
+      matches = p->symList->syms[i]==expected[i] && floatCompare(p->symList->values[i], values[i]);
+    }
+  sput_fail_unless(matches, "A REPEAT should hold its trip count and its END the length of its body.");
+  sput_fail_unless(floatCompare(getVarValue(p, 'A'), 4) && floatCompare(getVarValue(p, 'B'), 3),
+		   "Loop variables should be left as if every iteration had run.");
+  freeSymList(p->symList);
+  freeParser(p);
+  freeInstructionList(program);
+}
+
+void testStreamParser()
+{
+  const char program[] = "{ SET A := 0 ; DO B FROM 1 TO 3 { SET A := A B + ; FD A RT 90 } LT -A }";
+  instructionList * tree = parseProgram(program, strlen(program));
+  symbolList * expected = executeProgram(tree);
+  freeInstructionList(tree);
+  streamParser * s = initStreamParser();
+  for(unsigned long i=0; i<strlen(program); ++i)
+    {
+      feedStreamParser(s, program+i, 1);
+    }
+  symbolList * streamed = finishStreamParser(s);
+  int matches = streamed!=NULL && streamed->length==expected->length;
+  for(unsigned long i=0; matches && i<expected->length; ++i)
+    {
+      matches = expected->syms[i]==streamed->syms[i] && floatCompare(expected->values[i], streamed->values[i]);
+    }
+  sput_fail_unless(matches, "Feeding a program one char at a time should give the same symList as parsing it whole.");
+  freeSymList(expected);
+  if(streamed) freeSymList(streamed);
+
+  s = initStreamParser();
+  feedStreamParser(s, "{ FD 10 RT 9", 12);
+  sput_fail_unless(s->p->symList->length==1, "A finished instruction should be run before the input ends.");
+  sput_fail_unless(s->length-s->start==4 && strncmp(s->buffer+s->start, "RT 9", 4)==0,
+		   "Only the text of the unfinished instruction should be kept.");
+  feedStreamParser(s, "0 }", 3);
+  streamed = finishStreamParser(s);
+  sput_fail_unless(streamed!=NULL && streamed->length==2 && floatCompare(streamed->values[1], 90),
+		   "A number cut by the end of a chunk should be joined with the rest of it.");
+  if(streamed) freeSymList(streamed);
+
+  s = initStreamParser();
+  feedStreamParser(s, "{ ", 2);
+  for(int i=0; i<10000; ++i)
+    {
+      feedStreamParser(s, "FD 1 LT 1 ", 10);
+    }
+  feedStreamParser(s, "}", 1);
+  sput_fail_unless(s->capacity<=64, "The buffer should not grow with the length of the program.");
+  streamed = finishStreamParser(s);
+  sput_fail_unless(streamed!=NULL && streamed->length==20000, "Every streamed instruction should be run.");
+  if(streamed) freeSymList(streamed);
+
+  s = initStreamParser();
+  feedStreamParser(s, "{ FD 10 ", 8);
+  sput_fail_unless(finishStreamParser(s)==NULL, "A program that never closes its ""}"" is invalid.");
+
+  s = initStreamParser();
+  sput_fail_unless(feedStreamParser(s, "{ FD 10 FD x } ", 15)==0, "Feeding an invalid instruction should return 0.");
+  sput_fail_unless(finishStreamParser(s)==NULL, "An invalid program should give a NULL symList.");
+
+  s = initStreamParser();
+  sput_fail_unless(feedStreamParser(s, "FD 10 }", 7)==0, "A program must start with a ""{"".");
+  sput_fail_unless(finishStreamParser(s)==NULL, "A program that doesn't start with a ""{"" is invalid.");
+}
+
+/**
+   Parse unit test suite.
+   Stress tests the parser and tree walker with a program and an expression far longer
+   than the C stack could take a frame per instruction or term for.
+*/
+void testLongPrograms()
+{
+  const int pairs = 1000000;
+  const char pair[] = "FD 1 RT 1 ";
+  char * source = malloc(pairs*strlen(pair)+8);
+  if(source==NULL)
+    {
+      printError("malloc failed exiting.",__FILE__,__FUNCTION__,__LINE__);
+      exit(1);
+    }
+  char * at = source + sprintf(source, "{ ");
+  for(int i=0; i<pairs; ++i) at += sprintf(at, "%s", pair);
+  sprintf(at, "}");
+  parser * p = initParser();
+  p->tokens = tokenise(source);
+  sput_fail_unless(parseMAIN(p)==1 && p->program->numberOfInstructions==2*pairs,
+		   "A flat program of two million instructions should parse.");
+  sput_fail_unless(executeInstrctlst(p, p->program)==1 && p->symList->length==2*pairs &&
+		   p->symList->syms[2*pairs-1]==symRT,
+		   "and run to two million entries on the symList.");
+  freeSymList(p->symList);
+  freeParser(p);
+
+  const int terms = 1000000;
+  at = source + sprintf(source, "{ SET A := 1 ");
+  for(int i=1; i<terms; i+=2) at += sprintf(at, "1 + ");
+  sprintf(at, "; FD A }");
+  p = initParser();
+  p->tokens = tokenise(source);
+  sput_fail_unless(parseMAIN(p)==1 && executeInstrctlst(p, p->program)==1 &&
+		   p->program->array[0].expression.numberOfTerms==terms+1 &&
+		   floatCompare(p->symList->values[0], terms/2+1),
+		   "A million term expression should parse and evaluate.");
+  freeSymList(p->symList);
+  freeParser(p);
+
+  const int depth = 2000;//loopIsRepeatable looks at every body inside each loop, so this is quadratic
+  at = source;
+  for(int i=0; i<depth; ++i) at += sprintf(at, "DO A FROM 1 TO 1 { ");
+  at += sprintf(at, "FD 1 ");
+  for(int i=0; i<depth; ++i) at += sprintf(at, "} ");
+  sprintf(at, "}");
+  instructionList * list = initInstructionList(initArena("program"));
+  p = initParser();
+  p->tokens = tokenise(source);
+  p->currentList = list;
+  sput_fail_unless(parseINSTRCTLST(p)==1 && list->numberOfInstructions==1 && executeInstrctlst(p, list)==1 &&
+		   p->symList->length==1,
+		   "Loops nested two thousand deep should parse and run.");
+  freeInstructionList(list);
+  freeSymList(p->symList);
+  freeParser(p);
+  free(source);
+}
+
 /**
    Builds a symbolList for use in path.c unit tests, if you change this you
    need to update void testBuildPath() in path.c and void testGetScaler() in draw.c
 */
 symbolList * mockSymListForPathUnitTests()
 {
-  parser * p = initParser();
-  addSymToList(p, symFD, 20);
-  addSymToList(p, symRT, 90);
-  addSymToList(p, symFD, 20);
-  addSymToList(p, symLT, 90);
-  addSymToList(p, symFD, 20);
-  addSymToList(p, symRT, 180);
-  addSymToList(p, symFD, 40);
-  addSymToList(p, symRT, 90);
-  addSymToList(p, symFD, 20);
-  symbolList * symList = p->symList;
-  freeParser(p);//note that this function never frees p->symList.
+  symbolList * symList = initSymList();
+  appendSym(symList, symFD, 20);
+  appendSym(symList, symRT, 90);
+  appendSym(symList, symFD, 20);
+  appendSym(symList, symLT, 90);
+  appendSym(symList, symFD, 20);
+  appendSym(symList, symRT, 180);
+  appendSym(symList, symFD, 40);
+  appendSym(symList, symRT, 90);
+  appendSym(symList, symFD, 20);
   return symList;
 }
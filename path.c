@@ -10,24 +10,86 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <pthread.h>
+#include <limits.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define ANIMATION_SPEED 10
 #define SCALE 10
+#define PATH_BLOCK_SIZE 256 //FDs whose headings are evaluated together by the batched kernel
+#define HEADING_TABLE_SIZE (360*HEADING_TABLE_STEPS)
+
+#if SINCOS_TERMS<3 || SINCOS_TERMS>6
+#error "SINCOS_TERMS must be between 3 and 6"
+#endif
 
 #pragma mark prototypes
 //pathBuilder Functions:
 typedef struct turtle {
-    float direction;//angle with +ve x axis (in radians)
+    double heading;//angle with +ve x axis in degrees, 0 <= heading < 360 so whole degree turns stay exact
     point position;//r=(x,y)
 } turtle;
 
+//a block of FDs for the batched kernel with the sin and cos of the heading at each
+typedef struct pathBlock {
+    float ammounts[PATH_BLOCK_SIZE];
+    float sines[PATH_BLOCK_SIZE];
+    float cosines[PATH_BLOCK_SIZE];
+    //headings not in the table, in radians, and which FD they belong to
+    float misses[PATH_BLOCK_SIZE];
+    int missedFD[PATH_BLOCK_SIZE];
+    float missSines[PATH_BLOCK_SIZE];
+    float missCosines[PATH_BLOCK_SIZE];
+} pathBlock;
+
+//reads a symList in order as if every REPEAT had been written out in full
+typedef struct repeatFrame {
+    unsigned long bodyStart;
+    int tripsLeft;
+} repeatFrame;
+
+typedef struct symCursor {
+    symbolList * symList;
+    unsigned long at;
+    repeatFrame * repeats;//innermost last
+    int depth, capacity;
+} symCursor;
+
+/* A slice of the program built on a thread of its own. Its turtle starts at the origin
+   facing 0, so where it ends up is the chunk's net rotation and translation. */
+typedef struct pathChunk {
+    symbolList syms;//views in to the program's symList
+    pointArray points;//and the path, neither owns its arrays
+    turtle * t;
+    pathBlock * block;
+    turtle start;//where the chunk really starts, from the scan of the chunks before it
+    int built;
+} pathChunk;
+
 pointArray * buildPath( symbolList * symList);
-turtle * startingPoint();
+turtle * startingPoint(arena * memory);
 void sampleTurtle(pointArray * path, turtle * t);
 void moveTurtleFD(turtle * t, float ammount);
 void rotateTurtle(turtle * t, symbol leftOrRight, float ammount);
 float convertDegreesToRadians(float degrees);
 pointArray * initPath();
+int walkSymList(pointArray * path, turtle * t, symbolList * symList);
+int walkSymListInBlocks(pointArray * path, turtle * t, symbolList * symList, pathBlock * block);
+void sinCosBlock(const float * angles, float * sines, float * cosines, int n);
+void sinCosPolynomial(float angle, float * sine, float * cosine);
+void buildHeadingTable();
+int walkChunk(pointArray * path, turtle * t, symbolList * symList, pathBlock * block);
+double countFDs(symbolList * symList, unsigned long start, unsigned long stop, unsigned long * end);
+void initSymCursor(symCursor * cursor, symbolList * symList);
+int nextSym(symCursor * cursor, symbol * sym, float * value);
+void freeSymCursor(symCursor * cursor);
+int walkSymListInParallel(pointArray * path, turtle * t, symbolList * symList, int numberOfThreads, arena * memory);
+void * buildChunk(void * chunk);
+void * placeChunk(void * chunk);
+void runOnThreads(void * (*function)(void *), pathChunk * chunks, int numberOfChunks, pthread_t * threads);
+int lookUpHeading(double heading, float * sine, float * cosine);
 
 #pragma mark Unit Test Prototypes
 void testDegreesToRadians();
@@ -36,6 +98,11 @@ void testRotateTurtle();
 void testMoveTurtleFD();
 void testSampleTurtle();
 void testBuildPath();
+void testSinCosBlock();
+void testBatchedKernel();
+void testLookUpHeading();
+void testParallelPath();
+void testRepeatReplay();
 
 #pragma mark Path Builder Functions
 /**
@@ -46,83 +113,513 @@ void testBuildPath();
 pointArray * buildPath( symbolList * symList)
 {
     if(symList->length==0) return NULL;
+    arena * memory = initArena("path");
     pointArray * path = initPath();
-    turtle * t = startingPoint();
+    unsigned long end;
+    double numberOfFDs = countFDs(symList, 0, symList->length, &end);
+    if(numberOfFDs>=INT_MAX)
+    {
+        printError("The program draws too many lines to hold as a path.", __FILE__, __FUNCTION__, __LINE__);
+        freeArena(memory);
+        freePath(path);
+        return NULL;
+    }
+    reservePath(path, (int)numberOfFDs+1);//a point for the start and one after each FD
+    buildHeadingTable();
+    turtle * t = startingPoint(memory);
     sampleTurtle(path, t);
-    symbolNode * currentInstruction = symList->start;
-    while(currentInstruction!=NULL)//move through linked list
+    unsigned long numberOfThreads = symList->length/PATH_SYMS_PER_THREAD;
+    if(numberOfThreads>PATH_THREADS) numberOfThreads = PATH_THREADS;
+    int built = numberOfThreads>1 ?
+        walkSymListInParallel(path, t, symList, (int)numberOfThreads, memory) :
+        walkChunk(path, t, symList, arenaAlloc(memory, sizeof(pathBlock)));
+    freeArena(memory);
+    if(!built)
     {
-        if(currentInstruction->sym==symFD)
+        freePath(path);
+        return NULL;
+    }
+    freeSymList(symList);
+    return path;
+}
+
+/**
+ Moves t through the instructions in order one at a time, sampling it after each FD.
+ Returns 1 if successful, 0 if symList contains anything but FD, LT, RT and REPEATs.
+ */
+int walkSymList(pointArray * path, turtle * t, symbolList * symList)
+{
+    symCursor cursor;
+    initSymCursor(&cursor, symList);
+    symbol sym;
+    float value;
+    while(nextSym(&cursor, &sym, &value))
+    {
+        if(sym==symFD)
         {
-            moveTurtleFD( t, currentInstruction->value);
+            moveTurtleFD( t, value);
             sampleTurtle(path, t);
         }
-        else if(currentInstruction->sym==symRT || currentInstruction->sym==symLT)
+        else if(sym==symRT || sym==symLT)
         {
-            rotateTurtle(t, currentInstruction->sym, currentInstruction->value);
+            rotateTurtle(t, sym, value);
         }
         else
         {
             printError("Unexpected sym in symList.", __FILE__, __FUNCTION__, __LINE__);
-            return NULL;
+            freeSymCursor(&cursor);
+            return 0;
         }
-        currentInstruction=currentInstruction->next;
     }
-    free(t);
-    freeSymList(symList);
-    return path;
+    freeSymCursor(&cursor);
+    return 1;
 }
 
 /**
- Moves turtle in the direction t->direction by ammount.
+ Does the same as walkSymList() a block of PATH_BLOCK_SIZE FDs at a time. The turns are
+ applied first, looking up the sin and cos of the heading at each FD in the table. Any
+ headings not in it are found together by sinCosBlock() before the turtle is moved.
+ Returns 1 if successful, 0 if symList contains anything but FD, LT and RT.
  */
-void moveTurtleFD(turtle * t, float ammount)
+int walkSymListInBlocks(pointArray * path, turtle * t, symbolList * symList, pathBlock * block)
 {
-    t->position.r[X] += ammount*cos(t->direction);
-    t->position.r[Y] += ammount*sin(t->direction);
+    symCursor cursor;
+    initSymCursor(&cursor, symList);
+    symbol sym;
+    float value;
+    int more = 1;
+    while(more)
+    {
+        int numberOfFDs = 0, numberOfMisses = 0;
+        while(numberOfFDs<PATH_BLOCK_SIZE && (more = nextSym(&cursor, &sym, &value)))
+        {
+            if(sym==symFD)
+            {
+                if(!lookUpHeading(t->heading, &block->sines[numberOfFDs], &block->cosines[numberOfFDs]))
+                {
+                    block->misses[numberOfMisses] = t->heading*M_PI/180;
+                    block->missedFD[numberOfMisses++] = numberOfFDs;
+                }
+                block->ammounts[numberOfFDs++] = value;
+            }
+            else if(sym==symRT || sym==symLT)
+            {
+                rotateTurtle(t, sym, value);
+            }
+            else
+            {
+                printError("Unexpected sym in symList.", __FILE__, __FUNCTION__, __LINE__);
+                freeSymCursor(&cursor);
+                return 0;
+            }
+        }
+        sinCosBlock(block->misses, block->missSines, block->missCosines, numberOfMisses);
+        for(int miss=0; miss<numberOfMisses; ++miss)
+        {
+            block->sines[block->missedFD[miss]] = block->missSines[miss];
+            block->cosines[block->missedFD[miss]] = block->missCosines[miss];
+        }
+        for(int fd=0; fd<numberOfFDs; ++fd)
+        {
+            t->position.r[X] += block->ammounts[fd]*block->cosines[fd];
+            t->position.r[Y] += block->ammounts[fd]*block->sines[fd];
+            sampleTurtle(path, t);
+        }
+    }
+    freeSymCursor(&cursor);
+    return 1;
 }
 
+#pragma mark Repeat Functions
 /**
- if leftOrRight= symRT then increase t->direction by ammount
- if leftOrRight= symLT then decrease t->direction by ammount
- Values wrapped so 0 <=  t->direction <= 2pi
+ Returns the number of FDs symList draws from start, which must not be inside a REPEAT,
+ counting each REPEAT's body as many times as it runs. Stops at the first index at or
+ after stop that is outside every REPEAT, which is put in end.
  */
-void rotateTurtle(turtle * t, symbol leftOrRight, float ammount)
+double countFDs(symbolList * symList, unsigned long start, unsigned long stop, unsigned long * end)
 {
-    float ammountInRadians = convertDegreesToRadians(ammount);
-    if(leftOrRight==symLT) ammountInRadians = -ammountInRadians;
-    
-    t->direction += ammountInRadians;
-    while (t->direction<0)
+    double count = 0, trips = 1;//how many times the current instruction runs
+    double * outerTrips = NULL;
+    int depth = 0, capacity = 0;
+    unsigned long i = start;
+    for(; i<symList->length && (i<stop || depth>0); ++i)
     {
-        t->direction += 2*M_PI;
+        symbol sym = symList->syms[i];
+        if(sym==symFD) count += trips;
+        else if(sym==symREPEAT)
+        {
+            if(depth==capacity)
+            {
+                capacity = capacity ? 2*capacity : 8;
+                double * tmp = realloc(outerTrips, capacity*sizeof(double));
+                if(tmp==NULL)
+                {
+                    printError("realloc failed exiting.",__FILE__,__FUNCTION__,__LINE__);
+                    exit(1);
+                }
+                outerTrips = tmp;
+            }
+            outerTrips[depth++] = trips;
+            trips *= symList->values[i];
+        }
+        else if(sym==symENDREPEAT && depth>0)
+        {
+            trips = outerTrips[--depth];
+        }
     }
-    while (t->direction>2*M_PI)
+    free(outerTrips);
+    *end = i;
+    return count;
+}
+
+void initSymCursor(symCursor * cursor, symbolList * symList)
+{
+    cursor->symList = symList;
+    cursor->at = 0;
+    cursor->repeats = NULL;
+    cursor->depth = 0;
+    cursor->capacity = 0;
+}
+
+/**
+ Puts the next instruction the turtle should follow in sym and value, going back over
+ the body of a REPEAT until it has run as many times as it should.
+ Returns 1 if there was one, 0 at the end of the symList.
+ */
+int nextSym(symCursor * cursor, symbol * sym, float * value)
+{
+    symbolList * symList = cursor->symList;
+    while(cursor->at<symList->length)
     {
-        t->direction -= 2*M_PI;
+        unsigned long i = cursor->at++;
+        if(symList->syms[i]==symREPEAT)
+        {
+            if(cursor->depth==cursor->capacity)
+            {
+                cursor->capacity = cursor->capacity ? 2*cursor->capacity : 8;
+                repeatFrame * tmp = realloc(cursor->repeats, cursor->capacity*sizeof(repeatFrame));
+                if(tmp==NULL)
+                {
+                    printError("realloc failed exiting.",__FILE__,__FUNCTION__,__LINE__);
+                    exit(1);
+                }
+                cursor->repeats = tmp;
+            }
+            cursor->repeats[cursor->depth].bodyStart = i+1;
+            cursor->repeats[cursor->depth++].tripsLeft = (int)symList->values[i];
+        }
+        else if(symList->syms[i]==symENDREPEAT && cursor->depth>0)
+        {
+            repeatFrame * innermost = &cursor->repeats[cursor->depth-1];
+            if(--innermost->tripsLeft>0) cursor->at = innermost->bodyStart;
+            else --cursor->depth;
+        }
+        else
+        {
+            *sym = symList->syms[i];
+            *value = symList->values[i];
+            return 1;
+        }
     }
+    return 0;
+}
+
+void freeSymCursor(symCursor * cursor)
+{
+    free(cursor->repeats);
+    cursor->repeats = NULL;
 }
 
 /**
- Converts an angle in degrees into radians
+ Walks symList with the batched kernel if BATCHED_PATH_KERNEL is set, one FD at a time if not.
  */
-float convertDegreesToRadians(float degrees)
+int walkChunk(pointArray * path, turtle * t, symbolList * symList, pathBlock * block)
 {
-    return (degrees * M_PI)/180;
+#if BATCHED_PATH_KERNEL
+    return walkSymListInBlocks(path, t, symList, block);
+#else
+    (void)block;
+    return walkSymList(path, t, symList);
+#endif
 }
 
+#pragma mark Parallel Path Builder Functions
 /**
- Builds and returns a * to a fresh turtle struct.
+ Does the same as walkChunk() split between numberOfThreads threads. Every run of FD, LT
+ and RT is a rotation plus a translation, so each thread builds its slice of the path as
+ if the turtle started at the origin. Scanning the chunks in order then gives each one the
+ turtle it really starts with, and a second parallel pass moves its points there.
+ Chunks only end outside a REPEAT, so one REPEAT is never split between threads.
+ Returns 1 if successful, 0 if symList contains anything but FD, LT and RT.
  */
-turtle * startingPoint()
+int walkSymListInParallel(pointArray * path, turtle * t, symbolList * symList, int numberOfThreads, arena * memory)
 {
-    turtle * t = malloc(sizeof(turtle));
-    if(t==NULL)
+    pathChunk * chunks = arenaAlloc(memory, numberOfThreads*sizeof(pathChunk));
+    pthread_t * threads = arenaAlloc(memory, numberOfThreads*sizeof(pthread_t));
+    unsigned long start = 0;
+    int numberOfPoints = path->numberOfPoints;
+    for(int c=0; c<numberOfThreads; ++c)
     {
-        printError("malloc failed exiting.",__FILE__,__FUNCTION__,__LINE__);
+        unsigned long end;
+        int numberOfFDs = (int)countFDs(symList, start, symList->length*(c+1)/numberOfThreads, &end);
+        pathChunk * chunk = &chunks[c];
+        chunk->syms.syms = symList->syms+start;
+        chunk->syms.values = symList->values+start;
+        chunk->syms.length = chunk->syms.capacity = end-start;
+        chunk->points.numberOfPoints = numberOfPoints;//offset until the path is reserved
+        chunk->points.capacity = numberOfFDs;
+        chunk->t = startingPoint(memory);
+        chunk->block = arenaAlloc(memory, sizeof(pathBlock));
+        numberOfPoints += numberOfFDs;
+        start = end;
+    }
+    reservePath(path, numberOfPoints);
+    for(int c=0; c<numberOfThreads; ++c)
+    {
+        chunks[c].points.array = path->array+chunks[c].points.numberOfPoints;
+        chunks[c].points.numberOfPoints = 0;
+    }
+    runOnThreads(buildChunk, chunks, numberOfThreads, threads);
+    for(int c=0; c<numberOfThreads; ++c)
+    {
+        if(!chunks[c].built) return 0;
+    }
+    //the scan, there are only ever a few chunks so it is done in order here
+    for(int c=0; c<numberOfThreads; ++c)
+    {
+        chunks[c].start = *t;
+        float sine, cosine;
+        if(!lookUpHeading(t->heading, &sine, &cosine))
+        {
+            sine = sin(t->heading*M_PI/180);
+            cosine = cos(t->heading*M_PI/180);
+        }
+        point moved = chunks[c].t->position;
+        t->position.r[X] += moved.r[X]*cosine - moved.r[Y]*sine;
+        t->position.r[Y] += moved.r[X]*sine + moved.r[Y]*cosine;
+        t->heading = fmod(t->heading + chunks[c].t->heading, 360);
+    }
+    runOnThreads(placeChunk, chunks+1, numberOfThreads-1, threads);//the first chunk is already in place
+    path->numberOfPoints = numberOfPoints;
+    return 1;
+}
+
+/**
+ Thread function, walks a pathChunk from the origin.
+ */
+void * buildChunk(void * chunk)
+{
+    pathChunk * c = chunk;
+    c->built = walkChunk(&c->points, c->t, &c->syms, c->block);
+    return NULL;
+}
+
+/**
+ Thread function, rotates and moves a built pathChunk's points to where it really starts.
+ */
+void * placeChunk(void * chunk)
+{
+    pathChunk * c = chunk;
+    float sine, cosine;
+    if(!lookUpHeading(c->start.heading, &sine, &cosine))
+    {
+        sine = sin(c->start.heading*M_PI/180);
+        cosine = cos(c->start.heading*M_PI/180);
+    }
+    for(int p=0; p<c->points.numberOfPoints; ++p)
+    {
+        point local = c->points.array[p];
+        c->points.array[p].r[X] = c->start.position.r[X] + local.r[X]*cosine - local.r[Y]*sine;
+        c->points.array[p].r[Y] = c->start.position.r[Y] + local.r[X]*sine + local.r[Y]*cosine;
+    }
+    return NULL;
+}
+
+/**
+ Runs function on each chunk, each on its own thread. A chunk whose thread can't be
+ started is run on this one instead.
+ */
+void runOnThreads(void * (*function)(void *), pathChunk * chunks, int numberOfChunks, pthread_t * threads)
+{
+    int * started = calloc(numberOfChunks ? numberOfChunks : 1, sizeof(int));
+    if(started==NULL)
+    {
+        printError("calloc failed exiting.",__FILE__,__FUNCTION__,__LINE__);
         exit(1);
     }
-    t->direction = 0;
+    for(int c=0; c<numberOfChunks; ++c)
+    {
+        started[c] = pthread_create(&threads[c], NULL, function, &chunks[c])==0;
+        if(!started[c]) function(&chunks[c]);
+    }
+    for(int c=0; c<numberOfChunks; ++c)
+    {
+        if(started[c]) pthread_join(threads[c], NULL);
+    }
+    free(started);
+}
+
+#pragma mark Sin Cos Functions
+/* Taylor coefficients, the angle is reduced to [-pi/4,pi/4] first so SINCOS_TERMS of
+   them bound the error as listed in main.h. */
+static const float sinCoefficients[] = { 1.0f, -1.0f/6, 1.0f/120, -1.0f/5040, 1.0f/362880, -1.0f/39916800 };
+static const float cosCoefficients[] = { 1.0f, -1.0f/2, 1.0f/24, -1.0f/720, 1.0f/40320, -1.0f/3628800 };
+#define TWO_OVER_PI 0.636619772f
+#define PI_OVER_2_HI 1.57079637f //pi/2 split in two so the reduction keeps float precision
+#define PI_OVER_2_LO -4.37113883e-08f
+
+/**
+ Fills sines and cosines with the sin and cos of each of the n angles (in radians).
+ Four at a time with SSE2 where it is available, the rest by sinCosPolynomial().
+ */
+void sinCosBlock(const float * angles, float * sines, float * cosines, int n)
+{
+    int i = 0;
+#ifdef __SSE2__
+    const __m128 twoOverPi = _mm_set1_ps(TWO_OVER_PI);
+    const __m128 piOver2Hi = _mm_set1_ps(PI_OVER_2_HI);
+    const __m128 piOver2Lo = _mm_set1_ps(PI_OVER_2_LO);
+    const __m128i one = _mm_set1_epi32(1), two = _mm_set1_epi32(2);
+    for(; i+4<=n; i+=4)
+    {
+        __m128 x = _mm_loadu_ps(angles+i);
+        __m128i quadrant = _mm_cvtps_epi32(_mm_mul_ps(x, twoOverPi));//rounds to nearest
+        __m128 q = _mm_cvtepi32_ps(quadrant);
+        __m128 r = _mm_sub_ps(_mm_sub_ps(x, _mm_mul_ps(q, piOver2Hi)), _mm_mul_ps(q, piOver2Lo));
+        __m128 r2 = _mm_mul_ps(r, r);
+        __m128 s = _mm_set1_ps(sinCoefficients[SINCOS_TERMS-1]);
+        __m128 c = _mm_set1_ps(cosCoefficients[SINCOS_TERMS-1]);
+        for(int term=SINCOS_TERMS-2; term>=0; --term)
+        {
+            s = _mm_add_ps(_mm_mul_ps(s, r2), _mm_set1_ps(sinCoefficients[term]));
+            c = _mm_add_ps(_mm_mul_ps(c, r2), _mm_set1_ps(cosCoefficients[term]));
+        }
+        s = _mm_mul_ps(s, r);
+        //odd quadrants swap sin and cos, the sign bits come from bit 1 of the quadrant
+        __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(quadrant, one), one));
+        __m128 sine = _mm_or_ps(_mm_and_ps(swap, c), _mm_andnot_ps(swap, s));
+        __m128 cosine = _mm_or_ps(_mm_and_ps(swap, s), _mm_andnot_ps(swap, c));
+        __m128i sineSign = _mm_slli_epi32(_mm_and_si128(quadrant, two), 30);
+        __m128i cosineSign = _mm_slli_epi32(_mm_and_si128(_mm_add_epi32(quadrant, one), two), 30);
+        _mm_storeu_ps(sines+i, _mm_xor_ps(sine, _mm_castsi128_ps(sineSign)));
+        _mm_storeu_ps(cosines+i, _mm_xor_ps(cosine, _mm_castsi128_ps(cosineSign)));
+    }
+#endif
+    for(; i<n; ++i)
+    {
+        sinCosPolynomial(angles[i], &sines[i], &cosines[i]);
+    }
+}
+
+/**
+ Scalar version of the sinCosBlock() kernel, gives the same results.
+ */
+void sinCosPolynomial(float angle, float * sine, float * cosine)
+{
+    int quadrant = (int)lrintf(angle*TWO_OVER_PI);
+    float q = quadrant;
+    float r = (angle - q*PI_OVER_2_HI) - q*PI_OVER_2_LO;
+    float r2 = r*r;
+    float s = sinCoefficients[SINCOS_TERMS-1];
+    float c = cosCoefficients[SINCOS_TERMS-1];
+    for(int term=SINCOS_TERMS-2; term>=0; --term)
+    {
+        s = s*r2 + sinCoefficients[term];
+        c = c*r2 + cosCoefficients[term];
+    }
+    s *= r;
+    *sine = quadrant&1 ? c : s;
+    *cosine = quadrant&1 ? s : c;
+    if(quadrant&2) *sine = -*sine;
+    if((quadrant+1)&2) *cosine = -*cosine;
+}
+
+#pragma mark Heading Table Functions
+static float sineTable[HEADING_TABLE_SIZE];
+static int headingTableBuilt = 0;
+
+/**
+ Fills sineTable with the sin of every HEADING_TABLE_STEPS'th of a degree. Only the first
+ quadrant is computed, the rest are its reflections so right angles come out exactly 0 or 1.
+ Call before any threads use lookUpHeading(), it does nothing once the table is built.
+ */
+void buildHeadingTable()
+{
+    if(headingTableBuilt) return;
+    const int quarter = HEADING_TABLE_SIZE/4;
+    for(int i=0; i<HEADING_TABLE_SIZE; ++i)
+    {
+        int quadrant = i/quarter, step = i%quarter;
+        double angle = step*M_PI/(180*HEADING_TABLE_STEPS);
+        float s = step==0 ? 0 : sin(angle);
+        float c = step==0 ? 1 : cos(angle);
+        sineTable[i] = quadrant==0 ? s : quadrant==1 ? c : quadrant==2 ? -s : -c;
+    }
+    headingTableBuilt = 1;
+}
+
+/**
+ If heading (in degrees, 0 <= heading < 360) is on the table's grid sets sine and cosine
+ from it and returns 1. Returns 0 and leaves them alone if it is not.
+ */
+int lookUpHeading(double heading, float * sine, float * cosine)
+{
+    double step = heading*HEADING_TABLE_STEPS;
+    if(step!=floor(step)) return 0;
+    if(!headingTableBuilt) buildHeadingTable();
+    int i = (int)step;
+    *sine = sineTable[i];
+    *cosine = sineTable[(i+HEADING_TABLE_SIZE/4)%HEADING_TABLE_SIZE];
+    return 1;
+}
+
+#pragma mark Turtle Functions
+/**
+ Moves turtle in the direction t->heading by ammount. The sin and cos come from the
+ heading table when they can and libm when they can't.
+ */
+void moveTurtleFD(turtle * t, float ammount)
+{
+    float sine, cosine;
+    if(lookUpHeading(t->heading, &sine, &cosine))
+    {
+        t->position.r[X] += ammount*cosine;
+        t->position.r[Y] += ammount*sine;
+        return;
+    }
+    double radians = t->heading*M_PI/180;
+    t->position.r[X] += ammount*cos(radians);
+    t->position.r[Y] += ammount*sin(radians);
+}
+
+/**
+ if leftOrRight= symRT then increase t->heading by ammount
+ if leftOrRight= symLT then decrease t->heading by ammount
+ Values wrapped so 0 <=  t->heading < 360
+ */
+void rotateTurtle(turtle * t, symbol leftOrRight, float ammount)
+{
+    double heading = fmod(t->heading + (leftOrRight==symLT ? -ammount : ammount), 360);
+    if(heading<0) heading += 360;
+    if(heading>=360) heading = 0;//a tiny negative heading can round up to 360
+    t->heading = heading;
+}
+
+/**
+ Converts an angle in degrees into radians
+ */
+float convertDegreesToRadians(float degrees)
+{
+    return (degrees * M_PI)/180;
+}
+
+/**
+ Builds and returns a * to a fresh turtle struct carved from memory.
+ */
+turtle * startingPoint(arena * memory)
+{
+    turtle * t = arenaAlloc(memory, sizeof(turtle));
+    t->heading = 0;
     for(dimension dim = X; dim<=DIM_MAX; ++dim)
     {
         t->position.r[dim]=0;
@@ -136,24 +633,46 @@ turtle * startingPoint()
 pointArray * initPath()
 {
     pointArray * path = malloc(sizeof(pointArray));
+    if(path==NULL)
+    {
+        printError("malloc failed exiting.",__FILE__,__FUNCTION__,__LINE__);
+        exit(1);
+    }
     path->numberOfPoints=0;
+    path->capacity=0;
     path->array=NULL;
     return path;
 }
 
 /**
- Takes turtles position and adds it to the path.
+ Module interface,
+ Makes sure path has room for at least capacity points without reallocating.
+ Returns the new capacity.
  */
-void sampleTurtle (pointArray * path, turtle * t)
+int reservePath(pointArray * path, int capacity)
 {
-    ++path->numberOfPoints;
-    point * tmp = realloc(path->array, path->numberOfPoints*sizeof(point));
+    if(capacity<=path->capacity) return path->capacity;
+    point * tmp = realloc(path->array, capacity*sizeof(point));
     if(tmp==NULL)
     {
         printError("realloc failed exiting.",__FILE__,__FUNCTION__,__LINE__);
         exit(1);
     }
     path->array = tmp;
+    path->capacity = capacity;
+    return capacity;
+}
+
+/**
+ Takes turtles position and adds it to the path, doubling the array if it is full.
+ */
+void sampleTurtle (pointArray * path, turtle * t)
+{
+    if(path->numberOfPoints==path->capacity)
+    {
+        reservePath(path, path->capacity ? 2*path->capacity : 64);
+    }
+    ++path->numberOfPoints;
     for(dimension dim = X; dim<=DIM_MAX; ++dim)
     {
         path->array[path->numberOfPoints-1].r[dim] = t->position.r[dim];
@@ -189,6 +708,26 @@ void unitTests_path()
     sput_enter_suite("testBuildPath()");
     sput_run_test(testBuildPath);
     sput_leave_suite();
+
+    sput_enter_suite("testSinCosBlock()");
+    sput_run_test(testSinCosBlock);
+    sput_leave_suite();
+
+    sput_enter_suite("testBatchedKernel()");
+    sput_run_test(testBatchedKernel);
+    sput_leave_suite();
+
+    sput_enter_suite("testLookUpHeading()");
+    sput_run_test(testLookUpHeading);
+    sput_leave_suite();
+
+    sput_enter_suite("testParallelPath()");
+    sput_run_test(testParallelPath);
+    sput_leave_suite();
+
+    sput_enter_suite("testRepeatReplay()");
+    sput_run_test(testRepeatReplay);
+    sput_leave_suite();
     
     sput_finish_testing();
 }
@@ -202,9 +741,10 @@ void testDegreesToRadians()
 
 void testStartingPoint()
 {
-    turtle * t = startingPoint();
+    arena * memory = initArena("path");
+    turtle * t = startingPoint(memory);
     
-    sput_fail_unless(t->direction==0,
+    sput_fail_unless(t->heading==0,
                      "Check all elements of the returned stuct are accessible and set correctly.");
     for(dimension dim = X; dim<=DIM_MAX; ++dim)
     {
@@ -213,40 +753,44 @@ void testStartingPoint()
         sput_fail_unless(t->position.r[dim]==0,
                          "Check all elements of the returned stuct are accessible and set correctly.");
     }
-    
-    free(t);
-
+    freeArena(memory);
 }
 
 void testRotateTurtle()
 {
-    turtle * t = startingPoint();
+    arena * memory = initArena("path");
+    turtle * t = startingPoint(memory);
     
     rotateTurtle(t,symLT, 90);
-    if(VERBOSE) printf("dirc = %f/pi\n",t->direction/M_PI);
-    sput_fail_unless(floatCompare(t->direction,3*M_PI_2)==1 ,
-                     "rotating left pi/2 should set t->direction to 3*pi/2.");
-    t->direction=0;
+    if(VERBOSE) printf("heading = %f degrees\n",t->heading);
+    sput_fail_unless(t->heading==270,
+                     "rotating left 90 should set t->heading to exactly 270.");
+    t->heading=0;
     rotateTurtle(t,symRT, 90);
-    if(VERBOSE) printf("dirc = %f/pi\n",t->direction/M_PI);
-    sput_fail_unless(floatCompare(t->direction, M_PI_2)==1 ,
-                     "rotating right pi/2 should set t->direction to pi/2.");
-    t->direction=0;
+    if(VERBOSE) printf("heading = %f degrees\n",t->heading);
+    sput_fail_unless(t->heading==90,
+                     "rotating right 90 should set t->heading to exactly 90.");
+    t->heading=0;
     rotateTurtle(t,symRT, 720+45);
-    if(VERBOSE) printf("dirc = %f/pi\n",t->direction/M_PI);
-    sput_fail_unless(floatCompare(t->direction, M_PI_4)==1 ,
-                     "rotating right 4pi +pi/4 should set t->direction to pi/4.");
-    t->direction=0;
+    if(VERBOSE) printf("heading = %f degrees\n",t->heading);
+    sput_fail_unless(t->heading==45,
+                     "rotating right 720+45 should set t->heading to 45.");
+    t->heading=0;
     rotateTurtle(t,symLT, 720+45);
-    if(VERBOSE) printf("dirc = %f/pi\n",t->direction/M_PI);
-    sput_fail_unless(floatCompare(t->direction, 2*M_PI - M_PI_4)==1 ,
-                     "rotating left 4pi +pi/4 should set t->direction to pi/4.");
-    free(t);
+    if(VERBOSE) printf("heading = %f degrees\n",t->heading);
+    sput_fail_unless(t->heading==315,
+                     "rotating left 720+45 should set t->heading to 315.");
+    t->heading=0;
+    for(int i=0; i<1000; ++i) rotateTurtle(t,symRT, 0.25);
+    sput_fail_unless(t->heading==250,
+                     "a thousand quarter degree turns should add up to exactly 250 degrees.");
+    freeArena(memory);
 }
 
 void testMoveTurtleFD()
 {
-    turtle * t = startingPoint();
+    arena * memory = initArena("path");
+    turtle * t = startingPoint(memory);
     float ammount = 0.5;
     moveTurtleFD(t, ammount);
     sput_fail_unless(floatCompare(t->position.r[X],ammount) &&
@@ -269,46 +813,43 @@ void testMoveTurtleFD()
     sput_fail_unless(floatCompare(t->position.r[X],0) &&
                      floatCompare(t->position.r[Y],0) ,
                      "moving FD 0.5 with direction = pi should set r[Y] back to 0.");
-    free(t);
-    t = startingPoint();
+    t = startingPoint(memory);
     rotateTurtle(t,symRT, 45);
     moveTurtleFD(t, ammount);
     sput_fail_unless(floatCompare(t->position.r[X],ammount/sqrt(2)) &&
                      floatCompare(t->position.r[Y],ammount/sqrt(2)) ,
                      "Checking that non right angle directions work");
-    free(t);
-    t = startingPoint();
+    t = startingPoint(memory);
     rotateTurtle(t,symLT, 45);
     moveTurtleFD(t, ammount);
     sput_fail_unless(floatCompare(t->position.r[X],ammount/sqrt(2)) &&
                      floatCompare(t->position.r[Y],-ammount/sqrt(2)) ,
                      "Checking that non right angle directions work");
-    free(t);
-    t = startingPoint();
+    t = startingPoint(memory);
     rotateTurtle(t,symRT, 135);
     moveTurtleFD(t, ammount);
     sput_fail_unless(floatCompare(t->position.r[X],-ammount/sqrt(2)) &&
                      floatCompare(t->position.r[Y],ammount/sqrt(2)) ,
                      "Checking that non right angle directions work");
-    free(t);
-    t = startingPoint();
+    t = startingPoint(memory);
     rotateTurtle(t, symLT,135 );
     moveTurtleFD(t, ammount);
     sput_fail_unless(floatCompare(t->position.r[X],-ammount/sqrt(2)) &&
                      floatCompare(t->position.r[Y],-ammount/sqrt(2)) ,
                      "Checking that non right angle directions work");
-    free(t);
-    t = startingPoint();
+    t = startingPoint(memory);
     rotateTurtle(t, symRT, 1.9);
     moveTurtleFD(t, ammount);
     sput_fail_unless(floatCompare(t->position.r[X],cos(convertDegreesToRadians(1.9))*ammount) &&
                      floatCompare(t->position.r[Y],sin(convertDegreesToRadians(1.9))*ammount) ,
                      "Checking that non right angle directions work");
+    freeArena(memory);
 }
 
 void testSampleTurtle()
 {
-    turtle * t = startingPoint();
+    arena * memory = initArena("path");
+    turtle * t = startingPoint(memory);
     pointArray * path = initPath();
     sampleTurtle(path, t);
     sput_fail_unless(floatCompare(path->array[0].r[X],0) && floatCompare(path->array[0].r[Y],0),
@@ -335,14 +876,22 @@ void testSampleTurtle()
     sampleTurtle(path, t);
     sput_fail_unless(floatCompare(path->array[4].r[X],0) && floatCompare(path->array[4].r[Y],0),
                      "Moving turtle in a square sampling at each corner checking it gets added the pointArray");
+    sput_fail_unless(path->capacity==64, "An unreserved path should start with room for 64 points.");
+    reservePath(path, 5);
+    sput_fail_unless(path->capacity==64, "reservePath should never shrink a path.");
+    for(int i=path->numberOfPoints; i<=64; ++i) sampleTurtle(path, t);
+    sput_fail_unless(path->numberOfPoints==65 && path->capacity==128,
+                     "Sampling past the capacity should double it.");
 
     freePath(path);
-    free(t);
+    freeArena(memory);
 }
 
 void testBuildPath()
 {
     pointArray * path = buildPath(mockSymListForPathUnitTests());
+    sput_fail_unless(path->numberOfPoints==6 && path->capacity==6,
+                     "buildPath should reserve exactly one point per FD plus the start.");
     sput_fail_unless(floatCompare(path->array[0].r[X],0) &&
                      floatCompare(path->array[0].r[Y],0),
                      "Testing buildPath with mockSymList.");
@@ -364,24 +913,185 @@ void testBuildPath()
     freePath(path);
 }
 
+void testSinCosBlock()
+{
+    float angles[PATH_BLOCK_SIZE], sines[PATH_BLOCK_SIZE], cosines[PATH_BLOCK_SIZE];
+    for(int i=0; i<PATH_BLOCK_SIZE; ++i)
+    {
+        angles[i] = 2*M_PI*i/(PATH_BLOCK_SIZE-1);
+    }
+    sinCosBlock(angles, sines, cosines, PATH_BLOCK_SIZE-1);//odd so the scalar tail runs too
+    float worst = 0;
+    for(int i=0; i<PATH_BLOCK_SIZE-1; ++i)
+    {
+        worst = fmaxf(worst, fabsf(sines[i]-(float)sin(angles[i])));
+        worst = fmaxf(worst, fabsf(cosines[i]-(float)cos(angles[i])));
+    }
+    sput_fail_unless(worst<5e-4, "sinCosBlock should stay within its error bound over 0 to 2pi.");
+    float sine, cosine;
+    sinCosPolynomial(M_PI_2, &sine, &cosine);
+    sput_fail_unless(floatCompare(sine,1) && floatCompare(cosine,0), "Checking sinCosPolynomial at pi/2.");
+    sinCosPolynomial(M_PI, &sine, &cosine);
+    sput_fail_unless(floatCompare(sine,0) && floatCompare(cosine,-1), "Checking sinCosPolynomial at pi.");
+}
+
+void testBatchedKernel()
+{
+    symbolList * symList = initSymList();
+    unsigned int seed = 1;
+    for(int i=0; i<3*PATH_BLOCK_SIZE; ++i)//more than one block, with runs of FDs and turns
+    {
+        seed = seed*1103515245+12345;
+        symbol sym = (seed>>16)%3==0 ? symFD : (seed>>16)%3==1 ? symLT : symRT;
+        appendSym(symList, sym, (float)((seed>>8)%360)/7);
+    }
+    arena * memory = initArena("path");
+    pointArray * scalar = initPath();
+    pointArray * batched = initPath();
+    turtle * t = startingPoint(memory);
+    sput_fail_unless(walkSymList(scalar, t, symList), "walkSymList should accept FD, LT and RT.");
+    t = startingPoint(memory);
+    sput_fail_unless(walkSymListInBlocks(batched, t, symList, arenaAlloc(memory, sizeof(pathBlock))),
+                     "walkSymListInBlocks should accept FD, LT and RT.");
+    int matches = scalar->numberOfPoints==batched->numberOfPoints;
+    for(int p=0; matches && p<scalar->numberOfPoints; ++p)
+    {
+        matches = floatCompare(scalar->array[p].r[X], batched->array[p].r[X]) &&
+                  floatCompare(scalar->array[p].r[Y], batched->array[p].r[Y]);
+    }
+    sput_fail_unless(matches, "The batched kernel should trace the same path as moveTurtleFD.");
+    symList->syms[symList->length/2] = symDO;//appendSym() won't add one
+    sput_fail_unless(walkSymListInBlocks(batched, t, symList, arenaAlloc(memory, sizeof(pathBlock)))==0,
+                     "walkSymListInBlocks should reject any other symbol.");
+    freePath(scalar);
+    freePath(batched);
+    freeSymList(symList);
+    freeArena(memory);
+}
+void testLookUpHeading()
+{
+    float sine = 2, cosine = 2;
+    sput_fail_unless(lookUpHeading(90, &sine, &cosine) && sine==1 && cosine==0,
+                     "Right angles should come from the table exactly.");
+    sput_fail_unless(lookUpHeading(270, &sine, &cosine) && sine==-1 && cosine==0,
+                     "Right angles should come from the table exactly.");
+    sput_fail_unless(lookUpHeading(30.25, &sine, &cosine) &&
+                     floatCompare(sine, sin(30.25*M_PI/180)) && floatCompare(cosine, cos(30.25*M_PI/180)),
+                     "Headings on the table's grid should be looked up.");
+    sput_fail_unless(lookUpHeading(30.1, &sine, &cosine)==0, "Headings off the grid should not be.");
+    arena * memory = initArena("path");
+    turtle * t = startingPoint(memory);
+    for(int side=0; side<4; ++side)
+    {
+        moveTurtleFD(t, 5);
+        rotateTurtle(t, symRT, 90);
+    }
+    sput_fail_unless(t->position.r[X]==0 && t->position.r[Y]==0 && t->heading==0,
+                     "A square should close exactly.");
+    freeArena(memory);
+}
+void testParallelPath()
+{
+    symbolList * symList = initSymList();
+    for(int a=1; a<=400; ++a)//a smaller input.txt
+    {
+        appendSym(symList, symFD, a);
+        appendSym(symList, symRT, 217);
+        appendSym(symList, symFD, 20);
+        for(int b=1; b<=8; ++b)
+        {
+            appendSym(symList, symFD, b);
+            appendSym(symList, symRT, 41);
+        }
+        appendSym(symList, symFD, a);
+    }
+    appendSym(symList, symLT, 0.3);//ends off the table's grid
+    appendSym(symList, symFD, 10);
+    arena * memory = initArena("path");
+    pointArray * serial = initPath();
+    pointArray * parallel = initPath();
+    turtle * serialTurtle = startingPoint(memory);
+    turtle * parallelTurtle = startingPoint(memory);
+    walkSymList(serial, serialTurtle, symList);
+    sput_fail_unless(walkSymListInParallel(parallel, parallelTurtle, symList, 3, memory),
+                     "walkSymListInParallel should accept FD, LT and RT.");
+    int matches = serial->numberOfPoints==parallel->numberOfPoints;
+    for(int p=0; matches && p<serial->numberOfPoints; ++p)
+    {
+        matches = floatCompare(serial->array[p].r[X], parallel->array[p].r[X]) &&
+                  floatCompare(serial->array[p].r[Y], parallel->array[p].r[Y]);
+    }
+    sput_fail_unless(matches, "Building a path on three threads should match building it on one.");
+    sput_fail_unless(floatCompare(serialTurtle->heading, parallelTurtle->heading) &&
+                     floatCompare(serialTurtle->position.r[X], parallelTurtle->position.r[X]) &&
+                     floatCompare(serialTurtle->position.r[Y], parallelTurtle->position.r[Y]),
+                     "The turtle should end up in the same place either way.");
+    freePath(serial);
+    freePath(parallel);
+    freeSymList(symList);
+    freeArena(memory);
+}
+void testRepeatReplay()
+{
+    //4 x (FD 5, 3 x (RT 30 FD 2), LT 0.3) written both ways
+    symbolList * repeated = initSymList();
+    symbolList * expanded = initSymList();
+    appendSym(repeated, symREPEAT, 4);
+    appendSym(repeated, symFD, 5);
+    appendSym(repeated, symREPEAT, 3);
+    appendSym(repeated, symRT, 30);
+    appendSym(repeated, symFD, 2);
+    appendSym(repeated, symENDREPEAT, 2);
+    appendSym(repeated, symLT, 0.3);
+    appendSym(repeated, symENDREPEAT, 6);
+    for(int outer=0; outer<4; ++outer)
+    {
+        appendSym(expanded, symFD, 5);
+        for(int inner=0; inner<3; ++inner)
+        {
+            appendSym(expanded, symRT, 30);
+            appendSym(expanded, symFD, 2);
+        }
+        appendSym(expanded, symLT, 0.3);
+    }
+    unsigned long end;
+    sput_fail_unless(countFDs(repeated, 0, 1, &end)==16 && end==repeated->length,
+                     "countFDs should count each REPEAT as many times as it runs and not stop inside one.");
+    arena * memory = initArena("path");
+    pointArray * fromRepeats = initPath();
+    pointArray * fromExpanded = initPath();
+    sput_fail_unless(walkChunk(fromRepeats, startingPoint(memory), repeated, arenaAlloc(memory, sizeof(pathBlock))) &&
+                     walkSymList(fromExpanded, startingPoint(memory), expanded),
+                     "Both lists should walk without error.");
+    int matches = fromRepeats->numberOfPoints==16 && fromExpanded->numberOfPoints==16;
+    for(int p=0; matches && p<16; ++p)
+    {
+        matches = floatCompare(fromRepeats->array[p].r[X], fromExpanded->array[p].r[X]) &&
+                  floatCompare(fromRepeats->array[p].r[Y], fromExpanded->array[p].r[Y]);
+    }
+    sput_fail_unless(matches, "Replaying the REPEATs should trace the same path as the loops written out.");
+    freePath(fromRepeats);
+    freePath(fromExpanded);
+    freeSymList(repeated);
+    freeSymList(expanded);
+    freeArena(memory);
+}
 
 /**Copied from parser.c for reference
  Builds a symbolList for use in path.c unit tests
  
 symbolList * mockSymListForPathUnitTests()
 {
-    parser * p = initParser();
-    addSymToList(p, symFD, 20);
-    addSymToList(p, symRT, 90);
-    addSymToList(p, symFD, 20);
-    addSymToList(p, symLT, 90);
-    addSymToList(p, symFD, 20);
-    addSymToList(p, symRT, 180);
-    addSymToList(p, symFD, 40);
-    addSymToList(p, symRT, 90);
-    addSymToList(p, symFD, 20);
-    symbolList * symList = p->symList;
-    freeParser(p);//note that this function never frees p->symList.
+    symbolList * symList = initSymList();
+    appendSym(symList, symFD, 20);
+    appendSym(symList, symRT, 90);
+    appendSym(symList, symFD, 20);
+    appendSym(symList, symLT, 90);
+    appendSym(symList, symFD, 20);
+    appendSym(symList, symRT, 180);
+    appendSym(symList, symFD, 40);
+    appendSym(symList, symRT, 90);
+    appendSym(symList, symFD, 20);
     return symList;
 }
 
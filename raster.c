@@ -0,0 +1,520 @@
+//
+//  raster.c
+//  logo
+//
+//  Draws a path in to a framebuffer in memory and writes it out as a PPM or PNG
+//  image, for machines with no display. Nothing here needs SDL.
+//
+#include "main.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+//RGB, 3 bytes a pixel, rows top to bottom
+typedef struct framebuffer {
+    unsigned char * pixels;
+    int width, height;
+} framebuffer;
+
+//packs bits least significant first, as deflate wants them
+typedef struct bitWriter {
+    unsigned char * bytes;
+    unsigned long length;
+    unsigned int buffer;
+    int bits;
+} bitWriter;
+
+#pragma mark prototypes
+framebuffer * initFramebuffer(int width, int height);
+void freeFramebuffer(framebuffer * f);
+void rasterizeLines(framebuffer * f, pointArray * path);
+void drawLine(framebuffer * f, point a, point b);
+int clipLine(float * x0, float * y0, float * x1, float * y1, float maxX, float maxY);
+void setPixel(framebuffer * f, int x, int y);
+int writePPM(framebuffer * f, FILE * out);
+int writePNG(framebuffer * f, FILE * out);
+unsigned long deflateFixed(const unsigned char * data, unsigned long length, unsigned char * out);
+void putBits(bitWriter * w, unsigned int value, int bits);
+void putHuffman(bitWriter * w, unsigned int code, int bits);
+void putLiteral(bitWriter * w, unsigned char byte);
+void putRun(bitWriter * w, int length);
+int writePNGChunk(FILE * out, const char type[], const unsigned char * data, unsigned long length);
+unsigned long pngCRC(unsigned long crc, const unsigned char * data, unsigned long length);
+void putBigEndian(unsigned char * out, unsigned long value);
+int endsWith(const char * string, const char * ending);
+
+#pragma mark Unit Test Prototypes
+void testClipLine();
+void testDrawLine();
+void testWritePPM();
+void testWritePNG();
+void testWritePathImage();
+
+#pragma mark Raster Functions
+/**
+ Module interface,
+ Draws path fitted by getScaler on to an IMAGE_WIDTH by IMAGE_HEIGHT image and writes it
+ to imagePath, as a PNG if the name ends in .png and a PPM if not.
+ Returns 1 if successful, 0 if not.
+ */
+int writePathImage(pointArray * path, const char * imagePath)
+{
+    const int size[NUMBER_OF_DIMENSIONS] = { IMAGE_WIDTH, IMAGE_HEIGHT };
+    scaler * s = getScaler(size, path);
+    if(s==NULL) return 0;
+    viewTransform view = makeViewTransform(s->scale, s->offset, s->rotation);
+    free(s);
+    pointArray * scaledPath = initPath();
+    reservePath(scaledPath, path->numberOfPoints);
+    transformPath(path, &view, scaledPath);
+    framebuffer * f = initFramebuffer(IMAGE_WIDTH, IMAGE_HEIGHT);
+    rasterizeLines(f, scaledPath);
+    freePath(scaledPath);
+    FILE * out = fopen(imagePath, "wb");
+    if(!out)
+    {
+        printError("could not open image file.", __FILE__, __FUNCTION__, __LINE__);
+        freeFramebuffer(f);
+        return 0;
+    }
+    int written = endsWith(imagePath, ".png") ? writePNG(f, out) : writePPM(f, out);
+    written = fclose(out)==0 && written;
+    freeFramebuffer(f);
+    if(!written) printError("could not write the image.", __FILE__, __FUNCTION__, __LINE__);
+    else if(VERBOSE) printf("Wrote %s.\n", imagePath);
+    return written;
+}
+
+/**
+ Makes a black width by height framebuffer.
+ */
+framebuffer * initFramebuffer(int width, int height)
+{
+    framebuffer * f = malloc(sizeof(framebuffer));
+    if(f==NULL)
+    {
+        printError("framebuffer * f = malloc(sizeof(framebuffer)) failed exiting.",__FILE__,__FUNCTION__,__LINE__);
+        exit(1);
+    }
+    f->width = width;
+    f->height = height;
+    f->pixels = calloc((size_t)width*height, 3);
+    if(f->pixels==NULL)
+    {
+        printError("f->pixels = calloc(width*height, 3) failed exiting.",__FILE__,__FUNCTION__,__LINE__);
+        exit(1);
+    }
+    return f;
+}
+
+void freeFramebuffer(framebuffer * f)
+{
+    free(f->pixels);
+    free(f);
+}
+
+/**
+ Joins the points of path, already in pixel coordinates, with white lines.
+ */
+void rasterizeLines(framebuffer * f, pointArray * path)
+{
+    for(int p=1; p<path->numberOfPoints; ++p)
+    {
+        drawLine(f, path->array[p-1], path->array[p]);
+    }
+}
+
+/**
+ Draws the part of the line from a to b that is on f with Bresenham's algorithm.
+ */
+void drawLine(framebuffer * f, point a, point b)
+{
+    float x0 = a.r[X], y0 = a.r[Y], x1 = b.r[X], y1 = b.r[Y];
+    if(!clipLine(&x0, &y0, &x1, &y1, f->width-1, f->height-1)) return;
+    int x = (int)lroundf(x0), y = (int)lroundf(y0);
+    int xEnd = (int)lroundf(x1), yEnd = (int)lroundf(y1);
+    int dx = abs(xEnd-x), dy = -abs(yEnd-y);
+    int stepX = x<xEnd ? 1 : -1, stepY = y<yEnd ? 1 : -1;
+    int error = dx+dy;
+    while(1)
+    {
+        setPixel(f, x, y);
+        if(x==xEnd && y==yEnd) return;
+        int twice = 2*error;
+        if(twice>=dy)
+        {
+            error += dy;
+            x += stepX;
+        }
+        if(twice<=dx)
+        {
+            error += dx;
+            y += stepY;
+        }
+    }
+}
+
+/**
+ Cuts the line down to the part inside 0<=x<=maxX, 0<=y<=maxY (Liang-Barsky).
+ Returns 0 if none of it is, or it isn't made of finite numbers.
+ */
+int clipLine(float * x0, float * y0, float * x1, float * y1, float maxX, float maxY)
+{
+    float dx = *x1-*x0, dy = *y1-*y0;
+    if(!isfinite(dx) || !isfinite(dy)) return 0;
+    const float p[4] = { -dx, dx, -dy, dy };
+    const float q[4] = { *x0, maxX-*x0, *y0, maxY-*y0 };
+    float enter = 0, leave = 1;
+    for(int edge=0; edge<4; ++edge)
+    {
+        if(p[edge]==0)
+        {
+            if(q[edge]<0) return 0;//parallel to the edge and outside it
+            continue;
+        }
+        float t = q[edge]/p[edge];
+        if(p[edge]<0)
+        {
+            if(t>leave) return 0;
+            if(t>enter) enter = t;
+        }
+        else
+        {
+            if(t<enter) return 0;
+            if(t<leave) leave = t;
+        }
+    }
+    float startX = *x0, startY = *y0;
+    *x0 = startX + enter*dx;
+    *y0 = startY + enter*dy;
+    *x1 = startX + leave*dx;
+    *y1 = startY + leave*dy;
+    return 1;
+}
+
+void setPixel(framebuffer * f, int x, int y)
+{
+    if(x<0 || y<0 || x>=f->width || y>=f->height) return;
+    memset(&f->pixels[3*((size_t)y*f->width+x)], 0xFF, 3);
+}
+
+#pragma mark Image File Functions
+/**
+ Writes f as a binary PPM. Returns 1 if successful, 0 if not.
+ */
+int writePPM(framebuffer * f, FILE * out)
+{
+    size_t bytes = (size_t)3*f->width*f->height;
+    if(fprintf(out, "P6\n%d %d\n255\n", f->width, f->height)<0) return 0;
+    return fwrite(f->pixels, 1, bytes, out)==bytes;
+}
+
+/**
+ Writes f as an 8 bit RGB PNG. Each row is stored unfiltered and compressed with
+ deflate's fixed Huffman codes, which is all the long runs of black need.
+ Returns 1 if successful, 0 if not.
+ */
+int writePNG(framebuffer * f, FILE * out)
+{
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    unsigned long rowBytes = 1+3*(unsigned long)f->width;//a filter type byte then the row
+    unsigned long rawLength = rowBytes*f->height;
+    unsigned char * raw = malloc(rawLength);
+    //zlib header, no more than 9 bits a byte, end of block and the checksum
+    unsigned char * compressed = malloc(2+rawLength*9/8+8+4);
+    if(raw==NULL || compressed==NULL)
+    {
+        printError("malloc failed exiting.",__FILE__,__FUNCTION__,__LINE__);
+        exit(1);
+    }
+    for(int row=0; row<f->height; ++row)
+    {
+        raw[row*rowBytes] = 0;
+        memcpy(&raw[row*rowBytes+1], &f->pixels[row*(rowBytes-1)], rowBytes-1);
+    }
+    unsigned long compressedLength = deflateFixed(raw, rawLength, compressed);
+    free(raw);
+
+    unsigned char header[13];
+    putBigEndian(header, f->width);
+    putBigEndian(header+4, f->height);
+    header[8] = 8;//bits a channel
+    header[9] = 2;//RGB
+    header[10] = header[11] = header[12] = 0;//deflate, adaptive filtering, not interlaced
+    int written = fwrite(signature, 1, sizeof(signature), out)==sizeof(signature) &&
+        writePNGChunk(out, "IHDR", header, sizeof(header)) &&
+        writePNGChunk(out, "IDAT", compressed, compressedLength) &&
+        writePNGChunk(out, "IEND", NULL, 0);
+    free(compressed);
+    return written;
+}
+
+/**
+ Compresses data in to out as a zlib stream of one fixed Huffman deflate block. The only
+ matches looked for are runs of the previous byte, at distance 1.
+ Returns the length of the stream.
+ */
+unsigned long deflateFixed(const unsigned char * data, unsigned long length, unsigned char * out)
+{
+    bitWriter w = { out, 0, 0, 0 };
+    putBits(&w, 0x78, 8);//deflate with a 32K window
+    putBits(&w, 0x01, 8);//makes the header a multiple of 31
+    putBits(&w, 1, 1);//the last block
+    putBits(&w, 1, 2);//fixed Huffman codes
+    unsigned long adlerA = 1, adlerB = 0;
+    for(unsigned long i=0; i<length; )
+    {
+        putLiteral(&w, data[i]);
+        unsigned long run = 0;
+        while(i+1+run<length && data[i+1+run]==data[i] && run<258) ++run;
+        if(run<3) run = 0;
+        else putRun(&w, (int)run);
+        for(unsigned long j=i; j<=i+run; ++j)
+        {
+            adlerA = (adlerA+data[j])%65521;
+            adlerB = (adlerB+adlerA)%65521;
+        }
+        i += run+1;
+    }
+    putHuffman(&w, 0, 7);//end of block
+    if(w.bits>0) putBits(&w, 0, 8-w.bits);
+    unsigned char adler[4];
+    putBigEndian(adler, (adlerB<<16)|adlerA);
+    memcpy(&w.bytes[w.length], adler, 4);
+    return w.length+4;
+}
+
+void putBits(bitWriter * w, unsigned int value, int bits)
+{
+    w->buffer |= value<<w->bits;
+    w->bits += bits;
+    while(w->bits>=8)
+    {
+        w->bytes[w->length++] = w->buffer & 0xFF;
+        w->buffer >>= 8;
+        w->bits -= 8;
+    }
+}
+
+//Huffman codes go most significant bit first
+void putHuffman(bitWriter * w, unsigned int code, int bits)
+{
+    unsigned int reversed = 0;
+    for(int b=0; b<bits; ++b)
+    {
+        reversed = (reversed<<1) | ((code>>b) & 1);
+    }
+    putBits(w, reversed, bits);
+}
+
+void putLiteral(bitWriter * w, unsigned char byte)
+{
+    if(byte<144) putHuffman(w, 0x30+byte, 8);
+    else         putHuffman(w, 0x190+byte-144, 9);
+}
+
+/* a match of length 3 to 258 at distance 1 */
+void putRun(bitWriter * w, int length)
+{
+    static const int base[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static const int extra[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    int code = 28;
+    while(base[code]>length) --code;
+    int symbol = 257+code;
+    if(symbol<280) putHuffman(w, symbol-256, 7);
+    else           putHuffman(w, 0xC0+symbol-280, 8);
+    putBits(w, length-base[code], extra[code]);
+    putHuffman(w, 0, 5);//distance 1
+}
+
+/**
+ Writes one chunk, its length, type, data and CRC. Returns 1 if successful, 0 if not.
+ */
+int writePNGChunk(FILE * out, const char type[], const unsigned char * data, unsigned long length)
+{
+    unsigned char word[4];
+    putBigEndian(word, length);
+    if(fwrite(word, 1, 4, out)!=4 || fwrite(type, 1, 4, out)!=4) return 0;
+    if(length>0 && fwrite(data, 1, length, out)!=length) return 0;
+    unsigned long crc = pngCRC(pngCRC(0, (const unsigned char *)type, 4), data, length);
+    putBigEndian(word, crc);
+    return fwrite(word, 1, 4, out)==4;
+}
+
+/**
+ Adds length bytes of data to crc, start with 0.
+ */
+unsigned long pngCRC(unsigned long crc, const unsigned char * data, unsigned long length)
+{
+    static unsigned long table[256];
+    static int tableMade = 0;
+    if(!tableMade)
+    {
+        for(unsigned long n=0; n<256; ++n)
+        {
+            unsigned long c = n;
+            for(int k=0; k<8; ++k) c = c&1 ? 0xEDB88320UL^(c>>1) : c>>1;
+            table[n] = c;
+        }
+        tableMade = 1;
+    }
+    crc ^= 0xFFFFFFFFUL;
+    for(unsigned long i=0; i<length; ++i)
+    {
+        crc = table[(crc^data[i]) & 0xFF]^(crc>>8);
+    }
+    return crc^0xFFFFFFFFUL;
+}
+
+void putBigEndian(unsigned char * out, unsigned long value)
+{
+    out[0] = (value>>24) & 0xFF;
+    out[1] = (value>>16) & 0xFF;
+    out[2] = (value>>8) & 0xFF;
+    out[3] = value & 0xFF;
+}
+
+int endsWith(const char * string, const char * ending)
+{
+    size_t length = strlen(string), endingLength = strlen(ending);
+    return length>=endingLength && stringsMatch(string+length-endingLength, ending);
+}
+
+#pragma mark Unit Tests
+void unitTests_raster()
+{
+    sput_start_testing();
+    sput_set_output_stream(NULL);
+
+    sput_enter_suite("testClipLine()");
+    sput_run_test(testClipLine);
+    sput_leave_suite();
+
+    sput_enter_suite("testDrawLine()");
+    sput_run_test(testDrawLine);
+    sput_leave_suite();
+
+    sput_enter_suite("testWritePPM()");
+    sput_run_test(testWritePPM);
+    sput_leave_suite();
+
+    sput_enter_suite("testWritePNG()");
+    sput_run_test(testWritePNG);
+    sput_leave_suite();
+
+    sput_enter_suite("testWritePathImage()");
+    sput_run_test(testWritePathImage);
+    sput_leave_suite();
+
+    sput_finish_testing();
+}
+
+void testClipLine()
+{
+    float x0 = 1, y0 = 2, x1 = 8, y1 = 9;
+    sput_fail_unless(clipLine(&x0, &y0, &x1, &y1, 10, 10) && x0==1 && y0==2 && x1==8 && y1==9,
+                     "A line inside the frame should be left alone.");
+    x0 = -10; y0 = 5; x1 = 20; y1 = 5;
+    sput_fail_unless(clipLine(&x0, &y0, &x1, &y1, 10, 10) && floatCompare(x0, 0) && floatCompare(x1, 10) &&
+                     floatCompare(y0, 5) && floatCompare(y1, 5),
+                     "A line across the frame should be cut at both edges.");
+    x0 = -10; y0 = -10; x1 = -1; y1 = 20;
+    sput_fail_unless(!clipLine(&x0, &y0, &x1, &y1, 10, 10), "A line left of the frame should be dropped.");
+    x0 = 0; y0 = 0; x1 = NAN; y1 = 5;
+    sput_fail_unless(!clipLine(&x0, &y0, &x1, &y1, 10, 10), "A line to NaN should be dropped.");
+}
+
+void testDrawLine()
+{
+    framebuffer * f = initFramebuffer(10, 10);
+    drawLine(f, (point){{ 1, 1 }}, (point){{ 5, 1 }});
+    int lit = 0;
+    for(int p=0; p<10*10; ++p) lit += f->pixels[3*p]!=0;
+    sput_fail_unless(lit==5 && f->pixels[3*(1*10+1)]==0xFF && f->pixels[3*(1*10+5)]==0xFF,
+                     "A 4 pixel horizontal line should light 5 pixels, both ends included.");
+    drawLine(f, (point){{ -20, -20 }}, (point){{ 30, 30 }});
+    sput_fail_unless(f->pixels[0]==0xFF && f->pixels[3*(9*10+9)+2]==0xFF,
+                     "A diagonal through the frame should reach both corners.");
+    freeFramebuffer(f);
+}
+
+void testWritePPM()
+{
+    framebuffer * f = initFramebuffer(4, 3);
+    setPixel(f, 3, 2);
+    FILE * file = tmpfile();
+    sput_fail_unless(file!=NULL && writePPM(f, file), "Writing a PPM should succeed.");
+    if(file==NULL) return;
+    rewind(file);
+    char header[11];
+    sput_fail_unless(fread(header, 1, sizeof(header), file)==sizeof(header) &&
+                     strncmp(header, "P6\n4 3\n255\n", sizeof(header))==0, "A PPM should start with its header.");
+    fseek(file, 0, SEEK_END);
+    sput_fail_unless(ftell(file)==sizeof(header)+4*3*3, "Then 3 bytes a pixel.");
+    fseek(file, -1, SEEK_END);
+    sput_fail_unless(fgetc(file)==0xFF, "The bottom right pixel should be the last one written.");
+    fclose(file);
+    freeFramebuffer(f);
+}
+
+void testWritePNG()
+{
+    framebuffer * f = initFramebuffer(300, 200);
+    drawLine(f, (point){{ 0, 0 }}, (point){{ 299, 199 }});
+    FILE * file = tmpfile();
+    sput_fail_unless(file!=NULL && writePNG(f, file), "Writing a PNG should succeed.");
+    if(file==NULL) return;
+    long size = ftell(file);
+    rewind(file);
+    unsigned char start[8+8+13];//signature, IHDR length and type, its data
+    sput_fail_unless(fread(start, 1, sizeof(start), file)==sizeof(start) && start[0]==0x89 &&
+                     memcmp(start+1, "PNG", 3)==0 && memcmp(start+12, "IHDR", 4)==0,
+                     "A PNG should start with its signature and then the IHDR chunk.");
+    unsigned char expectedCRC[4];
+    putBigEndian(expectedCRC, pngCRC(0, start+12, 4+13));
+    unsigned char crc[4];
+    sput_fail_unless(fread(crc, 1, 4, file)==4 && memcmp(crc, expectedCRC, 4)==0,
+                     "The IHDR chunk's CRC should cover its type and data.");
+    sput_fail_unless(size < 300*200*3/20, "Long runs of black should compress to a fraction of the image.");
+    fseek(file, -12, SEEK_END);
+    unsigned char end[12];
+    sput_fail_unless(fread(end, 1, 12, file)==12 && memcmp(end+4, "IEND", 4)==0,
+                     "A PNG should finish with an IEND chunk.");
+    fclose(file);
+    freeFramebuffer(f);
+}
+
+void testWritePathImage()
+{
+    pointArray * line = initPath();
+    reservePath(line, 2);
+    line->array[0] = (point){{ 0, 0 }};
+    line->array[1] = (point){{ 10, 0 }};
+    line->numberOfPoints = 2;
+    pointArray * paths[] = { mockPathForDrawUnitTests(), line };
+    const char * names[] = { "The mock path", "A single horizontal FD, with no height to scale to," };
+    const char * imagePath = "rasterTest.ppm";
+    for(int i=0; i<2; ++i)
+    {
+        char str[MAX_ERROR_STRING_SIZE];
+        sprintf(str, "%s should be written as an image.", names[i]);
+        sput_fail_unless(writePathImage(paths[i], imagePath), str);
+        freePath(paths[i]);
+        FILE * file = fopen(imagePath, "rb");
+        sput_fail_unless(file!=NULL, "The image file should be there.");
+        if(file==NULL) continue;
+        int width, height, maxValue, lit = 0, c;
+        sput_fail_unless(fscanf(file, "P6 %d %d %d", &width, &height, &maxValue)==3 &&
+                         width==IMAGE_WIDTH && height==IMAGE_HEIGHT && maxValue==255,
+                         "The image should be IMAGE_WIDTH by IMAGE_HEIGHT.");
+        fgetc(file);
+        while((c = fgetc(file))!=EOF) lit += c!=0;
+        sprintf(str, "%s should have been drawn on it.", names[i]);
+        sput_fail_unless(lit>0, str);
+        fclose(file);
+        remove(imagePath);
+    }
+}
@@ -0,0 +1,364 @@
+//
+//  view.c
+//  logo
+//
+//  Maps a path on to window coordinates with one 2x3 affine matrix, worked out
+//  once per view rather than once per point.
+//
+#define _POSIX_C_SOURCE 200809L //for clock_gettime
+#include "main.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+//a run of points one thread transforms
+typedef struct viewChunk {
+    const point * in;
+    point * out;
+    int numberOfPoints;
+    const viewTransform * view;
+} viewChunk;
+
+#pragma mark prototypes
+void transformPoints(const point * in, point * out, int numberOfPoints, const viewTransform * view);
+void * transformChunk(void * chunk);
+void scaleEachPoint(const pointArray * path, const float scale[], const float offset[], float rotation, pointArray * out);
+double secondsSince(const struct timespec * start);
+pointArray * makeTestPath(int numberOfPoints);
+
+#pragma mark Unit Test Prototypes
+void testMakeViewTransform();
+void testTransformPath();
+void testParallelTransform();
+
+#pragma mark View Functions
+/**
+ Module interface,
+ Takes path and works out what the px/unit (FD) distance should be to fit the
+ entire path on to a window winSize px across. It also works out the translation vector
+ required to move the path into the centre of the window.
+ It returns a malloc'd scaler *
+ */
+scaler * getScaler(const int winSize[], pointArray * path)
+{
+    scaler * s = malloc(sizeof(scaler));
+    if(s==NULL)
+    {
+        printError("scaler * s = malloc(sizeof(scaler)) failed exiting.",__FILE__,__FUNCTION__,__LINE__);
+        return NULL;
+    }
+    float rMin[NUMBER_OF_DIMENSIONS]={0};
+    float rMax[NUMBER_OF_DIMENSIONS]={0};
+    for(int point = 0; point<path->numberOfPoints; ++point)
+    {
+        for(dimension dim = X; dim<=DIM_MAX; ++dim)
+        {
+            if(path->array[point].r[dim] > rMax[dim]) rMax[dim] = path->array[point].r[dim];
+            if(path->array[point].r[dim] < rMin[dim]) rMin[dim] = path->array[point].r[dim];
+        }
+    }
+    for(dimension dim = X; dim<=DIM_MAX; ++dim)
+    {
+        s->spanOfPath[dim] = rMax[dim]-rMin[dim];//FD units
+        s->centreOfPath[dim] = (rMax[dim]-rMin[dim])/2;//FD units
+        s->centreOfWindow[dim] = (float)winSize[dim]/2;//px
+        float span = s->spanOfPath[dim]>0 ? s->spanOfPath[dim] : 1;//a straight line has no span across it
+        s->scale[dim] = SCALE_AT_START*( (float)winSize[dim]  / span);//px per fd unit
+        s->offset[dim] = -s->scale[dim]*s->centreOfPath[dim] + s->centreOfWindow[dim] +
+            s->scale[dim]*s->spanOfPath[dim]/2;
+    }
+    if(!STRETCH_TO_FIT_WINDOW)//if we dont want to alter ratio then use the smallest scale for both.
+    {
+        if( s->scale[X] < s->scale[Y] ) s->scale[Y] = s->scale[X];
+        if( s->scale[X] > s->scale[Y] ) s->scale[X] = s->scale[Y];
+    }
+    s->rotation = 0;
+    s->changed = 1;
+    if(VERBOSE)
+    {
+        printf("scale: %f,%f\n", s->scale[X], s->scale[Y]);
+        printf("offset: %f,%f\n", s->offset[X], s->offset[Y]);
+    }
+    return s;
+}
+
+/**
+ Module interface,
+ The transform that scales a path by scale, rotates it by rotation radians, flips y so
+ it points down the window and then moves it by offset.
+ */
+viewTransform makeViewTransform(const float scale[], const float offset[], float rotation)
+{
+    double cosine = cos(rotation), sine = sin(rotation);
+    viewTransform view = {{
+        { cosine*scale[X], sine*scale[Y], offset[X] },
+        { sine*scale[X], -cosine*scale[Y], offset[Y] }
+    }};
+    return view;
+}
+
+/**
+ Module interface,
+ Writes view applied to each point of path in to out, which needs room for all of them
+ and may be path itself. Paths of VIEW_POINTS_PER_THREAD or more are split between up to
+ VIEW_THREADS threads.
+ */
+void transformPath(const pointArray * path, const viewTransform * view, pointArray * out)
+{
+    int numberOfThreads = path->numberOfPoints/VIEW_POINTS_PER_THREAD;
+    if(numberOfThreads>VIEW_THREADS) numberOfThreads = VIEW_THREADS;
+    if(numberOfThreads<=1)
+    {
+        transformPoints(path->array, out->array, path->numberOfPoints, view);
+        out->numberOfPoints = path->numberOfPoints;
+        return;
+    }
+    viewChunk chunks[VIEW_THREADS];
+    pthread_t threads[VIEW_THREADS];
+    int started[VIEW_THREADS] = {0};
+    int perThread = path->numberOfPoints/numberOfThreads;
+    for(int c=0; c<numberOfThreads; ++c)
+    {
+        int first = c*perThread;
+        chunks[c] = (viewChunk){ path->array+first, out->array+first,
+            c==numberOfThreads-1 ? path->numberOfPoints-first : perThread, view };
+    }
+    for(int c=1; c<numberOfThreads; ++c)//this thread does the first chunk itself
+    {
+        started[c] = pthread_create(&threads[c], NULL, transformChunk, &chunks[c])==0;
+        if(!started[c]) transformChunk(&chunks[c]);
+    }
+    transformChunk(&chunks[0]);
+    for(int c=1; c<numberOfThreads; ++c)
+    {
+        if(started[c]) pthread_join(threads[c], NULL);
+    }
+    out->numberOfPoints = path->numberOfPoints;
+}
+
+/**
+ Thread function, transforms one viewChunk.
+ */
+void * transformChunk(void * chunk)
+{
+    viewChunk * c = chunk;
+    transformPoints(c->in, c->out, c->numberOfPoints, c->view);
+    return NULL;
+}
+
+/**
+ The kernel. Works on the path's own x,y pairs, which is the layout the renderer takes,
+ so two points fill an SSE2 register: x' and y' come from the x's and y's broadcast
+ across their pair times the matrix's columns. Four points a loop, the rest one at a time.
+ */
+void transformPoints(const point * in, point * out, int numberOfPoints, const viewTransform * view)
+{
+    const float (*m)[3] = view->m;
+    int p = 0;
+#ifdef __SSE2__
+    const __m128 xColumn = _mm_setr_ps(m[X][0], m[Y][0], m[X][0], m[Y][0]);
+    const __m128 yColumn = _mm_setr_ps(m[X][1], m[Y][1], m[X][1], m[Y][1]);
+    const __m128 offset = _mm_setr_ps(m[X][2], m[Y][2], m[X][2], m[Y][2]);
+    const float * from = (const float *)in;
+    float * to = (float *)out;
+    for(; p+4<=numberOfPoints; p += 4)
+    {
+        __m128 a = _mm_loadu_ps(from+2*p);//x0 y0 x1 y1
+        __m128 b = _mm_loadu_ps(from+2*p+4);//x2 y2 x3 y3
+        __m128 ax = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2,2,0,0));
+        __m128 ay = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3,3,1,1));
+        __m128 bx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(2,2,0,0));
+        __m128 by = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3,3,1,1));
+        _mm_storeu_ps(to+2*p, _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, xColumn), _mm_mul_ps(ay, yColumn)), offset));
+        _mm_storeu_ps(to+2*p+4, _mm_add_ps(_mm_add_ps(_mm_mul_ps(bx, xColumn), _mm_mul_ps(by, yColumn)), offset));
+    }
+#endif
+    for(; p<numberOfPoints; ++p)
+    {
+        float x = in[p].r[X], y = in[p].r[Y];
+        out[p].r[X] = m[X][0]*x + m[X][1]*y + m[X][2];
+        out[p].r[Y] = m[Y][0]*x + m[Y][1]*y + m[Y][2];
+    }
+}
+
+#pragma mark Benchmark Functions
+/**
+ Module interface,
+ Times runs transforms of path by the kernel against working out each point the way
+ draw.c's scale() used to, with the rotation's cos and sin for every point, and prints both.
+ */
+void benchmarkView(pointArray * path, int runs)
+{
+    const float scale[NUMBER_OF_DIMENSIONS] = { 0.7f, 0.7f };
+    const float offset[NUMBER_OF_DIMENSIONS] = { SDL_WINDOW_WIDTH/2, SDL_WINDOW_HEIGHT/2 };
+    pointArray * reference = initPath();
+    pointArray * kernel = initPath();
+    reservePath(reference, path->numberOfPoints);
+    reservePath(kernel, path->numberOfPoints);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int run=0; run<runs; ++run)
+    {
+        scaleEachPoint(path, scale, offset, run*0.1f, reference);
+    }
+    double referenceSeconds = secondsSince(&start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int run=0; run<runs; ++run)
+    {
+        viewTransform view = makeViewTransform(scale, offset, run*0.1f);
+        transformPath(path, &view, kernel);
+    }
+    double kernelSeconds = secondsSince(&start);
+    float maxError = 0;
+    for(int p=0; p<path->numberOfPoints; ++p)
+    {
+        for(dimension dim=X; dim<=DIM_MAX; ++dim)
+        {
+            float error = fabsf(kernel->array[p].r[dim]-reference->array[p].r[dim]);
+            if(error>maxError) maxError = error;
+        }
+    }
+    printf("\nview benchmark over %d runs, %d points per run:\n", runs, path->numberOfPoints);
+    printf("per point: %f ms a transform\n", 1e3*referenceSeconds/runs);
+    printf("kernel:    %f ms a transform (%.1fx), max difference %g px\n\n", 1e3*kernelSeconds/runs,
+           kernelSeconds>0 ? referenceSeconds/kernelSeconds : 0, maxError);
+    freePath(reference);
+    freePath(kernel);
+}
+
+/**
+ The transform as scale() in draw.c did it before this module, kept for benchmarkView.
+ */
+void scaleEachPoint(const pointArray * path, const float scale[], const float offset[], float rotation, pointArray * out)
+{
+    for(int point = 0; point<path->numberOfPoints; ++point)
+    {
+        out->array[point].r[0] =
+            (cos(rotation)*(path->array[point].r[0]*scale[0]) +
+             sin(rotation)*(path->array[point].r[1]*scale[1])) +
+            offset[0];
+        out->array[point].r[1] =
+            (cos(rotation)*(-path->array[point].r[1]*scale[1]) +
+             sin(rotation)*(path->array[point].r[0]*scale[0])) +
+            offset[1];
+    }
+    out->numberOfPoints = path->numberOfPoints;
+}
+
+double secondsSince(const struct timespec * start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec-start->tv_sec) + 1e-9*(now.tv_nsec-start->tv_nsec);
+}
+
+#pragma mark Unit Tests
+void unitTests_view()
+{
+    sput_start_testing();
+    sput_set_output_stream(NULL);
+
+    sput_enter_suite("testMakeViewTransform()");
+    sput_run_test(testMakeViewTransform);
+    sput_leave_suite();
+
+    sput_enter_suite("testTransformPath()");
+    sput_run_test(testTransformPath);
+    sput_leave_suite();
+
+    sput_enter_suite("testParallelTransform()");
+    sput_run_test(testParallelTransform);
+    sput_leave_suite();
+
+    sput_finish_testing();
+}
+
+/* a path of numberOfPoints points spiralling out from the origin */
+pointArray * makeTestPath(int numberOfPoints)
+{
+    pointArray * path = initPath();
+    reservePath(path, numberOfPoints);
+    for(int p=0; p<numberOfPoints; ++p)
+    {
+        path->array[p].r[X] = p*0.01f*cosf(p*0.1f);
+        path->array[p].r[Y] = p*0.01f*sinf(p*0.1f);
+    }
+    path->numberOfPoints = numberOfPoints;
+    return path;
+}
+
+void testMakeViewTransform()
+{
+    const float scale[NUMBER_OF_DIMENSIONS] = { 2, 3 };
+    const float offset[NUMBER_OF_DIMENSIONS] = { 10, 20 };
+    viewTransform view = makeViewTransform(scale, offset, 0);
+    sput_fail_unless(floatCompare(view.m[X][0], 2) && floatCompare(view.m[X][1], 0) && floatCompare(view.m[X][2], 10),
+                     "With no rotation x' should be x scaled and moved.");
+    sput_fail_unless(floatCompare(view.m[Y][0], 0) && floatCompare(view.m[Y][1], -3) && floatCompare(view.m[Y][2], 20),
+                     "With no rotation y' should be y scaled, flipped and moved.");
+    view = makeViewTransform(scale, offset, M_PI/2);
+    sput_fail_unless(floatCompare(view.m[X][0], 0) && floatCompare(view.m[X][1], 3) &&
+                     floatCompare(view.m[Y][0], 2) && floatCompare(view.m[Y][1], 0),
+                     "A quarter turn should swap the axes.");
+}
+
+void testTransformPath()
+{
+    const float scale[NUMBER_OF_DIMENSIONS] = { 1.5f, 1.5f };
+    const float offset[NUMBER_OF_DIMENSIONS] = { 450, 330 };
+    pointArray * path = makeTestPath(103);//not a whole number of the kernel's four point steps
+    pointArray * expected = initPath();
+    pointArray * actual = initPath();
+    reservePath(expected, path->numberOfPoints);
+    reservePath(actual, path->numberOfPoints);
+    scaleEachPoint(path, scale, offset, 1.2f, expected);
+    viewTransform view = makeViewTransform(scale, offset, 1.2f);
+    transformPath(path, &view, actual);
+    int matches = actual->numberOfPoints==path->numberOfPoints;
+    for(int p=0; p<path->numberOfPoints; ++p)
+    {
+        matches = matches && floatCompare(actual->array[p].r[X], expected->array[p].r[X]) &&
+            floatCompare(actual->array[p].r[Y], expected->array[p].r[Y]);
+    }
+    sput_fail_unless(matches, "Every point, the last three too, should land where scale() put it.");
+
+    transformPath(path, &view, path);
+    matches = 1;
+    for(int p=0; p<path->numberOfPoints; ++p)
+    {
+        matches = matches && actual->array[p].r[X]==path->array[p].r[X] && actual->array[p].r[Y]==path->array[p].r[Y];
+    }
+    sput_fail_unless(matches, "Transforming a path in place should give the same points.");
+    freePath(path);
+    freePath(expected);
+    freePath(actual);
+}
+
+void testParallelTransform()
+{
+    const float scale[NUMBER_OF_DIMENSIONS] = { 0.5f, 0.5f };
+    const float offset[NUMBER_OF_DIMENSIONS] = { 450, 330 };
+    int numberOfPoints = VIEW_THREADS*VIEW_POINTS_PER_THREAD+7;
+    pointArray * path = makeTestPath(numberOfPoints);
+    pointArray * serial = initPath();
+    pointArray * parallel = initPath();
+    reservePath(serial, numberOfPoints);
+    reservePath(parallel, numberOfPoints);
+    viewTransform view = makeViewTransform(scale, offset, 4);
+    transformPoints(path->array, serial->array, numberOfPoints, &view);
+    transformPath(path, &view, parallel);
+    int matches = parallel->numberOfPoints==numberOfPoints;
+    for(int p=0; p<numberOfPoints; ++p)
+    {
+        matches = matches && parallel->array[p].r[X]==serial->array[p].r[X] && parallel->array[p].r[Y]==serial->array[p].r[Y];
+    }
+    sput_fail_unless(matches, "Splitting the path between threads should not change a single point.");
+    freePath(path);
+    freePath(serial);
+    freePath(parallel);
+}
@@ -0,0 +1,418 @@
+//
+//  vm.c
+//  logo
+//
+//  Compiles a validated instruction tree into a flat bytecode array and runs
+//  it on a small stack machine.
+//
+#include "main.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+typedef enum opcode {
+    opcPUSH,     //push value
+    opcLOAD,     //push value*var
+    opcSTORE,    //pop into var
+    opcADD, opcSUB, opcMUL, opcDIV, opcPOW,
+    opcFD, opcLT, opcRT,//pop the amount and add it to the symList
+    opcLOOPBEGIN,//pop TO and FROM, start looping var or jump past the loop. value 1 if it is repeatable
+    opcLOOPEND,  //step var, jump back to the start of the body while var<=TO
+    opcHALT
+} opcode;
+
+typedef struct bytecodeInstruction {
+    unsigned char op;
+    char var;
+    int jump;//index of the instruction to jump to
+    float value;
+} bytecodeInstruction;
+
+typedef struct bytecode {
+    bytecodeInstruction * array;
+    int length, capacity;
+    int maxStackDepth, maxLoopDepth;//sizes the VM's stacks so it never has to grow them
+} bytecode;
+
+typedef struct loopState {
+    int iter;
+    float to;
+    int trips;//if the loop is being kept as a REPEAT, its body is then run once
+    unsigned long repeatAt;//index of its symREPEAT
+} loopState;
+
+#pragma mark prototypes
+bytecode * compileProgram(instructionList * program);
+int compileInstrctlst(bytecode * code, instructionList * list, int * depth, int loopDepth);
+int compileVarnum(bytecode * code, varnum operand, int * depth);
+int emitBytecode(bytecode * code, opcode op, char var, float value);
+symbolList * runBytecode(bytecode * code);
+void freeBytecode(bytecode * code);
+void printBytecode(bytecode * code);
+
+#pragma mark Unit Test Prototypes
+void testCompileProgram();
+void testRunBytecode();
+
+#pragma mark VM functions
+/**
+ Module interface,
+ Compiles program to bytecode, runs it and returns the resulting symList.
+ */
+symbolList * runProgramOnVM(instructionList * program)
+{
+    bytecode * code = compileProgram(program);
+    if(code==NULL) return NULL;
+    if(VERBOSE) printBytecode(code);
+    symbolList * symList = runBytecode(code);
+    freeBytecode(code);
+    return symList;
+}
+
+/**
+ Runs program runs times with the tree walker and then on the VM, printing
+ the time each takes and the number of symbols produced per second.
+ */
+void benchmarkVM(instructionList * program, int runs)
+{
+    unsigned long symbols = 0;
+    clock_t start = clock();
+    for(int run=0; run<runs; ++run)
+    {
+        symbolList * symList = executeProgram(program);
+        symbols = symList->length;
+        freeSymList(symList);
+    }
+    double treeSeconds = (double)(clock()-start)/CLOCKS_PER_SEC;
+
+    start = clock();
+    bytecode * code = compileProgram(program);
+    for(int run=0; run<runs; ++run)
+    {
+        symbolList * symList = runBytecode(code);
+        freeSymList(symList);
+    }
+    double vmSeconds = (double)(clock()-start)/CLOCKS_PER_SEC;
+    printf("\nbenchmark over %d runs, %lu symbols per run, %d bytecode instructions:\n", runs, symbols, code->length);
+    printf("tree walker: %f s (%.0f symbols/s)\n", treeSeconds, treeSeconds>0 ? symbols*runs/treeSeconds : 0);
+    printf("bytecode VM: %f s (%.0f symbols/s)\n\n", vmSeconds, vmSeconds>0 ? symbols*runs/vmSeconds : 0);
+    freeBytecode(code);
+}
+
+/**
+ Flattens program in to a bytecode array terminated by opcHALT.
+ */
+bytecode * compileProgram(instructionList * program)
+{
+    bytecode * code = malloc(sizeof(bytecode));
+    if(code==NULL)
+    {
+        printError("bytecode * code = malloc(sizeof(bytecode)) failed exiting.",__FILE__,__FUNCTION__,__LINE__);
+        exit(1);
+    }
+    code->array = NULL;
+    code->length = 0;
+    code->capacity = 0;
+    code->maxStackDepth = 0;
+    code->maxLoopDepth = 0;
+    int depth = 0;
+    if(compileInstrctlst(code, program, &depth, 0)==0)
+    {
+        freeBytecode(code);
+        return NULL;
+    }
+    emitBytecode(code, opcHALT, '\0', 0);
+    return code;
+}
+
+/**
+ Appends the bytecode for each instruction in list to code. depth tracks how many
+ values are on the VM stack and loopDepth how many loops enclose list.
+ Returns 1 if successful, 0 if not.
+ */
+int compileInstrctlst(bytecode * code, instructionList * list, int * depth, int loopDepth)
+{
+    static const opcode operatorOpcodes[] = {
+        ['+'] = opcADD, ['-'] = opcSUB, ['*'] = opcMUL, ['/'] = opcDIV, ['^'] = opcPOW
+    };
+    for(int i=0; i<list->numberOfInstructions; ++i)
+    {
+        instruction * current = &list->array[i];
+        switch(current->sym)
+        {
+            case symFD:
+            case symLT:
+            case symRT:
+            {
+                compileVarnum(code, current->operand[0], depth);
+                opcode op = current->sym==symFD ? opcFD : current->sym==symLT ? opcLT : opcRT;
+                emitBytecode(code, op, '\0', 0);
+                --*depth;
+                break;
+            }
+            case symSET:
+            {
+                for(int t=0; t<current->expression.numberOfTerms; ++t)
+                {
+                    polishTerm * term = &current->expression.terms[t];
+                    if(term->isOperator)
+                    {
+                        emitBytecode(code, operatorOpcodes[term->op], '\0', 0);
+                        --*depth;
+                    }
+                    else
+                    {
+                        compileVarnum(code, term->operand, depth);
+                    }
+                }
+                emitBytecode(code, opcSTORE, current->var, 0);
+                --*depth;
+                break;
+            }
+            case symDO:
+            {
+                compileVarnum(code, current->operand[0], depth);
+                compileVarnum(code, current->operand[1], depth);
+                int loopBegin = emitBytecode(code, opcLOOPBEGIN, current->var, current->repeatable) - 1;
+                *depth -= 2;
+                if(loopDepth+1 > code->maxLoopDepth) code->maxLoopDepth = loopDepth+1;
+                if(compileInstrctlst(code, current->body, depth, loopDepth+1)==0) return 0;
+                int loopEnd = emitBytecode(code, opcLOOPEND, current->var, 0) - 1;
+                code->array[loopEnd].jump = loopBegin+1;
+                code->array[loopBegin].jump = loopEnd+1;
+                break;
+            }
+            default:
+            {
+                printError("instructionList contained an unexpected symbol.", __FILE__, __FUNCTION__, __LINE__);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/**
+ Appends the push for operand to code.
+ */
+int compileVarnum(bytecode * code, varnum operand, int * depth)
+{
+    if(++*depth > code->maxStackDepth) code->maxStackDepth = *depth;
+    if(operand.var=='\0') return emitBytecode(code, opcPUSH, '\0', operand.value);
+    return emitBytecode(code, opcLOAD, operand.var, operand.value);
+}
+
+/**
+ Appends one instruction to code, growing the array geometrically.
+ Returns the new length of code.
+ */
+int emitBytecode(bytecode * code, opcode op, char var, float value)
+{
+    if(code->length==code->capacity)
+    {
+        int newCapacity = code->capacity ? 2*code->capacity : 64;
+        bytecodeInstruction * tmp = realloc(code->array, newCapacity*sizeof(bytecodeInstruction));
+        if(tmp==NULL)
+        {
+            printError("realloc failed exiting.",__FILE__,__FUNCTION__,__LINE__);
+            exit(1);
+        }
+        code->array = tmp;
+        code->capacity = newCapacity;
+    }
+    bytecodeInstruction * newInstruction = &code->array[code->length];
+    newInstruction->op = op;
+    newInstruction->var = var;
+    newInstruction->jump = 0;
+    newInstruction->value = value;
+    return ++code->length;
+}
+
+/**
+ The dispatch loop. Variables, the value stack and the loop stack are all local so
+ the hot state stays in registers, and the stacks are sized by the compiler so
+ nothing is checked or grown while running.
+ */
+symbolList * runBytecode(bytecode * code)
+{
+    symbolList * symList = initSymList();
+    float vars['Z'+1] = { 0 };
+    float * stack = malloc((code->maxStackDepth+1)*sizeof(float));
+    loopState * loops = malloc((code->maxLoopDepth+1)*sizeof(loopState));
+    if(stack==NULL || loops==NULL)
+    {
+        printError("malloc failed exiting.",__FILE__,__FUNCTION__,__LINE__);
+        exit(1);
+    }
+    int sp = 0, lp = 0;
+    const bytecodeInstruction * pc = code->array;
+    while(pc->op!=opcHALT)
+    {
+        switch(pc->op)
+        {
+            case opcPUSH: stack[sp++] = pc->value; break;
+            case opcLOAD: stack[sp++] = pc->value*vars[(int)pc->var]; break;
+            case opcSTORE: vars[(int)pc->var] = stack[--sp]; break;
+            case opcADD: --sp; stack[sp-1] = stack[sp-1] + stack[sp]; break;
+            case opcSUB: --sp; stack[sp-1] = stack[sp-1] - stack[sp]; break;
+            case opcMUL: --sp; stack[sp-1] = stack[sp-1] * stack[sp]; break;
+            case opcDIV: --sp; stack[sp-1] = stack[sp-1] / stack[sp]; break;
+            case opcPOW: --sp; stack[sp-1] = pow(stack[sp-1], stack[sp]); break;
+            case opcFD:
+            case opcLT:
+            case opcRT:
+            {
+                float value = stack[--sp];
+                if(value!=0) appendSym(symList, pc->op==opcFD ? symFD : pc->op==opcLT ? symLT : symRT, value);
+                break;
+            }
+            case opcLOOPBEGIN:
+            {
+                float to = stack[--sp];
+                int iter = stack[--sp];
+                if(!(iter<=to))//a NaN bound skips the loop, as in executeInstrctlst
+                {
+                    pc = code->array + pc->jump;
+                    continue;
+                }
+                loops[lp].iter = iter;
+                loops[lp].to = to;
+                loops[lp].trips = repeatTrips(pc->value!=0, iter, to);
+                if(loops[lp].trips)
+                {
+                    loops[lp].repeatAt = symList->length;
+                    appendSym(symList, symREPEAT, loops[lp].trips);
+                }
+                ++lp;
+                vars[(int)pc->var] = iter;
+                break;
+            }
+            case opcLOOPEND:
+            {
+                loopState * loop = &loops[lp-1];
+                if(loop->trips)//the same as finishRepeat()
+                {
+                    unsigned long bodyLength = symList->length-loop->repeatAt-1;
+                    if(bodyLength==0) symList->length = loop->repeatAt;
+                    else appendSym(symList, symENDREPEAT, bodyLength);
+                    vars[(int)pc->var] = loop->iter+loop->trips-1;
+                    --lp;
+                    break;
+                }
+                if(++loop->iter <= loop->to)
+                {
+                    vars[(int)pc->var] = loop->iter;
+                    pc = code->array + pc->jump;
+                    continue;
+                }
+                --lp;
+                break;
+            }
+        }
+        ++pc;
+    }
+    free(stack);
+    free(loops);
+    return symList;
+}
+
+void freeBytecode(bytecode * code)
+{
+    free(code->array);
+    free(code);
+}
+
+/**
+ Prints a listing of code to stdout.
+ */
+void printBytecode(bytecode * code)
+{
+    static const char * names[] = {
+        "PUSH", "LOAD", "STORE", "ADD", "SUB", "MUL", "DIV", "POW",
+        "FD", "LT", "RT", "LOOPBEGIN", "LOOPEND", "HALT"
+    };
+    printf("\nbytecode (stack %d, loops %d):\n", code->maxStackDepth, code->maxLoopDepth);
+    for(int i=0; i<code->length; ++i)
+    {
+        bytecodeInstruction * current = &code->array[i];
+        printf("%4d  %-10s", i, names[current->op]);
+        if(current->var) printf(" %c", current->var);
+        if(current->op==opcPUSH || current->op==opcLOAD) printf(" %f", current->value);
+        if(current->op==opcLOOPBEGIN || current->op==opcLOOPEND) printf(" -> %d", current->jump);
+        printf("\n");
+    }
+}
+
+#pragma mark Unit Test Functions
+void unitTests_vm()
+{
+    sput_start_testing();
+    sput_set_output_stream(NULL);
+
+    sput_enter_suite("testCompileProgram()");
+    sput_run_test(testCompileProgram);
+    sput_leave_suite();
+
+    sput_enter_suite("testRunBytecode()");
+    sput_run_test(testRunBytecode);
+    sput_leave_suite();
+
+    sput_finish_testing();
+}
+
+void testCompileProgram()
+{
+    char program[] = "{ DO A FROM 1 TO 3 { SET B := A 2 * ; FD B } }";
+    instructionList * list = parseProgram(program, strlen(program));
+    bytecode * code = compileProgram(list);
+    opcode expected[] = {
+        opcPUSH, opcPUSH, opcLOOPBEGIN,
+        opcLOAD, opcPUSH, opcMUL, opcSTORE,
+        opcLOAD, opcFD,
+        opcLOOPEND, opcHALT
+    };
+    int matches = code->length==sizeof(expected)/sizeof(opcode);
+    for(int i=0; matches && i<code->length; ++i)
+    {
+        matches = code->array[i].op==expected[i];
+    }
+    sput_fail_unless(matches, "Checks the opcodes a loop containing a SET and an FD compiles to.");
+    sput_fail_unless(code->array[2].jump==10 && code->array[9].jump==3,
+                     "LOOPBEGIN should jump past LOOPEND and LOOPEND back to the start of the body.");
+    sput_fail_unless(code->maxStackDepth==2 && code->maxLoopDepth==1,
+                     "The compiler should size the stacks for the deepest expression and loop nesting.");
+    freeBytecode(code);
+    freeInstructionList(list);
+}
+
+void testRunBytecode()
+{
+    char * programs[] = {
+        "{ FD 5 RT 90 FD 5 RT 90 FD 5 RT 90 FD 5 }",
+        "{ DO A FROM 1 TO 8 { FD A RT 45 } LT 10 FD -A }",
+        "{ DO A FROM 3 TO 1 { FD A } FD 2 }",
+        "{ DO A FROM -2 TO 2 { DO B FROM 1 TO A { SET C := A B * 2 / 1 + ; FD C RT B } } }",
+        "{ SET A := 3 2 ^ 1 - ; DO B FROM 1 TO A { FD B } }",
+        "{ DO A FROM 1 TO 4 { DO B FROM 1 TO 3 { FD 5 } RT 90 DO C FROM 1 TO 2 { SET D := 1 ; } } FD D }",
+        "{ SET B := 0 0 / ; DO A FROM 1 TO B { FD 10 RT 90 } FD 3 }"//a NaN bound, the body never runs
+    };
+    for(int i=0; i<(int)(sizeof(programs)/sizeof(char *)); ++i)
+    {
+        instructionList * list = parseProgram(programs[i], strlen(programs[i]));
+        symbolList * expected = executeProgram(list);
+        symbolList * actual = runProgramOnVM(list);
+        int matches = expected->length==actual->length;
+        for(unsigned long j=0; matches && j<expected->length; ++j)
+        {
+            matches = expected->syms[j]==actual->syms[j] && expected->values[j]==actual->values[j];
+        }
+        char str[MAX_ERROR_STRING_SIZE];
+        sprintf(str, "The VM should produce exactly the same symList as the tree walker for %s", programs[i]);
+        sput_fail_unless(matches, str);
+        freeSymList(expected);
+        freeSymList(actual);
+        freeInstructionList(list);
+    }
+}